@@ -0,0 +1,54 @@
+"""
+Per-byte cost of ivtt and bitrans on plain text (user-009).
+
+ivtt runs on 25 MB of the ZL transliteration repeated, with the
+default options and with -x7. bitrans runs on 8 MB of the same with
+a rules file that only defines comments, so that the time is that of
+reading, classifying and writing the characters.
+
+    python3 benchmarks/bench_chartab.py 5cb3e98~1 5cb3e98
+"""
+
+import os
+
+import benchutil
+
+RULES = """##BIT  Eva- v101
+<(comment)>
+#(comment)
+{(comment)}
+!(comment)
+%(comment)
+"""
+
+
+def main():
+    args = benchutil.parser(__doc__.split('\n\n')[0]).parse_args()
+    wdir = benchutil.workdir(args)
+    big = os.path.join(wdir, 'corpus25.txt')
+    benchutil.corpus(big, 25 << 20)
+    small = os.path.join(wdir, 'corpus8.txt')
+    benchutil.corpus(small, 8 << 20)
+    rules = os.path.join(wdir, 'norules.bit')
+    with open(rules, 'w') as f:
+        f.write(RULES)
+
+    versions = benchutil.builds(args, 'ivtt', wdir)
+    size = os.path.getsize(big)
+    print('ivtt, %d bytes, best user+sys of %d runs' % (size, args.runs))
+    for k, opts in enumerate(['', '-x7']):
+        benchutil.timing(opts or 'default', versions,
+                         lambda exe, out: [exe] + opts.split() + [big, out],
+                         args.runs, 3, os.path.join(wdir, 'ivtt%d' % k), nbytes=size)
+
+    versions = benchutil.builds(args, 'bitrans', wdir)
+    size = os.path.getsize(small)
+    print('bitrans, %d bytes, best user+sys of %d runs' % (size, args.runs))
+    benchutil.timing('comments only', versions,
+                     lambda exe, out: [exe, '-1', '-f', rules, small, out],
+                     args.runs, 0, os.path.join(wdir, 'bitrans'), nbytes=size)
+    benchutil.cleanup(args, wdir)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,35 @@
+"""
+Timing of ivtt on 32 MB of text in lines of 1 KB, 64 KB and 1 MB
+(user-011).
+
+Versions with fixed line buffers reject the longer lines, which is
+reported as a failed run.
+
+    python3 benchmarks/bench_longlines.py b08da51~1 b08da51
+"""
+
+import os
+
+import benchutil
+
+LENGTHS = [('1 KB', 1 << 10), ('64 KB', 1 << 16), ('1 MB', 1 << 20)]
+
+
+def main():
+    args = benchutil.parser(__doc__.split('\n\n')[0]).parse_args()
+    wdir = benchutil.workdir(args)
+    versions = benchutil.builds(args, 'ivtt', wdir)
+    print('ivtt, 32 MB, best user+sys of %d runs' % args.runs)
+    for name, length in LENGTHS:
+        inp = os.path.join(wdir, 'lines%d.txt' % length)
+        benchutil.ivtff(inp, 32 << 20, length, dense=0.05)
+        for opts in ['', '-x7']:
+            benchutil.timing(('%s %s' % (name, opts)).strip(), versions,
+                             lambda exe, out: [exe] + opts.split() + [inp, out],
+                             args.runs, 3, os.path.join(wdir, 'l%d%s' % (length, opts)))
+        os.remove(inp)
+    benchutil.cleanup(args, wdir)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,33 @@
+"""
+Timing of ivtt output option sets on 25 MB of text (user-013).
+
+The input is the ZL transliteration repeated. The option sets cover
+the presets and the comment, paragraph and transliterator options
+that decide what PutLine writes.
+
+    python3 benchmarks/bench_output.py 3477473~1 3477473
+"""
+
+import os
+
+import benchutil
+
+CASES = ['-x0', '-x1', '-x3', '-x7', '-c3 -p2', '-tH']
+
+
+def main():
+    args = benchutil.parser(__doc__.split('\n\n')[0]).parse_args()
+    wdir = benchutil.workdir(args)
+    versions = benchutil.builds(args, 'ivtt', wdir)
+    inp = os.path.join(wdir, 'corpus25.txt')
+    benchutil.corpus(inp, 25 << 20)
+    print('ivtt, %d bytes, best user+sys of %d runs' % (os.path.getsize(inp), args.runs))
+    for k, opts in enumerate(CASES):
+        benchutil.timing(opts, versions,
+                         lambda exe, out: [exe] + opts.split() + [inp, out],
+                         args.runs, 3, os.path.join(wdir, 'case%d' % k))
+    benchutil.cleanup(args, wdir)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,34 @@
+"""
+Timing of ivtt on lines dense in uncertain readings (user-007).
+
+The input has 4000 text lines of about 3800 characters, in which
+about every other word has an alternate reading [a:b], a ligature
+{ch} or an unreadable ?. These are the lines on which ProcRead used
+to shift the rest of the line for every group.
+
+    python3 benchmarks/bench_procread.py 05b3adf~1 05b3adf
+"""
+
+import os
+
+import benchutil
+
+CASES = ['-u1', '-u2', '-u3', '-u1 -l4']
+
+
+def main():
+    args = benchutil.parser(__doc__.split('\n\n')[0]).parse_args()
+    wdir = benchutil.workdir(args)
+    versions = benchutil.builds(args, 'ivtt', wdir)
+    inp = os.path.join(wdir, 'dense.txt')
+    benchutil.ivtff(inp, 4000 * 3800, 3800, dense=0.5, nlines=40)
+    print('ivtt, %d bytes, best user+sys of %d runs' % (os.path.getsize(inp), args.runs))
+    for k, opts in enumerate(CASES):
+        benchutil.timing(opts, versions,
+                         lambda exe, out: [exe] + opts.split() + [inp, out],
+                         args.runs, 3, os.path.join(wdir, 'case%d' % k))
+    benchutil.cleanup(args, wdir)
+
+
+if __name__ == '__main__':
+    main()
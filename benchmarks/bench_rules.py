@@ -0,0 +1,67 @@
+"""
+Timing of bitrans with large rules files (user-024).
+
+The rules file is a dictionary of random words, each replaced by its
+reverse in upper case, with a sorting block record every 1000 rules.
+bitrans runs once on a single line, which is mostly the time to read,
+check and sort the rules, and once on the first 3000 lines of
+texts/ZL_raw.txt.
+
+Versions with fixed rule tables need them raised to load the larger
+dictionaries, e.g.:
+
+    python3 benchmarks/bench_rules.py -D MAXDEF=200000 -D MAXRUL=4000000 a66bcd4~1 a66bcd4
+"""
+
+import os
+import random
+
+import benchutil
+
+
+def dictionary(path, nrule, block=1000, seed=1):
+    """Write a rules file of nrule distinct words with a block record every block rules."""
+    rnd = random.Random(seed)
+    seen = set()
+    with open(path, 'w') as f:
+        f.write('##BIT\n')
+        while len(seen) < nrule:
+            word = ''.join(rnd.choice('abcdefghiklmnopqrstuy') for k in range(rnd.randint(3, 9)))
+            if word in seen:
+                continue
+            seen.add(word)
+            f.write('%s %s\n' % (word, word[::-1].upper()))
+            if len(seen) % block == 0:
+                f.write('------\n')
+
+
+def main():
+    p = benchutil.parser(__doc__.split('\n\n')[0])
+    p.add_argument('-s', '--sizes', default='1000,10000,100000',
+                   help='numbers of rules, separated by commas (default 1000,10000,100000)')
+    args = p.parse_args()
+    wdir = benchutil.workdir(args)
+    versions = benchutil.builds(args, 'bitrans', wdir)
+
+    one = os.path.join(wdir, 'one.txt')
+    with open(one, 'w') as f:
+        f.write('qokeedy daiin\n')
+    text = os.path.join(wdir, 'zl3000.txt')
+    with open(os.path.join(benchutil.REPO, 'texts', 'ZL_raw.txt'), 'rb') as fi:
+        lines = fi.readlines()[:3000]
+    with open(text, 'wb') as f:
+        f.writelines(lines)
+
+    print('bitrans, best user+sys of %d runs' % args.runs)
+    for n in (int(k) for k in args.sizes.split(',')):
+        rules = os.path.join(wdir, 'dict%d.bit' % n)
+        dictionary(rules, n)
+        for name, inp in (('load', one), ('3000 lines', text)):
+            benchutil.timing('%d %s' % (n, name), versions,
+                             lambda exe, out: [exe, '-1', '-m2', '-f', rules, inp, out],
+                             args.runs, 0, os.path.join(wdir, 'r%d%s' % (n, name[0])))
+    benchutil.cleanup(args, wdir)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,227 @@
+"""
+Shared helpers for the timing scripts in this folder.
+
+Each script compares versions of ivtt or bitrans, given either as
+git revisions (built from software/ at that revision) or as paths
+to ready-made binaries. It generates its input with a fixed seed,
+prints the best user+sys time over several runs for each version,
+and checks that every version writes the same output as the first.
+
+Example, comparing a commit with its parent:
+
+    python3 benchmarks/bench_procread.py 05b3adf~1 05b3adf
+"""
+
+import argparse
+import filecmp
+import os
+import random
+import re
+import resource
+import shutil
+import subprocess
+import sys
+import tempfile
+
+REPO = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# Syllables of the synthetic Eva words
+SYLLABLES = ['qo', 'o', 'ch', 'sh', 'e', 'ee', 'd', 'k', 't', 'l', 'r', 's',
+             'y', 'a', 'i', 'in', 'iin', 'aiin', 'ol', 'al', 'ar', 'or',
+             'dy', 'ey', 'eey', 'cth', 'ckh', 'ok', 'ot', 'p', 'f']
+
+
+def parser(description):
+    """Return an argument parser with the options common to all scripts."""
+    p = argparse.ArgumentParser(description=description)
+    p.add_argument('versions', nargs='+',
+                   help='git revisions or binaries to compare, the first is the reference')
+    p.add_argument('-n', '--runs', type=int, default=5,
+                   help='runs per measurement, the best is kept (default 5)')
+    p.add_argument('-w', '--workdir',
+                   help='keep the builds and generated files here (default: a temporary folder)')
+    p.add_argument('-D', '--define', action='append', default=[], metavar='NAME=VALUE',
+                   help='replace a #define in the sources built from revisions, '
+                        'e.g. to raise the table sizes of old versions')
+    return p
+
+
+def workdir(args):
+    """Return the folder for builds and generated files."""
+    if args.workdir:
+        os.makedirs(args.workdir, exist_ok=True)
+        return args.workdir
+    return tempfile.mkdtemp(prefix='bench')
+
+
+def cleanup(args, wdir):
+    """Remove the temporary folder, unless it was given."""
+    if not args.workdir:
+        shutil.rmtree(wdir, ignore_errors=True)
+
+
+def build(spec, prog, wdir, defines=()):
+    """Return the path of program prog ('ivtt' or 'bitrans') for spec,
+    which is either an executable or a git revision."""
+    if os.path.isfile(spec) and os.access(spec, os.X_OK):
+        return os.path.abspath(spec)
+    tag = re.sub(r'\W', '_', spec)
+    bdir = os.path.join(wdir, 'build_' + tag)
+    os.makedirs(bdir, exist_ok=True)
+    for name in (prog + '.c', prog + '.h'):
+        show = subprocess.run(['git', '-C', REPO, 'show', '%s:software/%s' % (spec, name)],
+                              capture_output=True)
+        if show.returncode != 0:
+            if name.endswith('.c'):
+                sys.exit('Cannot find software/%s at %s' % (name, spec))
+            continue
+        src = show.stdout.decode('latin-1')
+        for d in defines:
+            key, value = d.split('=', 1)
+            src = re.sub(r'(?m)^#define %s\b.*$' % key, '#define %s %s' % (key, value), src)
+        with open(os.path.join(bdir, name), 'w', encoding='latin-1') as f:
+            f.write(src)
+    exe = os.path.join(bdir, prog)
+    subprocess.run(['cc', '-O2', '-w', '-o', exe, os.path.join(bdir, prog + '.c'), '-lpthread'],
+                   check=True)
+    return exe
+
+
+def builds(args, prog, wdir):
+    """Return the list of (name, path) of the versions to compare."""
+    return [(v, build(v, prog, wdir, args.define)) for v in args.versions]
+
+
+def run(cmd, stdin=None, stdout=None):
+    """Run cmd once. Return its exit code and its user+sys time."""
+    fin = open(stdin, 'rb') if stdin else subprocess.DEVNULL
+    fout = open(stdout, 'wb') if stdout else subprocess.DEVNULL
+    r0 = resource.getrusage(resource.RUSAGE_CHILDREN)
+    code = subprocess.run(cmd, stdin=fin, stdout=fout, stderr=subprocess.DEVNULL).returncode
+    r1 = resource.getrusage(resource.RUSAGE_CHILDREN)
+    if stdin:
+        fin.close()
+    if stdout:
+        fout.close()
+    return code, (r1.ru_utime - r0.ru_utime) + (r1.ru_stime - r0.ru_stime)
+
+
+def best(cmd, runs, stdin=None):
+    """Return the exit code of cmd and its best user+sys time over runs,
+    the output being discarded."""
+    times = []
+    for i in range(runs):
+        code, t = run(cmd, stdin)
+        times.append(t)
+    return code, min(times)
+
+
+def compare(versions, outputs):
+    """Print whether the output of each version matches the first one."""
+    ref = outputs[0]
+    for (name, exe), out in zip(versions[1:], outputs[1:]):
+        if out is None or ref is None:
+            print('  %s: no output to compare' % name)
+        elif filecmp.cmp(ref, out, shallow=False):
+            print('  %s: same output as %s' % (name, versions[0][0]))
+        else:
+            print('  %s: OUTPUT DIFFERS from %s' % (name, versions[0][0]))
+
+
+def timing(label, versions, cmds, runs, okcode, base, stdin=None, nbytes=0):
+    """Time each version on one case and print a line for it. cmds(exe, out)
+    gives the command of a version writing its output to file out. The
+    outputs are kept as base.<k>.out, and that of the first version is
+    compared with the others. A version that does not end with exit
+    code okcode is reported as failed. With nbytes, the time per byte
+    of input is also given."""
+    cols = []
+    outputs = []
+    for k, (name, exe) in enumerate(versions):
+        code, t = best(cmds(exe, os.devnull), runs, stdin)
+        if code != okcode:
+            cols.append('failed (exit %d)' % code)
+            outputs.append(None)
+            continue
+        if nbytes:
+            cols.append('%.3f s (%.1f ns/byte)' % (t, t * 1e9 / nbytes))
+        else:
+            cols.append('%.3f s' % t)
+        out = '%s.%d.out' % (base, k)
+        run(cmds(exe, out), stdin)
+        outputs.append(out)
+    print('%-18s %s' % (label, ' -> '.join(cols)))
+    compare(versions, outputs)
+
+
+def words(rnd, nword):
+    """Return nword synthetic Eva words."""
+    return [''.join(rnd.choice(SYLLABLES) for k in range(rnd.randint(1, 4)))
+            for i in range(nword)]
+
+
+def uncertain(rnd, word, dense):
+    """Mark word with the uncertain readings of IVTFF: an alternate
+    reading [a:b], a ligature {ch} or an unreadable ?, each with
+    probability dense."""
+    if rnd.random() < dense:
+        k = rnd.randrange(len(word))
+        word = word[:k] + '[%s:%s]' % (word[k], rnd.choice('aoeyk')) + word[k+1:]
+    if rnd.random() < dense:
+        k = rnd.randrange(len(word) + 1)
+        word = word[:k] + '{ch}' + word[k:]
+    if rnd.random() < dense:
+        k = rnd.randrange(len(word) + 1)
+        word = word[:k] + '?' + word[k:]
+    return word
+
+
+def ivtff(path, nbytes, linelen, dense=0.0, seed=1, nlines=40):
+    """Write a synthetic IVTFF file of about nbytes, with text lines of
+    about linelen characters, nlines to a page. Words are separated by
+    dots, with some uncertain spaces (commas) and inline comments, and
+    carry uncertain readings with probability dense."""
+    rnd = random.Random(seed)
+    vocab = words(rnd, 5000)
+    size = 0
+    page = 0
+    with open(path, 'w') as f:
+        f.write('#=IVTFF Eva- 2.0\n')
+        while size < nbytes:
+            page += 1
+            name = 'f%d%s' % ((page + 1) // 2, 'rv'[(page + 1) % 2])
+            head = '<%s>      <! $I=T $Q=A $P=A $L=A $H=1>\n# page %d\n' % (name, page)
+            f.write(head)
+            size += len(head)
+            for num in range(1, nlines + 1):
+                if size >= nbytes:
+                    break
+                text = []
+                tlen = 0
+                while tlen < linelen:
+                    w = uncertain(rnd, rnd.choice(vocab), dense)
+                    r = rnd.random()
+                    if r < 0.02:
+                        w = w + '<!plant>'
+                    sep = ',' if r > 0.95 else '.'
+                    text.append(w)
+                    text.append(sep)
+                    tlen += len(w) + 1
+                line = '<%s.%d,%sP0>      %s\n' % (name, num, '@' if num == 1 else '+',
+                                                  ''.join(text[:-1]))
+                f.write(line)
+                size += len(line)
+
+
+def corpus(path, nbytes, source='ZL_ivtff_1r.txt'):
+    """Write about nbytes of a real transliteration from data/, repeated
+    as often as needed, the file header kept only once."""
+    with open(os.path.join(REPO, 'data', source), 'rb') as f:
+        data = f.read()
+    body = b''.join(l for l in data.splitlines(True) if not l.startswith(b'#=IVTFF'))
+    with open(path, 'wb') as f:
+        f.write(data)
+        size = len(data)
+        while size < nbytes:
+            f.write(body)
+            size += len(body)
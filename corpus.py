@@ -0,0 +1,236 @@
+import json
+from collections.abc import Sequence
+
+import numpy as np
+
+from uncertainties import Uncertainty, Alternatives
+
+
+# Token flags, as defined in software/ivtt.h
+FLAGS = {'SINGLE_UNCERTAINTY': 1,
+         'UNCERTAIN_SEQUENCE': 2,
+         'ALT_READING': 4,
+         'UNCERTAIN_SPACE': 8,
+         'LIGATURE': 16,
+         'HIGH_ASCII': 32}
+
+# Sections of the file, in the order of their offsets in the header
+SECTIONS = ['tok', 'flag', 'line', 'lloc', 'par', 'lfol', 'lnum', 'fol', 'voff', 'pool', 'unc']
+
+# Flags that make a token uncertain
+UNCERTAIN = FLAGS['SINGLE_UNCERTAINTY'] | FLAGS['UNCERTAIN_SEQUENCE'] | FLAGS['ALT_READING'] | FLAGS['UNCERTAIN_SPACE']
+
+# One uncertain token, as struct ivtt_urec in software/ivtt.h
+UREC = [('tok', 'u4'), ('word', 'u4'), ('lbeg', 'u4'), ('lend', 'u4'), ('pbeg', 'u4'), ('pend', 'u4'),
+        ('locus', 'u4'), ('flag', 'u1'), ('qrun', 'u1'), ('spare', 'u1', 2)]
+
+HEADER_SIZE = 96
+
+
+class Words(Sequence):
+    '''
+    The words of a corpus, each decoded from the word pool when it is accessed,
+    so that loading the corpus does not split the pool.
+
+    Args:
+        pool (numpy array of uint8): the words, each ending in 0
+        offsets (numpy array of uint32): start of each word in the pool, plus the size of the pool
+    '''
+
+    def __init__(self, pool, offsets):
+        self._pool = pool
+        self._offsets = offsets
+
+    def __len__(self):
+        return len(self._offsets) - 1
+
+    def __getitem__(self, i):
+        if isinstance(i, slice):
+            return [self[k] for k in range(*i.indices(len(self)))]
+        if i < 0:
+            i += len(self)
+        if not 0 <= i < len(self):
+            raise IndexError('word ID out of range')
+        return self._pool[self._offsets[i]:self._offsets[i + 1] - 1].tobytes().decode('latin-1')
+
+
+class Corpus:
+    '''
+    Binary corpus written by ivtt with --corpus=<file>, mapped into memory.
+
+    Attributes:
+        tokens (numpy array of uint32): word ID of each token
+        flags (numpy array of uint8): uncertainty flags (see FLAGS) of each token
+        line_starts (numpy array of uint32): first token of each line, plus the number of tokens
+        line_locus (numpy array of uint32): locus ID of each line
+        paragraph_starts (numpy array of uint32): first line of each paragraph, plus the number of lines
+        locus_folio (numpy array of uint32): folio ID of each locus
+        locus_number (numpy array of uint32): number of each locus in its folio
+        folios (list of str): folio names
+        vocabulary (Words): the words, indexed by word ID
+        uncertain (numpy structured array): the uncertain tokens, with their position (tok),
+            word ID (word), line (lbeg, lend), paragraph (pbeg, pend), locus, flags (flag)
+            and longest run of ? (qrun)
+    '''
+
+    def __init__(self, path):
+        data = np.memmap(path, dtype=np.uint8, mode='r')
+        if bytes(data[:8]) != b'IVTTCORP':
+            raise ValueError(path + ' is not an ivtt corpus')
+        # The numbers are in the byte order of the machine that wrote the file
+        byteorder = '<' if np.frombuffer(data, dtype='<u4', count=1, offset=12)[0] == 0x01020304 else '>'
+        u32 = np.dtype(np.uint32).newbyteorder(byteorder)
+        header = np.frombuffer(data, dtype=u32, count=(HEADER_SIZE - 8) // 4, offset=8)
+        if header[0] != 1:
+            raise ValueError('Unsupported corpus version ' + str(header[0]))
+        ntok, nline, npar, nlocus, nfolio, nword, npool, nunc = (int(n) for n in header[2:10])
+        offsets = dict(zip(SECTIONS, (int(o) for o in header[10:21])))
+
+        def section(name, dtype, count):
+            return np.frombuffer(data, dtype=dtype, count=count, offset=offsets[name])
+
+        self.tokens = section('tok', u32, ntok)
+        self.flags = section('flag', np.uint8, ntok)
+        self.line_starts = section('line', u32, nline + 1)
+        self.line_locus = section('lloc', u32, nline)
+        self.paragraph_starts = section('par', u32, npar + 1)
+        self.locus_folio = section('lfol', u32, nlocus)
+        self.locus_number = section('lnum', u32, nlocus)
+        fol = section('fol', 'S8', nfolio)
+        self.folios = [name.decode('latin-1') for name in fol]
+        self.vocabulary = Words(section('pool', np.uint8, npool), section('voff', u32, nword + 1))
+        self.uncertain = section('unc', np.dtype(UREC).newbyteorder(byteorder), nunc)
+
+    def line(self, i):
+        '''
+        Words of one line.
+
+        Args:
+            i (int): line number
+
+        Returns:
+            (list of str): the words of the line
+        '''
+        ids = self.tokens[self.line_starts[i]:self.line_starts[i + 1]]
+        return [self.vocabulary[w] for w in ids]
+
+    def paragraph(self, i):
+        '''
+        Lines of one paragraph.
+
+        Args:
+            i (int): paragraph number
+
+        Returns:
+            (list of list of str): the words of each line of the paragraph
+        '''
+        return [self.line(j) for j in range(self.paragraph_starts[i], self.paragraph_starts[i + 1])]
+
+    def locus(self, i):
+        '''
+        Name of the locus of a line, as in the transliteration.
+
+        Args:
+            i (int): line number
+
+        Returns:
+            (str): the locus, e.g. 'f1r.3'
+        '''
+        loc = self.line_locus[i]
+        return self.folios[self.locus_folio[loc]] + '.' + str(self.locus_number[loc])
+
+    def uncertain_tokens(self, uncertainty_type):
+        '''
+        Positions of all tokens with one type of uncertainty.
+
+        Args:
+            uncertainty_type (str): one of the keys of FLAGS
+
+        Returns:
+            (numpy array of int): token positions
+        '''
+        return np.flatnonzero(self.flags & FLAGS[uncertainty_type])
+
+    def uncertainty_types(self, i, uncertainty_chars):
+        '''
+        Types of one uncertain token, named and ordered as in contextualize_sentence.
+
+        Args:
+            i (int): index in the uncertain table
+            uncertainty_chars (dict): mapping of (type of uncertainty, char representation)
+
+        Returns:
+            (list of str): the types of uncertainty of the token
+        '''
+        rec = self.uncertain[i]
+        present = {'SINGLE_UNCERTAINTY': rec['qrun'] >= 1,
+                   'DOUBLE_UNCERTAINTY': rec['qrun'] >= 2,
+                   'UNCERTAIN_SEQUENCE': rec['qrun'] >= 3,
+                   'UNCERTAIN_SPACE': bool(rec['flag'] & FLAGS['UNCERTAIN_SPACE'])}
+        types = [key for key in uncertainty_chars if present.get(key, False)]
+        if rec['flag'] & FLAGS['ALT_READING']:
+            types.append('ALTERNATE_READING')
+        return types
+
+    def uncertainties(self, uncertainty_chars, alphabet, paragraphs=False, vocabulary=None):
+        '''
+        Generate the list of Uncertainty of the whole corpus, as contextualize_sentence
+        does for each line (or paragraph) of the Voynich text with uncertain words removed
+        from the context.
+
+        Args:
+            uncertainty_chars (dict): mapping of (type of uncertainty, char representation)
+            alphabet (list): known non-space characters in the alphabet
+            paragraphs (bool): True to take the context from the paragraph instead of the line
+            vocabulary (Vocabulary): if not None, keep only the alternatives made of words
+                of the vocabulary
+
+        Returns:
+            (list of Uncertainty): the uncertain words with their contexts
+        '''
+        certain = (self.flags & UNCERTAIN) == 0
+        beg = self.uncertain['pbeg' if paragraphs else 'lbeg']
+        end = self.uncertain['pend' if paragraphs else 'lend']
+        result = []
+        for i, rec in enumerate(self.uncertain):
+            tok = int(rec['tok'])
+            left = np.arange(beg[i], tok)
+            right = np.arange(tok + 1, end[i])
+            word = self.vocabulary[rec['word']]
+            result.append(Uncertainty(corrupted_word=word,
+                                      correct_word='',
+                                      left_context=[self.vocabulary[w] for w in self.tokens[left[certain[left]]]],
+                                      right_context=[self.vocabulary[w] for w in self.tokens[right[certain[right]]]],
+                                      alternatives_list=list(set(Alternatives(word, uncertainty_chars, alphabet,
+                                                                            vocabulary=vocabulary))),
+                                      uncertainty_types=self.uncertainty_types(i, uncertainty_chars)))
+        return result
+
+
+def read_uncertainties(path):
+    '''
+    Read the uncertainty records written by ivtt with --uncert=<file>.
+
+    Args:
+        path (str): name of the JSON lines file
+
+    Returns:
+        (list of dict): one record per uncertain word, with its word, types, position
+            (token), left and right context and paragraph as [begin, end) token positions,
+            locus ID (locus) and locus name (name)
+    '''
+    with open(path, encoding='utf-8') as f:
+        return [json.loads(line) for line in f]
+
+
+def load_corpus(path):
+    '''
+    Map a binary corpus written by ivtt into memory, without parsing the text.
+
+    Args:
+        path (str): name of the corpus file
+
+    Returns:
+        (Corpus): the corpus
+    '''
+    return Corpus(path)
@@ -0,0 +1,699 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "ctype.h"
+#include "altgen.h"
+
+/* Slot types of a form */
+#define AG_LIT 0          /* Fixed text */
+#define AG_ONE 1          /* Single uncertainty: one letter */
+#define AG_SEQ 2          /* Uncertain sequence: three, two or one letters */
+
+/* Marks passed to altgen_open */
+#define AM_ONE 0
+#define AM_SEQ 1
+#define AM_SPACE 2
+#define AM_OTHER 3
+
+/*
+   Alternatives generator, see altgen.h.
+
+   A candidate is numbered as follows. The pieces between uncertain
+   spaces are the digits of a mixed-radix number, the last piece
+   varying fastest, and below them are the space/no space choices
+   at the joins. Inside a piece the forms are numbered one after the
+   other, and inside a form the slots are again digits of a mixed-
+   radix number. An uncertain sequence has L*L*L + L*L + L choices
+   for an alphabet of L letters, in this order.
+*/
+
+struct ag_slot {
+  int type;         /* AG_.. */
+  int beg, len;     /* Fixed text: its place in the text of the form */
+  long long n;      /* Number of choices */
+};
+
+struct ag_form {
+  char *text;       /* The piece with its alternate readings resolved */
+  int nslot;
+  struct ag_slot *slot;
+  long long n;      /* Number of candidates */
+};
+
+struct ag_piece {
+  int nform, mform;
+  struct ag_form *form;
+  long long n;      /* Number of candidates, summed over the forms */
+  int maxlen;       /* Longest candidate */
+};
+
+struct ag_node {
+  int child;        /* First node below, 0 if none */
+  int next;         /* Next node with the same parent, 0 if none */
+  unsigned char c;  /* Byte that leads to this node */
+  char end;         /* 1 if a word ends here */
+};
+
+struct altvoc {
+  int nnode, mnode; /* Node 0 is the root */
+  struct ag_node *node;
+};
+
+struct altgen {
+  int npiece;
+  struct ag_piece *piece;
+  char **letter;    /* The alphabet */
+  int *llen;
+  int nletter;
+  char **mark;      /* The uncertainty marks (AM_..) */
+  int *mlen;
+  int nmark;
+  long long nseq;   /* Choices of an uncertain sequence */
+  long long n;      /* Number of candidates, -1 if too many */
+  int maxlen;       /* Longest candidate */
+  int maxslot;      /* Most slots in one form */
+  long long *digit; /* Work area for the slot choices */
+  long long *pidx;  /* Work area for the piece choices */
+  long long nall;   /* Number of candidates before pruning */
+  int pruned;       /* 1 if only the kept candidates are given */
+  char *kept;       /* Candidates kept by altgen_prune, each ending in a 0 */
+  long nbyte, mbyte;
+  long *koff;       /* Where each kept candidate starts */
+  long long nkept, mkept;
+  ALTVOC *voc;      /* Vocabulary of altgen_prune while it runs */
+};
+
+int WalkSlot(ALTGEN *g,int ip,struct ag_form *pf,int is,int node,char *out,int len);
+
+/*-----------------------------------------------------------*/
+
+long long MulCount(long long a,long long b)
+/* Multiply two counts */
+/* Return -1 if either is -1 or the product is too large */
+{
+  if (a < 0 || b < 0) return -1;
+  if (b > 0 && a > 0x7fffffffffffffffLL / b) return -1;
+  return a * b;
+}
+
+/*-----------------------------------------------------------*/
+
+long long AddCount(long long a,long long b)
+/* Add two counts */
+/* Return -1 if either is -1 or the sum is too large */
+{
+  if (a < 0 || b < 0) return -1;
+  if (a > 0x7fffffffffffffffLL - b) return -1;
+  return a + b;
+}
+
+/*-----------------------------------------------------------*/
+
+int IsMark(ALTGEN *g,int im,char *text,int len,int pos)
+/* Check if mark im occurs in text at position pos */
+/* Return 1 if so, else 0 */
+{
+  int ml = g->mlen[im];
+
+  return (ml > 0 && pos + ml <= len &&
+          memcmp(text+pos, g->mark[im], ml) == 0);
+}
+
+/*-----------------------------------------------------------*/
+
+int FindAlt(char *text,int len,int *popen,int *pcolon,int *pclose)
+/* Find the first alternate reading [a:b], as the regular expression
+   \[(\S*?):(\S*?)\] of uncertainties.py does */
+/* Return 1 if found, else 0 */
+{
+  int p, q, r;
+
+  for (p=0; p<len; p++) {
+    if (text[p] != '[') continue;
+    for (q=p+1; q<len && text[q] != ':' && !isspace((unsigned char) text[q]); q++) ;
+    if (q >= len || text[q] != ':') continue;
+    for (r=q+1; r<len && text[r] != ']' && !isspace((unsigned char) text[r]); r++) ;
+    if (r >= len || text[r] != ']') continue;
+    *popen = p; *pcolon = q; *pclose = r;
+    return 1;
+  }
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int AddForm(ALTGEN *g,struct ag_piece *pc,char *text,int len)
+/* Cut a piece without alternate readings into slots and add it to
+   the forms of the piece. A text with any other uncertainty left in
+   it gives no candidates and is not added. Takes over text */
+/* Return 0 if all OK, 1 if out of memory */
+{
+  struct ag_form *pf, *nform;
+  struct ag_slot *ps;
+  int pos, lbeg, im, type, ml, flen;
+
+  for (im=AM_OTHER; im<g->nmark; im++) {
+    for (pos=0; pos<len; pos++) {
+      if (IsMark(g, im, text, len, pos)) {
+        free(text);
+        return 0;
+      }
+    }
+  }
+
+  if (pc->nform == pc->mform) {
+    pc->mform = (pc->mform == 0) ? 4 : 2 * pc->mform;
+    nform = (struct ag_form *) realloc(pc->form, pc->mform * sizeof(struct ag_form));
+    if (nform == NULL) {
+      free(text);
+      return 1;
+    }
+    pc->form = nform;
+  }
+  pf = pc->form + pc->nform;
+  pf->text = text; pf->nslot = 0; pf->n = 1;
+  pf->slot = (struct ag_slot *) malloc((len+1) * sizeof(struct ag_slot));
+  if (pf->slot == NULL) {
+    free(text);
+    return 1;
+  }
+  pc->nform += 1;
+
+  /* Uncertain sequences are taken first, from the left, so that a
+     run of four marks is a sequence and a single uncertainty */
+  flen = 0; lbeg = 0; pos = 0;
+  while (pos <= len) {
+    type = -1; ml = 1;
+    if (pos == len) {
+      type = AG_LIT;
+    } else if (IsMark(g, AM_SEQ, text, len, pos)) {
+      type = AG_SEQ; ml = g->mlen[AM_SEQ];
+    } else if (IsMark(g, AM_ONE, text, len, pos)) {
+      type = AG_ONE; ml = g->mlen[AM_ONE];
+    }
+    if (type < 0) {
+      pos += 1;
+      continue;
+    }
+    if (pos > lbeg) {
+      ps = pf->slot + pf->nslot++;
+      ps->type = AG_LIT; ps->beg = lbeg; ps->len = pos - lbeg; ps->n = 1;
+      flen += ps->len;
+    }
+    if (type != AG_LIT) {
+      ps = pf->slot + pf->nslot++;
+      ps->type = type; ps->beg = pos; ps->len = 0;
+      ps->n = (type == AG_SEQ) ? g->nseq : g->nletter;
+      pf->n = MulCount(pf->n, ps->n);
+      flen += (type == AG_SEQ ? 3 : 1) * g->maxlen;
+    }
+    pos += ml; lbeg = pos;
+  }
+
+  pc->n = AddCount(pc->n, pf->n);
+  if (flen > pc->maxlen) pc->maxlen = flen;
+  if (pf->nslot > g->maxslot) g->maxslot = pf->nslot;
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int AddForms(ALTGEN *g,struct ag_piece *pc,char *text,int len)
+/* Resolve the first alternate reading of a piece both ways, and
+   go on with what results until none is left. Takes over text */
+/* Return 0 if all OK, 1 if out of memory */
+{
+  int p, q, r, i, n;
+  char *alt;
+
+  if (FindAlt(text, len, &p, &q, &r) == 0) return AddForm(g, pc, text, len);
+
+  /* The text before the [, one of the readings, the text after the ] */
+  for (i=0; i<2; i++) {
+    n = (i == 0) ? q-p-1 : r-q-1;
+    alt = (char *) malloc(len + 1);
+    if (alt == NULL) {
+      free(text);
+      return 1;
+    }
+    memcpy(alt, text, p);
+    memcpy(alt+p, text + (i == 0 ? p+1 : q+1), n);
+    memcpy(alt+p+n, text+r+1, len-r-1);
+    if (AddForms(g, pc, alt, p+n+len-r-1)) {
+      free(text);
+      return 1;
+    }
+  }
+  free(text);
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+char *CopyText(char *text,int len)
+/* Copy len bytes of text into allocated memory */
+/* Return NULL if out of memory */
+{
+  char *copy;
+
+  copy = (char *) malloc(len + 1);
+  if (copy == NULL) return NULL;
+  memcpy(copy, text, len);
+  copy[len] = 0;
+  return copy;
+}
+
+/*-----------------------------------------------------------*/
+
+ALTGEN *altgen_open(char *word,char **letters,int nletter,char **marks,int nmark)
+/* Set up the generator for one uncertain word */
+/* Return NULL if out of memory or if the marks are incomplete */
+{
+  ALTGEN *g;
+  struct ag_piece *pc;
+  int i, len, pos, beg, ml;
+  char *piece;
+
+  if (nmark < AM_OTHER || nletter < 0) return NULL;
+  g = (ALTGEN *) calloc(1, sizeof(ALTGEN));
+  if (g == NULL) return NULL;
+
+  /* Keep copies of the alphabet and the marks */
+  g->letter = (char **) calloc(nletter+1, sizeof(char *));
+  g->llen = (int *) calloc(nletter+1, sizeof(int));
+  g->mark = (char **) calloc(nmark, sizeof(char *));
+  g->mlen = (int *) calloc(nmark, sizeof(int));
+  if (g->letter == NULL || g->llen == NULL || g->mark == NULL || g->mlen == NULL) {
+    altgen_close(g);
+    return NULL;
+  }
+  for (i=0; i<nletter; i++) {
+    g->llen[i] = strlen(letters[i]);
+    if ((g->letter[i] = CopyText(letters[i], g->llen[i])) == NULL) {
+      altgen_close(g);
+      return NULL;
+    }
+    g->nletter += 1;
+    if (g->llen[i] > g->maxlen) g->maxlen = g->llen[i];
+  }
+  for (i=0; i<nmark; i++) {
+    g->mlen[i] = strlen(marks[i]);
+    if ((g->mark[i] = CopyText(marks[i], g->mlen[i])) == NULL) {
+      altgen_close(g);
+      return NULL;
+    }
+    g->nmark += 1;
+  }
+  g->nseq = AddCount(AddCount(MulCount(MulCount(nletter, nletter), nletter),
+                              MulCount(nletter, nletter)), nletter);
+
+  /* Cut the word at its uncertain spaces. The maximum letter length
+     is kept in maxlen until the pieces are done */
+  len = strlen(word);
+  ml = g->mlen[AM_SPACE];
+  g->piece = (struct ag_piece *) calloc(len+1, sizeof(struct ag_piece));
+  if (g->piece == NULL) {
+    altgen_close(g);
+    return NULL;
+  }
+  beg = 0;
+  for (pos=0; pos<=len; pos++) {
+    if (pos < len && !IsMark(g, AM_SPACE, word, len, pos)) continue;
+    pc = g->piece + g->npiece++;
+    if ((piece = CopyText(word+beg, pos-beg)) == NULL ||
+        AddForms(g, pc, piece, pos-beg)) {
+      altgen_close(g);
+      return NULL;
+    }
+    if (ml > 0) pos += ml - 1;
+    beg = pos + 1;
+  }
+
+  g->n = 1; g->maxlen = g->npiece - 1;
+  for (i=0; i<g->npiece; i++) {
+    g->n = MulCount(g->n, g->piece[i].n);
+    if (i > 0) g->n = MulCount(g->n, 2);
+    g->maxlen += g->piece[i].maxlen;
+  }
+  g->nall = g->n;
+  g->digit = (long long *) malloc((g->maxslot+1) * sizeof(long long));
+  g->pidx = (long long *) malloc(g->npiece * sizeof(long long));
+  if (g->digit == NULL || g->pidx == NULL) {
+    altgen_close(g);
+    return NULL;
+  }
+  return g;
+}
+
+/*-----------------------------------------------------------*/
+
+long long altgen_count(ALTGEN *g)
+/* Return the number of candidates, or -1 if they are too many */
+{
+  return g->n;
+}
+
+/*-----------------------------------------------------------*/
+
+int PutLetter(ALTGEN *g,long long d,char *out)
+/* Write letter d of the alphabet */
+/* Return its length */
+{
+  memcpy(out, g->letter[d], g->llen[d]);
+  return g->llen[d];
+}
+
+/*-----------------------------------------------------------*/
+
+int PutForm(ALTGEN *g,struct ag_form *pf,long long idx,char *out)
+/* Write candidate idx of a form */
+/* Return its length */
+{
+  struct ag_slot *ps;
+  long long d, nl = g->nletter;
+  int i, len = 0;
+
+  for (i=pf->nslot-1; i>=0; i--) {
+    g->digit[i] = idx % pf->slot[i].n;
+    idx /= pf->slot[i].n;
+  }
+  for (i=0; i<pf->nslot; i++) {
+    ps = pf->slot + i; d = g->digit[i];
+    if (ps->type == AG_LIT) {
+      memcpy(out+len, pf->text + ps->beg, ps->len);
+      len += ps->len;
+    } else if (ps->type == AG_ONE || d >= nl*nl*nl + nl*nl) {
+      if (ps->type == AG_SEQ) d -= nl*nl*nl + nl*nl;
+      len += PutLetter(g, d, out+len);
+    } else if (d >= nl*nl*nl) {
+      d -= nl*nl*nl;
+      len += PutLetter(g, d / nl, out+len);
+      len += PutLetter(g, d % nl, out+len);
+    } else {
+      len += PutLetter(g, d / (nl*nl), out+len);
+      len += PutLetter(g, (d / nl) % nl, out+len);
+      len += PutLetter(g, d % nl, out+len);
+    }
+  }
+  return len;
+}
+
+/*-----------------------------------------------------------*/
+
+int PutCand(ALTGEN *g,long long idx,char *out)
+/* Write candidate idx, which must be below the count */
+/* Return its length */
+{
+  struct ag_piece *pc;
+  long long joins, r;
+  int i, j, len = 0;
+
+  /* The joins take the lowest bits, the first join the highest */
+  joins = idx & ((1LL << (g->npiece-1)) - 1);
+  idx >>= g->npiece-1;
+  for (i=g->npiece-1; i>=0; i--) {
+    g->pidx[i] = idx % g->piece[i].n;
+    idx /= g->piece[i].n;
+  }
+
+  for (i=0; i<g->npiece; i++) {
+    if (i > 0 && ((joins >> (g->npiece-1-i)) & 1)) out[len++] = ' ';
+    pc = g->piece + i; r = g->pidx[i];
+    for (j=0; r >= pc->form[j].n; j++) r -= pc->form[j].n;
+    len += PutForm(g, pc->form + j, r, out+len);
+  }
+  return len;
+}
+
+/*-----------------------------------------------------------*/
+
+long altgen_fill(ALTGEN *g,long long start,long n,char *buf,long size)
+/* Write the candidates from number start on, each followed by a 0 */
+/* Return the number written, or -1 if the count is not known */
+{
+  long k, pos = 0;
+
+  long len;
+
+  if (g->n < 0) return -1;
+  for (k=0; k<n && start+k < g->n; k++) {
+    if (g->pruned) {
+      len = strlen(g->kept + g->koff[start+k]);
+      if (pos + len + 1 > size) break;
+      memcpy(buf+pos, g->kept + g->koff[start+k], len + 1);
+      pos += len + 1;
+      continue;
+    }
+    if (pos + g->maxlen + 1 > size) break;
+    pos += PutCand(g, start+k, buf+pos);
+    buf[pos++] = 0;
+  }
+  return k;
+}
+
+/*-----------------------------------------------------------*/
+
+void altgen_close(ALTGEN *g)
+/* Release a generator */
+{
+  int i, j;
+
+  if (g == NULL) return;
+  for (i=0; i<g->npiece; i++) {
+    for (j=0; j<g->piece[i].nform; j++) {
+      free(g->piece[i].form[j].text);
+      free(g->piece[i].form[j].slot);
+    }
+    free(g->piece[i].form);
+  }
+  free(g->piece);
+  for (i=0; i<g->nletter; i++) free(g->letter[i]);
+  for (i=0; i<g->nmark; i++) free(g->mark[i]);
+  free(g->letter); free(g->llen); free(g->mark); free(g->mlen);
+  free(g->digit); free(g->pidx);
+  free(g->kept); free(g->koff);
+  free(g);
+}
+
+/*-----------------------------------------------------------*/
+
+int StepNode(ALTVOC *v,int node,char *text,int len)
+/* Follow the bytes of text down from a node of the trie */
+/* Return the node reached, or -1 if no word goes on that way */
+{
+  int i, k;
+
+  for (i=0; i<len; i++) {
+    for (k=v->node[node].child; k > 0; k=v->node[k].next) {
+      if (v->node[k].c == (unsigned char) text[i]) break;
+    }
+    if (k == 0) return -1;
+    node = k;
+  }
+  return node;
+}
+
+/*-----------------------------------------------------------*/
+
+int AddWord(ALTVOC *v,char *word)
+/* Add a word to the trie */
+/* Return 0 if all OK, 1 if out of memory */
+{
+  struct ag_node *nnode;
+  int i, k, node = 0, len = strlen(word);
+
+  for (i=0; i<len; i++) {
+    for (k=v->node[node].child; k > 0; k=v->node[k].next) {
+      if (v->node[k].c == (unsigned char) word[i]) break;
+    }
+    if (k == 0) {
+      if (v->nnode == v->mnode) {
+        v->mnode *= 2;
+        nnode = (struct ag_node *) realloc(v->node, v->mnode * sizeof(struct ag_node));
+        if (nnode == NULL) return 1;
+        v->node = nnode;
+      }
+      k = v->nnode++;
+      v->node[k].child = 0; v->node[k].c = (unsigned char) word[i];
+      v->node[k].end = 0;
+      v->node[k].next = v->node[node].child;
+      v->node[node].child = k;
+    }
+    node = k;
+  }
+  v->node[node].end = 1;
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+ALTVOC *altvoc_open(char **words,int nword)
+/* Build the trie of a vocabulary */
+/* Return NULL if out of memory */
+{
+  ALTVOC *v;
+  int i;
+
+  v = (ALTVOC *) calloc(1, sizeof(ALTVOC));
+  if (v == NULL) return NULL;
+  v->mnode = 1024;
+  v->node = (struct ag_node *) calloc(v->mnode, sizeof(struct ag_node));
+  if (v->node == NULL) {
+    free(v);
+    return NULL;
+  }
+  v->nnode = 1;
+  for (i=0; i<nword; i++) {
+    if (AddWord(v, words[i])) {
+      altvoc_close(v);
+      return NULL;
+    }
+  }
+  return v;
+}
+
+/*-----------------------------------------------------------*/
+
+void altvoc_close(ALTVOC *v)
+/* Release a vocabulary */
+{
+  if (v == NULL) return;
+  free(v->node);
+  free(v);
+}
+
+/*-----------------------------------------------------------*/
+
+int KeepCand(ALTGEN *g,char *out,int len)
+/* Add a candidate to the kept ones */
+/* Return 0 if all OK, 1 if out of memory */
+{
+  char *nkept;
+  long *nkoff;
+
+  if (g->nkept == g->mkept) {
+    g->mkept = (g->mkept == 0) ? 64 : 2 * g->mkept;
+    nkoff = (long *) realloc(g->koff, g->mkept * sizeof(long));
+    if (nkoff == NULL) return 1;
+    g->koff = nkoff;
+  }
+  while (g->nbyte + len + 1 > g->mbyte) {
+    g->mbyte = (g->mbyte == 0) ? 1024 : 2 * g->mbyte;
+    nkept = (char *) realloc(g->kept, g->mbyte);
+    if (nkept == NULL) return 1;
+    g->kept = nkept;
+  }
+  g->koff[g->nkept++] = g->nbyte;
+  memcpy(g->kept + g->nbyte, out, len);
+  g->nbyte += len;
+  g->kept[g->nbyte++] = 0;
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int WalkPiece(ALTGEN *g,int ip,int node,char *out,int len)
+/* Go on with each form of piece ip from a node of the trie */
+/* Return 0 if all OK, 1 if out of memory */
+{
+  struct ag_piece *pc = g->piece + ip;
+  int j;
+
+  for (j=0; j<pc->nform; j++) {
+    if (WalkSlot(g, ip, pc->form + j, 0, node, out, len)) return 1;
+  }
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int EndPiece(ALTGEN *g,int ip,int node,char *out,int len)
+/* Piece ip ends at a node of the trie: keep the candidate after the
+   last piece, else go on without a space and then with one, as in
+   the numbering. A space or the end needs a whole word */
+/* Return 0 if all OK, 1 if out of memory */
+{
+  if (ip == g->npiece-1) {
+    if (g->voc->node[node].end == 0) return 0;
+    return KeepCand(g, out, len);
+  }
+  if (WalkPiece(g, ip+1, node, out, len)) return 1;
+  if (g->voc->node[node].end == 0) return 0;
+  out[len] = ' ';
+  return WalkPiece(g, ip+1, 0, out, len+1);
+}
+
+/*-----------------------------------------------------------*/
+
+int WalkLetters(ALTGEN *g,int ip,struct ag_form *pf,int is,int nlet,
+                int node,char *out,int len)
+/* Put nlet more letters in a slot, going down the trie */
+/* Return 0 if all OK, 1 if out of memory */
+{
+  int d, next;
+
+  if (nlet == 0) return WalkSlot(g, ip, pf, is+1, node, out, len);
+  for (d=0; d<g->nletter; d++) {
+    next = StepNode(g->voc, node, g->letter[d], g->llen[d]);
+    if (next < 0) continue;
+    memcpy(out+len, g->letter[d], g->llen[d]);
+    if (WalkLetters(g, ip, pf, is, nlet-1, next, out, len + g->llen[d])) return 1;
+  }
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int WalkSlot(ALTGEN *g,int ip,struct ag_form *pf,int is,int node,char *out,int len)
+/* Go on with slot is of a form from a node of the trie */
+/* Return 0 if all OK, 1 if out of memory */
+{
+  struct ag_slot *ps;
+  int n;
+
+  if (is == pf->nslot) return EndPiece(g, ip, node, out, len);
+  ps = pf->slot + is;
+  if (ps->type == AG_LIT) {
+    node = StepNode(g->voc, node, pf->text + ps->beg, ps->len);
+    if (node < 0) return 0;
+    memcpy(out+len, pf->text + ps->beg, ps->len);
+    return WalkSlot(g, ip, pf, is+1, node, out, len + ps->len);
+  }
+  if (ps->type == AG_ONE) return WalkLetters(g, ip, pf, is, 1, node, out, len);
+  for (n=3; n>0; n--) {
+    if (WalkLetters(g, ip, pf, is, n, node, out, len)) return 1;
+  }
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+long long altgen_prune(ALTGEN *g,ALTVOC *v)
+/* Keep only the candidates whose words are all in the vocabulary,
+   following the trie while the candidates are made so that a
+   branch is given up as soon as no word starts that way */
+/* Return the number kept, or -1 if out of memory */
+{
+  char *out;
+  int err;
+
+  if (g->pruned) return g->nkept;
+  out = (char *) malloc(g->maxlen + 1);
+  if (out == NULL) return -1;
+  g->voc = v;
+  err = (g->npiece > 0) ? WalkPiece(g, 0, 0, out, 0) : 0;
+  g->voc = NULL;
+  free(out);
+  if (err) return -1;
+  g->pruned = 1;
+  g->n = g->nkept;
+  return g->nkept;
+}
+
+/*-----------------------------------------------------------*/
+
+long long altgen_total(ALTGEN *g)
+/* Return the number of candidates before pruning, -1 if too many */
+{
+  return g->nall;
+}
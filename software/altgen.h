@@ -0,0 +1,62 @@
+/*
+   Alternatives generator - the possible readings of an uncertain word,
+   as create_alternatives in uncertainties.py makes them, but without
+   making them all at once.
+
+   The word is cut at its uncertain spaces, and each piece is turned
+   into a choice of forms, one for each way of resolving its alternate
+   readings [a:b]. A form is a sequence of fixed text, single
+   uncertainties (one letter) and uncertain sequences (three, two or
+   one letters). The candidates are numbered, so that they can be
+   counted and produced from any point on. Build it as a shared
+   library for the Python binding:
+
+     cc -O2 -shared -fPIC -o libaltgen.so altgen.c
+
+   g = altgen_open(word, letters, nletter, marks, nmark)
+         letters[0..nletter-1]  the alphabet, one letter per string
+         marks[0], [1], [2]     single uncertainty, uncertain sequence
+                                and uncertain space, e.g. ? ??? ,
+         marks[3..nmark-1]      other uncertainties: a form that still
+                                contains one of them is dropped
+   altgen_count(g)              Number of candidates, -1 if too many
+   altgen_fill(g, start, n, buf, size)
+                                Write candidates start, start+1, ...
+                                into buf, each ending in a 0. Return
+                                the number written, which is less than
+                                n at the end or when buf is full
+   altgen_close(g)              Release the generator
+
+   The candidates are the same as those of create_alternatives, with
+   the same repetitions, though in another order.
+
+   The candidates can be limited to those made of known words. The
+   trie of the vocabulary is built once and followed while the
+   candidates are made, so that a branch is given up at the first
+   letter that no word continues with:
+
+   v = altvoc_open(words, nword)
+   altgen_prune(g, v)           Keep only the candidates whose words
+                                are all in v, and return how many. From
+                                then on altgen_count and altgen_fill
+                                give the kept ones
+   altgen_total(g)              Number of candidates before pruning
+   altvoc_close(v)              Release the vocabulary
+*/
+
+#ifndef ALTGEN_H
+#define ALTGEN_H
+
+typedef struct altgen ALTGEN;
+typedef struct altvoc ALTVOC;
+
+ALTGEN *altgen_open(char *word,char **letters,int nletter,char **marks,int nmark);
+long long altgen_count(ALTGEN *g);
+long altgen_fill(ALTGEN *g,long long start,long n,char *buf,long size);
+void altgen_close(ALTGEN *g);
+ALTVOC *altvoc_open(char **words,int nword);
+void altvoc_close(ALTVOC *v);
+long long altgen_prune(ALTGEN *g,ALTVOC *v);
+long long altgen_total(ALTGEN *g);
+
+#endif
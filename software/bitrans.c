@@ -1,11 +1,86 @@
 #include "stdio.h"
+#include "stdlib.h"
 #include "string.h"
 #include "ctype.h"
+#include "limits.h"
+#include "unistd.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
 #define WIDTXT 2048
-#define MAXRUL 2048
 #define WIDRUL 64
-#define MAXDEF 512
-#define MAXCOM 6
+
+/* Character class bits, see SetClass */
+#define BC_SEP 1          /* Blank, dot or comma */
+#define BC_COMO 2         /* Opens an in-line comment */
+#define BC_COML 4         /* Starts a full line comment */
+
+/* Compiled rules file, written with --compile (see WriteComp) and
+   read with -f like a rules file (see LoadComp). It holds the
+   rules of one direction, sorted, and their matching automaton.
+   It starts with the header below. All numbers are in the byte
+   order of the machine that wrote the file (endian reads 0x01020304
+   when it matches), and every section starts at a multiple of 8
+   bytes. The sections are:
+
+   off[BITC_IP0]   int ip0[ndef]        Start of each input token
+   off[BITC_LIP0]  int lip0[ndef]       Its length
+   off[BITC_IP1]   int ip1[nout]        Start of each output token
+   off[BITC_LIP1]  int lip1[nout]       Its length
+   off[BITC_LO]    int lo[ndef]         First output token of each rule
+   off[BITC_HI]    int hi[ndef]         Last output token of each rule
+   off[BITC_RUL0]  char rul0[lstr0+1]   The input tokens
+   off[BITC_RUL1]  char rul1[lstr1+1]   The output tokens
+   off[BITC_COM]   char com[ncom][2]    The comment definitions
+   off[BITC_BYTE]  int byte[256]        The automaton, see BuildMatch
+   off[BITC_KID]   int kid[nstate+1]
+   off[BITC_CLS]   int cls[nstate]
+   off[BITC_FAIL]  int fail[nstate]
+   off[BITC_OUT]   int out[nstate]
+   off[BITC_LINK]  int link[nstate]
+   off[BITC_SRC]   char src[]           Name of the rules file
+
+   The rules are numbered in the order in which they are applied.
+   Offsets and lengths are 64-bit, and LoadComp checks them against
+   the size of the file and the counts before anything is used.
+   The compiled file is refused if the rules file is missing or no
+   longer has the hash it had. The hash is only computed again when
+   the size or time of the rules file changed */
+#define BITC_MAGIC "BITRCOMP"
+#define BITC_VERSION 4
+#define BITC_IP0 0
+#define BITC_LIP0 1
+#define BITC_IP1 2
+#define BITC_LIP1 3
+#define BITC_LO 4
+#define BITC_HI 5
+#define BITC_RUL0 6
+#define BITC_RUL1 7
+#define BITC_COM 8
+#define BITC_BYTE 9
+#define BITC_KID 10
+#define BITC_CLS 11
+#define BITC_FAIL 12
+#define BITC_OUT 13
+#define BITC_LINK 14
+#define BITC_SRC 15
+#define BITC_NSEC 16
+
+struct bitc_head {
+  char magic[8];               /* BITC_MAGIC */
+  unsigned int version;        /* BITC_VERSION */
+  unsigned int endian;         /* 0x01020304 */
+  unsigned long long srchash;  /* Hash of the rules file */
+  long long srcsize;           /* Its size */
+  long long srctime, srcnsec;  /* Its modification time */
+  int bitdir, poly;            /* Direction, and poly as it was set */
+  int ndef, nout, ncom, nstate, nclass;
+  int lstr[2];
+  char csep, spare[3];
+  char rucodi[4], rucodo[4];
+  unsigned long long off[BITC_NSEC]; /* Byte offset of each section */
+  unsigned long long len[BITC_NSEC]; /* Its length, without padding */
+  unsigned long long size;     /* Size of the file */
+};
 
 /*
    Bi-Directional Translation / Substitution Tool.
@@ -20,6 +95,7 @@ int debr=0;      /* Debugging output levels */
 int debs=0;
 int strict=0;    /* Be strict about matching transliteration alphabets */
 int mute=0;      /* Normal output to stderr, or less */
+int compile=0;   /* Only compile the rules file, see WriteComp */
 
 int infarg= -1;  /* Argument of input file name */
 int oufarg= -1;  /* Argument of output file name */
@@ -31,7 +107,14 @@ int rufarg= -1;  /* Argument of rules file name */
 FILE *fin, *fout, *frul; /* File handles */
 FILE *fdeb;              /* Debug file handle */
 
-char orig[WIDTXT], text[WIDTXT], modt[WIDTXT], spcs[WIDTXT];
+/* Line buffers. They start at WIDTXT bytes and grow by doubling
+   when a longer line arrives (see GrowBuf and TextRoom) */
+char *orig, *text, *modt, *spcs;
+char *ntext, *nmodt, *nspcs; /* The line being built by a rule, see ProcLine */
+int widorig = 0;  /* Allocated size of orig */
+int widtext = 0;  /* Allocated size of text, modt, spcs and the new ones */
+char *crul, *cwork; /* One rules file entry, and a work area for it */
+int widrul = 0, widwork = 0;
 
 char chutf[3];    /* to store UTF-8 strings */
 
@@ -51,18 +134,58 @@ char rucodo[ ] = "    ";
 int  samecode;
 int  levout = -1;   /* Optional STA level for output file */
 int  hascr          /* >0 if an input file includes CR characters */;
-char lcom[MAXCOM][2];
-int ip[2][MAXDEF][2];  /* Pointers to the collected replacement strings */
-int lip[2][MAXDEF];    /* The real lengths of the replacement strings */
-int lipsor[2][MAXDEF];    /* Their lengths for the purpose of sorting */
+char *lcom = NULL;       /* Comment definitions, two characters each */
+int widcom = 0;
+unsigned char ccls[256]; /* Class bits (BC_..) of each character */
+char cclose[256];        /* Closing character of each comment opener */
+
+/* The rules, as a table for each item that grows with the number
+   of rules (see RuleRoom), or of output tokens for ip[1], lip[1] and
+   lipsor[1] (see OutRoom). SortRules numbers the rules in the order
+   in which they are applied */
+int *ip[2];            /* Pointers to the collected replacement strings */
+int *lip[2];           /* The real lengths of the replacement strings */
+int *lipsor[2];        /* Their lengths for the purpose of sorting */
+int *sblk;             /* Sorting block points */
+int widdef = 0;        /* Allocated size of the tables of the rules */
+int widout = 0;        /* and of those of the output tokens */
+
+/* The strings of the tokens, each one kept once (see AddTok) */
 int lstr[2];           /* The total lengths, not including the final NULLs */
-char rulz[2][MAXRUL];  /* The actual strings. It has NULLS too. */
-int ix[MAXDEF];        /* (Forward) sorting list */
-int sblk[MAXDEF];      /* Sorting block points */
+char *rulz[2];         /* The actual strings. It has NULLS too. */
+int widrulz[2];
+int *tokslot[2];       /* Hash table of the tokens in each pool */
+int *toklen[2];        /* Length of the token in each slot */
+int nslot[2], ntoks[2];
+
+/* Matching automaton of the input tokens (Aho-Corasick), see BuildMatch.
+   The states are numbered breadth first, and the children of each
+   state follow one another in the order of their classes */
+int nstate = 0;        /* Number of states, state 0 is the start */
+int nclass = 1;        /* Number of byte classes */
+int acbyte[256];       /* Class of each byte, 0 if in no token */
+int *ackid = NULL;     /* Children of a state, ackid[state] to ackid[state+1]-1 */
+int *accls = NULL;     /* Class of the byte that leads to a state */
+int *acfail = NULL;    /* Longest proper suffix of a state that is a state */
+int acroot[257];       /* Child of state 0 for each class, or 0 */
+int *acout = NULL;     /* Rule whose input token ends in a state, or -1 */
+int *aclink = NULL;    /* Next state with a rule on the suffix chain, or 0 */
+
+/* Occurrences of the input tokens in the line, see FindTokens */
+int *occpos = NULL;    /* Position of each occurrence */
+int *occnext = NULL;   /* Next occurrence of the same rule, or -1 */
+int nocc = 0, widocc = 0;
+int *occfirst;         /* First and last occurrence of each rule */
+int *occlast;
+int *occscan;          /* Number of the scan that found them */
+int *occrule;          /* The rules found */
+int nfound = 0;
+int byfound = 0;       /* 1 if occrule is sorted for ProcLine */
+int nscan = 0;
 
 /* The following are for the homophonic option */
-int istrlo[MAXDEF];    /* Pointer to first (unsorted) output string option */
-int istrhi[MAXDEF];    /* Pointer to last  (unsorted) output string option */
+int *istrlo;           /* Pointer to first (unsorted) output string option */
+int *istrhi;           /* Pointer to last  (unsorted) output string option */
 
 long int locseed = 1;  /* Initial seed for local random function */
 int nrulw;             /* Number of words in rules file record */
@@ -76,53 +199,176 @@ int ivtfform = 0 /* value 1 if the input file has an IVTFF header, set in main *
 
 /*-----------------------------------------------------------*/
 
-void shiftl(int index, int nrlost)
+int GrowBuf(char **pbuf, int *pmax, int need)
+
+/* Make sure that the buffer (*pbuf) of size (*pmax) has at
+   least (need) bytes, doubling its size as often as necessary.
+   The contents are kept and new bytes are set to zero */
+/* Return 0 if all OK, 1 if out of memory */
+
+{
+  int nmax;
+  char *nbuf;
+
+  if (need <= *pmax) return 0;
+  nmax = (*pmax > 0) ? *pmax : need;
+  while (nmax < need) nmax *= 2;
+  nbuf = (char *) realloc(*pbuf, nmax);
+  if (nbuf == NULL) {
+    if (mute < 2) fprintf (stderr, "E: out of memory\n");
+    return 1;
+  }
+  memset(nbuf + *pmax, 0, nmax - *pmax);
+  *pbuf = nbuf; *pmax = nmax;
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int TextRoom(int need)
 
-/* Shift left by (nrlost) bytes the part of the three
-   strings text, modt and spcs,
-   STARTING AT (index), which can be 0 or higher */
-/* This also moves the terminating NULLs */
+/* Make sure that text, modt and spcs, and ntext, nmodt and nspcs,
+   have at least (need) bytes */
+/* Return 0 if all OK, 1 if out of memory */
 
 {
-  int jj, lold, lnew;
+  int wid;
+
+  if (need <= widtext) return 0;
+  wid = widtext;
+  if (GrowBuf(&text, &wid, need)) return 1;
+  wid = widtext;
+  if (GrowBuf(&modt, &wid, need)) return 1;
+  wid = widtext;
+  if (GrowBuf(&spcs, &wid, need)) return 1;
+  wid = widtext;
+  if (GrowBuf(&ntext, &wid, need)) return 1;
+  wid = widtext;
+  if (GrowBuf(&nmodt, &wid, need)) return 1;
+  wid = widtext;
+  if (GrowBuf(&nspcs, &wid, need)) return 1;
+  widtext = wid;
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
 
-  lold = strlen(text);
-  lnew = lold - nrlost;
-  for (jj = index; jj<=lnew; jj++) {
-    text[jj] = text[jj+nrlost];
-    modt[jj] = modt[jj+nrlost];
-    spcs[jj] = spcs[jj+nrlost];
+int RuleRoom(int need)
+
+/* Make sure that the tables of the rules have room for (need) rules */
+/* Return 0 if all OK, 1 if out of memory */
+
+{
+  int *(*tab[6]);
+  int jt, wid;
+
+  tab[0] = &ip[0]; tab[1] = &lip[0]; tab[2] = &lipsor[0];
+  tab[3] = &sblk; tab[4] = &istrlo; tab[5] = &istrhi;
+  need *= sizeof(int);
+  if (need <= widdef) return 0;
+  for (jt=0; jt<6; jt++) {
+    wid = widdef;
+    if (GrowBuf((char **) tab[jt], &wid, need)) return 1;
   }
-  return;
+  widdef = wid;
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int OutRoom(int need)
+
+/* Make sure that the tables of the output tokens have room for
+   (need) tokens */
+/* Return 0 if all OK, 1 if out of memory */
+
+{
+  int wid;
+
+  need *= sizeof(int);
+  if (need <= widout) return 0;
+  wid = widout;
+  if (GrowBuf((char **) &ip[1], &wid, need)) return 1;
+  wid = widout;
+  if (GrowBuf((char **) &lip[1], &wid, need)) return 1;
+  wid = widout;
+  if (GrowBuf((char **) &lipsor[1], &wid, need)) return 1;
+  widout = wid;
+  return 0;
 }
 
 /*-----------------------------------------------------------*/
 
-void shiftr(int index, int nradd)
+unsigned int HashTok(char *tok, int len)
 
-/* Shift right by (nradd) bytes the part of the three
-   strings text, modt and spcs,
-   STARTING AT (index), which can be 0 or higher. 
-   Fill the new spot(s) with space(s).
-   Assumes that length checks have been done */
-/* This also moves the terminating NULL */
+/* FNV-1a hash of a rules token of (len) bytes */
 
 {
-  int jj, lold, lnew;
+  unsigned int h = 2166136261U;
+  int jj;
 
-  lold = strlen(text);
-  lnew = lold + nradd;
-  for (jj = lold; jj>=index; jj--) {
-    text[jj+nradd] = text[jj];
-    modt[jj+nradd] = modt[jj];
-    spcs[jj+nradd] = spcs[jj];
+  for (jj=0; jj<len; jj++) {
+    h ^= (unsigned char) tok[jj];
+    h *= 16777619U;
   }
-  for (jj = index; jj<index+nradd; jj++) {
-    text[jj] = ' ';
-    modt[jj] = ' ';
-    spcs[jj] = ' ';
+  return h;
+}
+
+/*-----------------------------------------------------------*/
+
+int AddTok(int io, char *w, int len)
+
+/* Add a token of (len) bytes to the strings rulz[io], unless it is
+   there already, and return where it starts */
+/* Return -1 if out of memory */
+
+{
+  int js, jt, jp, nsl;
+  int *slot, *slen;
+
+  /* Keep the hash table at most half full */
+  if (2 * (ntoks[io] + 1) > nslot[io]) {
+    nsl = (nslot[io] > 0) ? 2 * nslot[io] : 64;
+    slot = (int *) malloc(nsl * sizeof(int));
+    slen = (int *) malloc(nsl * sizeof(int));
+    if (slot == NULL || slen == NULL) {
+      if (mute < 2) fprintf (stderr, "E: out of memory\n");
+      free(slot); free(slen);
+      return -1;
+    }
+    for (js=0; js<nsl; js++) slot[js] = -1;
+    for (jt=0; jt<nslot[io]; jt++) {
+      jp = tokslot[io][jt];
+      if (jp < 0) continue;
+      js = HashTok(&rulz[io][jp], toklen[io][jt]) & (nsl - 1);
+      while (slot[js] >= 0) js = (js + 1) & (nsl - 1);
+      slot[js] = jp;
+      slen[js] = toklen[io][jt];
+    }
+    free(tokslot[io]); free(toklen[io]);
+    tokslot[io] = slot;
+    toklen[io] = slen;
+    nslot[io] = nsl;
   }
-  return;
+
+  js = HashTok(w, len) & (nslot[io] - 1);
+  while ((jp = tokslot[io][js]) >= 0) {
+    if (toklen[io][js] == len && memcmp(&rulz[io][jp], w, len) == 0) {
+      return jp;
+    }
+    js = (js + 1) & (nslot[io] - 1);
+  }
+
+  /* A new one, after the NULL of the previous one */
+  if (GrowBuf(&rulz[io], &widrulz[io], lstr[io] + len + 2)) return -1;
+  jp = lstr[io] + 1;
+  memcpy(&rulz[io][jp], w, len);
+  rulz[io][jp+len] = (char) 0;
+  lstr[io] = jp + len;
+  tokslot[io][js] = jp;
+  toklen[io][js] = len;
+  ntoks[io] += 1;
+  return jp;
 }
 
 /*-----------------------------------------------------------*/
@@ -423,16 +669,12 @@ int addio(char *buf, char *w, int ii, int iolo, int iohi)
 
 {
   int io;
-  int lenstr;
-  int jj, jjbase, jjend;
+  int jjbase, jjend;
   int jdefo;
   int iproc, lenr, lens;
 
+  if (RuleRoom(ndef+1)) return 1;
   ndef += 1;
-  if (ndef >= MAXDEF) {
-    if (mute < 2) fprintf (stderr, "E: too many rules\n");        
-    return 1;
-  }
   sblk[ndef-1] = 0;
 
   /* Add the INPUT token */
@@ -454,23 +696,9 @@ int addio(char *buf, char *w, int ii, int iolo, int iohi)
     return 1;
   }
 
-  lenstr = lstr[0] + lenr;
-  if (lenstr+1 >= MAXRUL) {
-    if (mute < 2) {
-      fprintf (stderr, "E: combined input tokens too long\n");        
-    }
-    return 1;
-  }
-
   lip[0][ndef-1] = lenr;
-  ip[0][ndef-1][0] = lstr[0]+1;
-  ip[0][ndef-1][1] = lenstr;
-
-  for (jj=0; jj<lenr; jj++) {
-    rulz[0][lstr[0]+jj+1] = w[jj];
-  }
-  rulz[0][lenstr+1] = (char) 0;
-  lstr[0] = lenstr + 1;
+  ip[0][ndef-1] = AddTok(0, w, lenr);
+  if (ip[0][ndef-1] < 0) return 1;
   lipsor[0][ndef-1] = lens;
 
   /* Add the OUTPUT token(s) */
@@ -492,6 +720,7 @@ int addio(char *buf, char *w, int ii, int iolo, int iohi)
 
     jdefo += 1;
     istrhi[ndef-1] = jdefo;
+    if (OutRoom(jdefo+1)) return 1;
 
     jjbase = irulw0[io];
     jjend  = irulw1[io];
@@ -505,23 +734,10 @@ int addio(char *buf, char *w, int ii, int iolo, int iohi)
       }
       return 1;
     }
-    lenstr = lstr[1] + lenr;
-    if (lenstr+1 >= MAXRUL) {
-      if (mute < 2) {
-        fprintf (stderr, "E: combined output tokens too long\n");        
-      }
-      return 1;
-    }
 
     lip[1][jdefo] = lenr;
-    ip[1][jdefo][0] = lstr[1]+1;
-    ip[bitto][jdefo][1] = lenstr;
-
-    for (jj=0; jj<lenr; jj++) {
-      rulz[1][lstr[1]+jj+1] = w[jj];
-    }
-    rulz[1][lenstr+1] = (char) 0;
-    lstr[1] = lenstr + 1;
+    ip[1][jdefo] = AddTok(1, w, lenr);
+    if (ip[1][jdefo] < 0) return 1;
     lipsor[1][jdefo] = lens;
 
   }   /* End for io */
@@ -589,7 +805,8 @@ void OutLine( )
 int ParseOpts(int argc,char *argv[])
 /* Parse command line options. There can be several and each should be
    of one of the following types:
-   -1, 2, -s, -mn, -vn, -f <filename>
+   -1, 2, -s, -mn, -vn, -f <filename>, -o <filename>,
+   --compile <filename>
    where n can be a small integer
 
    <filename>:
@@ -655,6 +872,18 @@ int ParseOpts(int argc,char *argv[])
              iar += 1;
              rufarg = iar;
              break;
+           case 'o':
+             iar += 1;
+             oufarg = iar;
+             break;
+           case '-':
+             if (strcmp(argv[iar], "--compile") == 0) {
+               /* Compile the rules file that follows */
+               iar += 1;
+               rufarg = iar;
+               compile = 1;
+             }
+             break;
       }
     } else {
       /* A file name. Check which of two */
@@ -717,31 +946,45 @@ int DumpOpts(int argc,char *argv[])
 
   /* List and open the Files */
 
-  /* Input file */
-  if (mute == 0) fprintf (stderr,"\nInput file: ");
-  if (infarg >= 0) {
-    if (mute == 0) fprintf(stderr, "%s\n",argv[infarg]);
-    if ((fin = fopen(argv[infarg], "r")) == NULL) {
-      if (mute < 2) fprintf(stderr, "E: input file does not exist\n");
+  /* When compiling the rules, the only other file is the compiled one */
+  if (compile) {
+    if (oufarg < 0 || infarg >= 0) {
+      if (mute < 2) fprintf(stderr, "E: give only the compiled file, with -o\n");
       return 1;
     }
-  } else {
-    fin = stdin;
-    if (mute == 0) fprintf (stderr,"<stdin>\n");
-  }
-  
-  /* Output file */
-  if (mute == 0) fprintf (stderr,"Output file: ");
-  if (oufarg >= 0) {
-    if (mute == 0) fprintf(stderr, "%s\n", argv[oufarg]);
-    if ((fout = fopen(argv[oufarg], "w")) == NULL) {
-      if (mute < 2) fprintf(stderr, "E: cannot open output file\n");
+    if (mute == 0) fprintf (stderr,"\nCompiled rules file: %s\n", argv[oufarg]);
+    if ((fout = fopen(argv[oufarg], "wb")) == NULL) {
+      if (mute < 2) fprintf(stderr, "E: cannot open compiled rules file\n");
       return 1;
     }
   } else {
-    fout = stdout;
-    if (mute == 0) fprintf (stderr, "<stdout>\n");
-  } 
+
+    /* Input file */
+    if (mute == 0) fprintf (stderr,"\nInput file: ");
+    if (infarg >= 0) {
+      if (mute == 0) fprintf(stderr, "%s\n",argv[infarg]);
+      if ((fin = fopen(argv[infarg], "r")) == NULL) {
+        if (mute < 2) fprintf(stderr, "E: input file does not exist\n");
+        return 1;
+      }
+    } else {
+      fin = stdin;
+      if (mute == 0) fprintf (stderr,"<stdin>\n");
+    }
+
+    /* Output file */
+    if (mute == 0) fprintf (stderr,"Output file: ");
+    if (oufarg >= 0) {
+      if (mute == 0) fprintf(stderr, "%s\n", argv[oufarg]);
+      if ((fout = fopen(argv[oufarg], "w")) == NULL) {
+        if (mute < 2) fprintf(stderr, "E: cannot open output file\n");
+        return 1;
+      }
+    } else {
+      fout = stdout;
+      if (mute == 0) fprintf (stderr, "<stdout>\n");
+    } 
+  }
 
   /* Rules file */
   if (mute == 0) fprintf (stderr,"Rules file: ");
@@ -766,18 +1009,19 @@ int DumpOpts(int argc,char *argv[])
 
 /*-----------------------------------------------------------*/
 
-int GetLine(char *buf, FILE *fh, int max)
+int GetLine(char **pbuf, int *pmax, FILE *fh)
 
 /* Get a line from some input file to some buffer */
 /* The line is expected to end with newline, but this is not
    saved in the buffer. Instead, it will end with a NULL */
+/* The buffer (*pbuf) of size (*pmax) grows for a long line */
 /* Return 0 if all OK, <0 if EOF, 1 if error */
 /* -1 if EOF after newline, -2 if EOF after partial line */
 
 {
   int cr = 0, eod = 0, index = 0, iget;
   int jj;
-  char cget;
+  char cget, *buf = *pbuf;
 
   while (cr == 0 && eod == 0) {
     iget = fgetc(fh);
@@ -808,14 +1052,10 @@ int GetLine(char *buf, FILE *fh, int max)
       /* This is simply skipped - continue with next read */
     } else {
       /* Should add the character to the buffer */
-      /* However, first check for buffer overflow */
-      if (index >= (max-2)) {
-        buf[index] = 0;
-        if (mute < 2) {
-          fprintf (stderr, "E: record too long.\n");        
-          fprintf (stderr, "Line read so far: %s\n", buf); 
-        }
-        return 1;
+      /* However, first make room for a longer record */
+      if (index >= (*pmax-2)) {
+        if (GrowBuf(pbuf, pmax, 2 * *pmax)) return 1;
+        buf = *pbuf;
       }
 
       /* Check for newline */
@@ -845,14 +1085,14 @@ void ShowRules( )
   fprintf(fdeb,"\n");
   fprintf(fdeb,"Nr rules: %4d\n", ndef);
   fprintf(fdeb,"Length 1: %4d\n", lstr[0]);
-  for (jj=0; jj<20; jj++) {
+  for (jj=0; jj<20 && jj<=lstr[0]; jj++) {
     ich = (int) rulz[0][jj];
     /* fprintf(fdeb,"   %2x\n",ich); */
     fprintf(fdeb,"   %2x\n",rulz[0][jj]);
   }
   fprintf(fdeb,"\n");
   fprintf(fdeb,"Length 2: %4d\n", lstr[1]);
-  for (jj=0; jj<20; jj++) {
+  for (jj=0; jj<20 && jj<=lstr[1]; jj++) {
     ich = (int) rulz[1][jj];
     /* fprintf(fdeb,"   %2x\n",ich); */
     fprintf(fdeb,"   %2x\n",rulz[1][jj]);
@@ -877,6 +1117,22 @@ void ShowLines( )
 
 /*-----------------------------------------------------------*/
 
+void ShowParts(int jdst, int jsrc)
+
+/* Temporary debug output for testing the processing, while a rule
+   is being applied: the new line up to (jdst), followed by the
+   old one from (jsrc) on */
+
+{
+  fprintf(fdeb,"%.*s%s\n",jdst,ntext,text+jsrc);
+  fprintf(fdeb,"%.*s%s\n",jdst,nmodt,modt+jsrc);
+  fprintf(fdeb,"%.*s%s\n",jdst,nspcs,spcs+jsrc);
+  fprintf(fdeb,"\n");
+
+}
+
+/*-----------------------------------------------------------*/
+
 int ReadRules( )
 
 /* Read the rules file to memory.  Return 0 if all OK, 1 if error */
@@ -890,8 +1146,6 @@ int ReadRules( )
   int len01, len23, lentst;
   int jj0, jj1, jj2, jj3;
   int iadd;
-  char crul[WIDRUL];  /* Contents of one rules file entry */
-  char work[WIDRUL];  /* Temporary work area */
   char ctest[ ] = "##BIT";
 
   char cdir;
@@ -904,7 +1158,7 @@ int ReadRules( )
 
     /* Read one rules line to buffer */
 
-    igetr = GetLine(crul,frul,WIDRUL);
+    igetr = GetLine(&crul,&widrul,frul);
     eorulf = (igetr < 0);
     if (igetr == -1) {  /* Normal EOF */
       return 0;
@@ -912,6 +1166,7 @@ int ReadRules( )
     if (igetr > 0) {  /* An error */
       return 2;
     }
+    if (GrowBuf(&cwork, &widwork, widrul)) return 2;
 
     /* Now a line was read */
     nlin += 1;
@@ -1017,17 +1272,14 @@ int ReadRules( )
           if (i0 >= 0) {
 
             /* Comment record. Process it */
-            if (ncom >= MAXCOM) {
-              if (mute < 2) fprintf (stderr, "E: too many comment records\n");        
-              return 1;
-            }
+            if (GrowBuf(&lcom, &widcom, 2*(ncom+1))) return 1;
             /* fprintf(stderr,"Len comm %2d\n",lcrul-i0); */
             ncom += 1;
-            lcom[ncom-1][0] = crul[i0-1];
+            lcom[2*ncom-2] = crul[i0-1];
             if (lcrul-i0 > 9) {
-              lcom[ncom-1][1] = crul[i0+9];
+              lcom[2*ncom-1] = crul[i0+9];
             } else {
-              lcom[ncom-1][1] = ' ';
+              lcom[2*ncom-1] = ' ';
               if (mute < 2) {
                 fprintf (stderr, "W: comment record short - space added\n");        
               }
@@ -1092,7 +1344,7 @@ int ReadRules( )
         if (bitfr == 0) {
 
           /* One input with possibly several outputs */
-          iadd = addio(crul,work,0,1,iritg-1);
+          iadd = addio(crul,cwork,0,1,iritg-1);
           if (iadd != 0) {
             if (mute < 2) {
               fprintf (stderr, "E: cannot add rule to structure\n");        
@@ -1104,7 +1356,7 @@ int ReadRules( )
 
           /* Possibly several inputs all with the same output */
           for (iw=1; iw<iritg; iw++) {
-            iadd = addio(crul,work,iw,0,0);
+            iadd = addio(crul,cwork,iw,0,0);
             if (iadd != 0) {
               if (mute < 2) {
                 fprintf (stderr, "E: cannot add rule to structure\n");        
@@ -1128,22 +1380,59 @@ int ReadRules( )
 
 /*-----------------------------------------------------------*/
 
+int FindTok(int *hslot, int mask, char *tok, int len, unsigned int h)
+
+/* Find the slot of a token with hash (h) in the hash table of the
+   input tokens, or the empty slot where it should go */
+
+{
+  int js, jr;
+
+  js = h & mask;
+  while ((jr = hslot[js]) >= 0) {
+    if (lip[0][jr] == len &&
+        memcmp(&rulz[0][ip[0][jr]], tok, len) == 0) break;
+    js = (js + 1) & mask;
+  }
+  return js;
+}
+
+/*-----------------------------------------------------------*/
+
+int CompRule(const void *p1, const void *p2)
+
+/* Order of the rules for SortRules: longest effective length first,
+   and otherwise as they were read */
+
+{
+  int ii1 = *(const int *) p1, ii2 = *(const int *) p2;
+
+  if (lipsor[0][ii1] != lipsor[0][ii2]) return lipsor[0][ii2] - lipsor[0][ii1];
+  return ii1 - ii2;
+}
+
+/*-----------------------------------------------------------*/
+
 int SortRules( )
 
-/* Sort the rules that were stored in memory. 
+/* Sort the rules that were stored in memory, and number them
+   in that order.
    Return 0 if all OK, 1 if error */
    
 {
-  int didswap, ambig;
-  int jjend, js1;
-  int ii1, ii2, ipi1, ipi2, leni1, leni2;
-  int lens1, lens2;
-  int icomp;
-  int numcheck;
-
-  /* This routine implements a bubble sort looking at the lenghts */
-  /* This is different from the fortran implementation */
-  /* From version 1.4 onwards, it uses 'effective lengths' */
+  int ambig;
+  int js1, jsb, jj, jr, jf, jt, leni;
+  int nhash, mask;
+  int *hslot, *first, *nsame, *rank, *ix;
+  int *tab[5];
+  unsigned int h;
+  char *tok;
+
+  /* The input tokens are put in a hash table, which finds the
+     repeated rules, and then the rules that are shadowed by an
+     earlier one. The rules are sorted by their effective lengths
+     (from version 1.4 onwards) within each block, keeping the
+     order of the rules file for equal lengths */
 
   if (mute == 0) {
     fprintf(stderr, "\nAnalysing %3d substitution rules\n", ndef);
@@ -1158,101 +1447,130 @@ int SortRules( )
 
   ambig = 0;
 
-  /* Outer loop 1, to check for conflicting / multiple rules */
+  nhash = 2;
+  while (nhash < 2 * ndef) nhash *= 2;
+  mask = nhash - 1;
+  hslot = (int *) malloc(nhash * sizeof(int));
+  first = (int *) malloc(ndef * sizeof(int));
+  nsame = (int *) calloc(ndef, sizeof(int));
+  rank = (int *) malloc(ndef * sizeof(int));
+  ix = (int *) malloc(ndef * sizeof(int));
+  if (hslot == NULL || first == NULL || nsame == NULL || rank == NULL ||
+      ix == NULL) {
+    if (mute < 2) fprintf (stderr, "E: out of memory\n");
+    free(hslot); free(first); free(nsame); free(rank); free(ix);
+    return 1;
+  }
+  for (jj=0; jj<nhash; jj++) hslot[jj] = -1;
+
+  /* Check for conflicting / multiple rules. Each rule is linked
+     to the first one with the same input token */
 
-  numcheck = 0;
   if (debr) {
     fprintf(fdeb, "Checking...\n");
   }
-  for (ii1=0; ii1<ndef-1; ii1++) {
-
-    for (ii2=ii1+1; ii2<ndef; ii2++) {
-
-      numcheck += 1;
-
-      ipi1 = ip[0][ii1][0];
-      ipi2 = ip[0][ii2][0];
-      /* leni1 = ip[0][ii1][1] - ipi1 + 1;
-         leni2 = ip[0][ii2][1] - ipi2 + 1; */
-      leni1 = lip[0][ii1];
-      leni2 = lip[0][ii2];
-
-      if (debr) {
-        if (numcheck < 5000) {
-          fprintf(fdeb, " comp1: L=%d, %s\n", leni1,&rulz[0][ipi1]);
-          fprintf(fdeb, " comp2: L=%d, %s\n", leni2,&rulz[0][ipi2]);
-        }
-      }
+  for (jr=0; jr<ndef; jr++) {
+    tok = &rulz[0][ip[0][jr]];
+    leni = lip[0][jr];
+    js1 = FindTok(hslot, mask, tok, leni, HashTok(tok, leni));
+    if (hslot[js1] < 0) hslot[js1] = jr;
+    first[jr] = hslot[js1];
+    nsame[first[jr]] += 1;
+  }
 
-      if (leni2 == leni1) {
-        /* Check for repeated rules */
-        icomp = strncmp(&rulz[0][ipi1],&rulz[0][ipi2],leni1);
-        if (icomp == 0) {
-          if (mute < 2) {
-            fprintf(stderr, "E: multiple rules for %s\n", &rulz[0][ipi1]);
-          }
-          ambig = 1;
-        }
+  /* One message for each pair of the same rules, in the order of
+     the first rule of the pair */
+  for (jr=0; jr<ndef; jr++) {
+    jf = first[jr];
+    nsame[jf] -= 1;
+    for (jj=0; jj<nsame[jf]; jj++) {
+      if (mute < 2) {
+        fprintf(stderr, "E: multiple rules for %s\n", &rulz[0][ip[0][jr]]);
       }
-    }   /* End of first (inner) for loop */
-
-  }   /* End outer loop 1 */
-
-  /* Initialise the sorting */
-
-  for (js1=0; js1<ndef; js1++) {
-    ix[js1]=js1;
+      ambig = 1;
+    }
   }
 
-  /* Outer loop 2, bubble sort by length */
+  /* Sort each block by length */
 
   if (debr) {
     fprintf(fdeb, "\nSorting...\n");
   }
-  didswap = 1;
-  jjend = ndef-1;
-
-  while (didswap && (jjend >=0)) {
-
-    didswap = 0;
+  for (js1=0; js1<ndef; js1++) {
+    ix[js1]=js1;
+  }
+  jsb = 0;
+  for (js1=0; js1<ndef; js1++) {
+    if (sblk[js1] || js1 == ndef-1) {
+      qsort(&ix[jsb], js1-jsb+1, sizeof(int), CompRule);
+      jsb = js1 + 1;
+    }
+  }
+  for (js1=0; js1<ndef; js1++) {
+    jr = ix[js1];
+    rank[jr] = js1;
+    if (debr) {
+      fprintf(fdeb, " %4d: L=%d, Ls=%d %s\n", js1, lip[0][jr], lipsor[0][jr],
+              &rulz[0][ip[0][jr]]);
+      if (sblk[js1]) fprintf(fdeb, " ------\n");
+    }
+  }
 
-    for (js1=0; js1<jjend; js1++) {
+  /* A rule is shadowed by an earlier one for a prefix of its
+     input token, which takes all its occurrences first */
+  for (js1=0; js1<ndef; js1++) {
+    jr = ix[js1];
+    tok = &rulz[0][ip[0][jr]];
+    h = 2166136261U;
+    for (leni=1; leni<lip[0][jr]; leni++) {
+      h ^= (unsigned char) tok[leni-1];
+      h *= 16777619U;
+      jf = hslot[FindTok(hslot, mask, tok, leni, h)];
+      if (jf >= 0 && rank[jf] < js1) {
+        if (mute == 0) {
+          fprintf(stderr, "W: rule for %s is shadowed by the earlier rule for %s\n",
+                  tok, &rulz[0][ip[0][jf]]);
+        }
+      }
+    }
+  }
 
-      ii1 = ix[js1];
-      ii2 = ix[js1 + 1];
+  /* From now on the rules are applied in the order of their numbers */
+  tab[0] = ip[0]; tab[1] = lip[0]; tab[2] = lipsor[0];
+  tab[3] = istrlo; tab[4] = istrhi;
+  for (jt=0; jt<5; jt++) {
+    for (js1=0; js1<ndef; js1++) first[js1] = tab[jt][ix[js1]];
+    memcpy(tab[jt], first, ndef * sizeof(int));
+  }
 
-      ipi1 = ip[0][ii1][0];
-      ipi2 = ip[0][ii2][0];
-      /* leni1 = ip[0][ii1][1] - ipi1 + 1;
-         leni2 = ip[0][ii2][1] - ipi2 + 1; */
-      leni1 = lip[0][ii1];
-      leni2 = lip[0][ii2];
-      lens1 = lipsor[0][ii1];
-      lens2 = lipsor[0][ii2];
+  free(hslot); free(first); free(nsame); free(rank); free(ix);
+  return ambig;
+}
 
-      if (debr) {
-        fprintf(fdeb, " comp1: L=%d, Ls=%d %s\n", leni1,lens1,&rulz[0][ipi1]);
-        fprintf(fdeb, " comp2: L=%d, Ls=%d %s\n", leni2,lens2,&rulz[0][ipi2]);
-      }
-      if (lens2 > lens1) {
-        /* Do the swap if it is not blocked by a block record */
-        if (sblk[js1] == 0) {
-          ix[js1+1] = ii1;
-          ix[js1] = ii2;
-          if (debr) fprintf(fdeb, " swapped\n");
-          didswap = 1;
-        } else {
-          if (debr) fprintf(fdeb, " swap blocked\n");
-        }
-      }
+/*-----------------------------------------------------------*/
 
-    }      /* End of second (inner) for loop */
+void SetClass( )
 
-    jjend -=1;
+/* Set up the class bits of all characters, once the
+   comment definitions are known */
 
-  }       /* end of second outer loop (while jjend >= 0) */
+{
+  int jc;
+  unsigned char cl;
 
-  return ambig;
+  memset(ccls, 0, 256);
+  ccls[' '] = ccls['.'] = ccls[','] = BC_SEP;
+  for (jc=0; jc<ncom; jc++) {
+    cl = lcom[2*jc];
+    if (lcom[2*jc+1] == ' ') {
+      ccls[cl] |= BC_COML;
+    } else {
+      /* The last definition for the same opener applies */
+      ccls[cl] |= BC_COMO;
+      cclose[cl] = lcom[2*jc+1];
+    }
+  }
+  return;
 }
 
 /*-----------------------------------------------------------*/
@@ -1264,27 +1582,24 @@ int PrepLine( )
 /* Return -1 if the entire line is a comment */
 
 {
-  int jj, jc;
-  int iret;
+  int jj;
   char ch, clcom;
-  int issep;
+  unsigned char cl;
 
 
   /* Add a space at the start and at the end */
   text[lentext] = ' ';
   lentext += 1;
   text[lentext] = '\0';
-  shiftr(0,1);
+  memmove(text+1, text, lentext+1);
+  text[0] = ' ';
   lentext += 1;
 
-  /* Check for full line comment */
-  iret = 0;
-  for (jc=0; jc<ncom; jc++) {
-    if (lcom[jc][1] == ' ') {
-      if (text[1] == lcom[jc][0]) iret = -1;
-    }
+  /* Check for full line comment, which is written out as it is */
+  if (ccls[(unsigned char) text[1]] & BC_COML) {
+    memset(modt, '-', lentext);
+    return -1;
   }
-  if (iret < 0) return iret;
 
   /* Process the other comments, initialising "modt" */
 
@@ -1295,13 +1610,10 @@ int PrepLine( )
     modt[jj] = ' ';
     if (clcom == ' ') {
       /* Looking for start of a comment */
-      for (jc=0; jc<ncom; jc++) {
-        if (lcom[jc][1] != ' ') {
-          if (text[jj] == lcom[jc][0]) {
-            clcom = lcom[jc][1];
-            modt[jj] = '-';
-          }
-        }
+      cl = text[jj];
+      if (ccls[cl] & BC_COMO) {
+        clcom = cclose[cl];
+        modt[jj] = '-';
       }
     } else {
       /* Looking for end of a comment */
@@ -1317,9 +1629,7 @@ int PrepLine( )
     spcs[jj] = ' ';
     if (modt[jj] == ' ') {
       ch = text[jj];
-      issep = 0;
-      if (ch == ' ' || ch == '.' || ch == ',') issep = 1;
-      if (issep) {
+      if (ccls[(unsigned char) ch] & BC_SEP) {
         spcs[jj] = text[jj];
         text[jj] = csep;
       } else {
@@ -1338,98 +1648,404 @@ int PrepLine( )
 
 /*-----------------------------------------------------------*/
 
+int CompTok(const void *p1, const void *p2)
+
+/* Order of the rules for BuildMatch: by their input tokens, byte
+   by byte, and by number for the same token */
+
+{
+  int jr1 = *(const int *) p1, jr2 = *(const int *) p2;
+  int len, ic;
+
+  len = (lip[0][jr1] < lip[0][jr2]) ? lip[0][jr1] : lip[0][jr2];
+  ic = memcmp(&rulz[0][ip[0][jr1]], &rulz[0][ip[0][jr2]], len);
+  if (ic != 0) return ic;
+  if (lip[0][jr1] != lip[0][jr2]) return lip[0][jr1] - lip[0][jr2];
+  return jr1 - jr2;
+}
+
+/*-----------------------------------------------------------*/
+
+int AcNext(int js, int jc)
+
+/* The child of state (js) for byte class (jc), found by bisection
+   among the children of the state */
+/* Return the child, or 0 if there is none */
+
+{
+  int lo, hi, mid;
+
+  if (js == 0) return acroot[jc];
+  lo = ackid[js];
+  hi = ackid[js+1] - 1;
+  while (lo <= hi) {
+    mid = (lo + hi) / 2;
+    if (accls[mid] < jc) {
+      lo = mid + 1;
+    } else if (accls[mid] > jc) {
+      hi = mid - 1;
+    } else {
+      return mid;
+    }
+  }
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int BuildMatch( )
+
+/* Build the matching automaton of all input tokens, so that one
+   pass over the line finds all their occurrences. Only the tree of
+   the tokens and its failure links are kept, see FindTokens */
+/* Return 0 if all OK, 1 if error */
+
+{
+  int jr, jj, jc, js, jt, jf, jd, jp, nlive, nkeep, lastp, lastc;
+  long nmax;
+  int *tord, *tcur;
+  char *tok;
+
+  /* The bytes that occur in the tokens each have a class of their
+     own, numbered in the order of the bytes, and all others share
+     class 0 */
+  memset(acbyte, 0, sizeof(acbyte));
+  nmax = 1;
+  for (jr=0; jr<ndef; jr++) {
+    tok = &rulz[0][ip[0][jr]];
+    for (jj=0; jj<lip[0][jr]; jj++) acbyte[(unsigned char) tok[jj]] = 1;
+    nmax += lip[0][jr];
+  }
+  nclass = 1;
+  for (jc=0; jc<256; jc++) {
+    if (acbyte[jc] != 0) acbyte[jc] = nclass++;
+  }
+  if (nmax >= INT_MAX) {
+    if (mute < 2) fprintf (stderr, "E: too many input token bytes: %ld\n", nmax);
+    return 1;
+  }
+  ackid = (int *) malloc((nmax + 1) * sizeof(int));
+  accls = (int *) malloc(nmax * sizeof(int));
+  acfail = (int *) calloc(nmax, sizeof(int));
+  acout = (int *) malloc(nmax * sizeof(int));
+  aclink = (int *) calloc(nmax, sizeof(int));
+  tord = (int *) malloc((ndef + 1) * sizeof(int));
+  tcur = (int *) malloc((ndef + 1) * sizeof(int));
+  if (ackid == NULL || accls == NULL || acfail == NULL || acout == NULL ||
+      aclink == NULL || tord == NULL || tcur == NULL) {
+    if (mute < 2) fprintf (stderr, "E: out of memory\n");
+    free(tord); free(tcur);
+    return 1;
+  }
+
+  /* The rules in the order of their tokens. An empty token never
+     matches. Repeated tokens are an error found by SortRules, the
+     first rule is kept */
+  nlive = 0;
+  for (jr=0; jr<ndef; jr++) {
+    if (lip[0][jr] > 0) tord[nlive++] = jr;
+  }
+  qsort(tord, nlive, sizeof(int), CompTok);
+
+  /* The tree of the tokens, one depth at a time. The tokens that
+     are longer than the depth (jd) share their states when they
+     share their prefix, and these are next to each other, so the
+     children of each state are made one after the other in the
+     order of their classes. ackid is set for each state when its
+     first child is made, or when a later state has one (jp) */
+  nstate = 1;
+  accls[0] = 0;
+  acout[0] = -1;
+  for (jj=0; jj<nlive; jj++) tcur[jj] = 0;
+  jp = 0;
+  for (jd=0; nlive>0; jd++) {
+    nkeep = 0;
+    lastp = -1;
+    lastc = -1;
+    for (jj=0; jj<nlive; jj++) {
+      jr = tord[jj];
+      js = tcur[jj];
+      jc = acbyte[(unsigned char) rulz[0][ip[0][jr] + jd]];
+      if (js != lastp || jc != lastc) {
+        while (jp <= js) ackid[jp++] = nstate;
+        accls[nstate] = jc;
+        acout[nstate] = -1;
+        nstate++;
+        lastp = js;
+        lastc = jc;
+      }
+      jt = nstate - 1;
+      if (lip[0][jr] == jd + 1) {
+        if (acout[jt] < 0) acout[jt] = jr;
+      } else {
+        tord[nkeep] = jr;
+        tcur[nkeep++] = jt;
+      }
+    }
+    nlive = nkeep;
+  }
+  while (jp <= nstate) ackid[jp++] = nstate;
+  free(tord); free(tcur);
+
+  /* The failure links, and the next state with a rule on the
+     suffix chain. Both lead to a shallower state, which comes
+     first */
+  memset(acroot, 0, sizeof(acroot));
+  for (jt=ackid[0]; jt<ackid[1]; jt++) acroot[accls[jt]] = jt;
+  for (js=1; js<nstate; js++) {
+    jf = acfail[js];
+    aclink[js] = (acout[jf] >= 0) ? jf : aclink[jf];
+    for (jt=ackid[js]; jt<ackid[js+1]; jt++) {
+      jc = accls[jt];
+      jf = acfail[js];
+      while ((acfail[jt] = AcNext(jf, jc)) == 0 && jf > 0) jf = acfail[jf];
+    }
+  }
+
+  /* Give back what the tokens did not need */
+  ackid = (int *) realloc(ackid, (nstate + 1) * sizeof(int));
+  accls = (int *) realloc(accls, nstate * sizeof(int));
+  acfail = (int *) realloc(acfail, nstate * sizeof(int));
+  acout = (int *) realloc(acout, nstate * sizeof(int));
+  aclink = (int *) realloc(aclink, nstate * sizeof(int));
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int OccRoom(int need)
+
+/* Make sure that the occurrence lists have room for (need) entries */
+/* Return 0 if all OK, 1 if out of memory */
+
+{
+  int wid;
+
+  need *= sizeof(int);
+  if (need <= widocc) return 0;
+  wid = widocc;
+  if (GrowBuf((char **) &occpos, &wid, need)) return 1;
+  wid = widocc;
+  if (GrowBuf((char **) &occnext, &wid, need)) return 1;
+  widocc = wid;
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int ScanInit( )
+
+/* Set up the tables that FindTokens keeps for each rule */
+/* Return 0 if all OK, 1 if out of memory */
+
+{
+  occfirst = (int *) calloc(ndef + 1, sizeof(int));
+  occlast = (int *) calloc(ndef + 1, sizeof(int));
+  occscan = (int *) calloc(ndef + 1, sizeof(int));
+  occrule = (int *) calloc(ndef + 1, sizeof(int));
+  if (occfirst == NULL || occlast == NULL || occscan == NULL ||
+      occrule == NULL) {
+    if (mute < 2) fprintf (stderr, "E: out of memory\n");
+    return 1;
+  }
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int FindTokens( )
+
+/* Find all occurrences of all input tokens in the line in one
+   pass, as lists per rule in the order of their positions, and
+   the list of the rules that were found (occrule). This list is
+   sorted if it is short compared to the number of rules */
+/* Return 0 if all OK, 1 if out of memory */
+
+{
+  int jj, jc, js, jn, jt, jr;
+
+  nscan += 1;
+  nocc = 0;
+  nfound = 0;
+  js = 0;
+  for (jj=0; jj<lentext; jj++) {
+    jc = acbyte[(unsigned char) text[jj]];
+    if (jc == 0) {
+      js = 0;
+      continue;
+    }
+    while ((jn = AcNext(js, jc)) == 0 && js > 0) js = acfail[js];
+    js = jn;
+    jt = (acout[js] >= 0) ? js : aclink[js];
+    for ( ; jt > 0; jt = aclink[jt]) {
+      jr = acout[jt];
+      if (OccRoom(nocc+1)) return 1;
+      occpos[nocc] = jj - lip[0][jr] + 1;
+      occnext[nocc] = -1;
+      if (occscan[jr] != nscan) {
+        occscan[jr] = nscan;
+        occfirst[jr] = nocc;
+        occrule[nfound++] = jr;
+      } else {
+        occnext[occlast[jr]] = nocc;
+      }
+      occlast[jr] = nocc++;
+    }
+  }
+
+  byfound = ((long) nfound * nfound < ndef);
+  if (byfound) {
+    for (jj=1; jj<nfound; jj++) {
+      jr = occrule[jj];
+      for (jt=jj; jt>0 && occrule[jt-1]>jr; jt--) occrule[jt] = occrule[jt-1];
+      occrule[jt] = jr;
+    }
+  }
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
 int ProcLine( )
 
 /* Perform all substitutions on the line */
+/* The rules are applied one after the other, each from left to right
+   over the line as the previous rules left it. The occurrences are
+   taken from FindTokens, which is run again only after a rule has
+   replaced something. A rule builds the new line in ntext, nmodt
+   and nspcs: the text up to each replacement is copied, then the
+   output, and the rest at the end, after which the old and new
+   buffers change places. The old line does not change meanwhile,
+   so that its positions and flags stay valid for the whole rule.
+   When there are many rules, only those that were found are
+   visited, unless all of them are shown in the debugging output */
 
 {
-  int jd, jr, jro, jpi, jpo, jj, jc;
+  int jf, jr, jro, jpi, jpo, jj, jc;
   int jdout;
   int iret;
   int loc, newloc;
   int leni, leno, dlen;
   char ch, clcom, sepkeep;
   int issep, isfree;
+  int jo, rescan;
+  int jsrc, jdst, nrep;
+  char *swap;
+
+  rescan = 1;
+  jf = 0;
+  for (jr=0; jr<ndef; jr++) {
+
+    /* The rules found from this one on */
+    if (rescan) {
+      if (FindTokens( )) return 1;
+      rescan = 0;
+      if (byfound) {
+        for (jf=0; jf<nfound && occrule[jf]<jr; jf++) ;
+      }
+    }
+    if (byfound && debs == 0) {
+      if (jf >= nfound) break;
+      jr = occrule[jf++];
+    }
 
-  for (jd=0; jd<ndef; jd++) {
-    jr = ix[jd];
     /* Input pointers are fixed for this rule */
     /* Output pointers may vary in case of ambiguous substitutions */
-    jpi = ip[0][jr][0];
+    jpi = ip[0][jr];
     leni = lip[0][jr];
     if (debs) {
       fprintf(fdeb, " testing %s\n",&rulz[0][jpi]);
       fprintf(fdeb, " input  length: %3d\n",leni);
     }
 
-    /* Repeatedly search for this token */
-    loc = 0;
+    /* Go through the occurrences of this token, from the position
+       after the previous one. The old line has been copied up to
+       (jsrc) and the new one made up to (jdst) */
     newloc = 0;
+    jsrc = 0;
+    jdst = 0;
+    nrep = 0;
+    jo = (occscan[jr] == nscan) ? occfirst[jr] : -1;
+
+    for ( ; jo >= 0; jo = occnext[jo]) {
+
+      if (occpos[jo] < newloc) continue;
+      loc = occpos[jo];
+      if (debs) fprintf(fdeb, "   found at position %3d\n",loc+jdst-jsrc);
+      isfree = 1;
+
+      /* Select the output string */
+      jro = getio(jr);
+      jpo = ip[1][jro];
+      leno = lip[1][jro];
+      if (debs) {
+        fprintf(fdeb, " output length: %3d\n",leno);
+      }
 
-    while (loc >= 0) {
-
-      loc = cindex(&rulz[0][jpi],text,newloc);
-      if (loc <0) {
-        if (debs) fprintf(fdeb, "   not found\n");
+      /* set default new separator */
+      if (ivtfform) {
+        sepkeep = '.';
       } else {
-        if (debs) fprintf(fdeb, "   found at position %3d\n",loc);
-        isfree = 1;
-
-        /* Select the output string */
-        jro = getio(jr);
-        jpo = ip[1][jro][0];
-        leno = lip[1][jro];
-        if (debs) {
-          fprintf(fdeb, " output length: %3d\n",leno);
-        }
+        sepkeep = ' ';
+      }
+      for (jj=0; jj<leni; jj++) {
+        if (modt[loc+jj] != ' ') isfree = 0;
+        if (text[loc+jj] == csep) sepkeep = spcs[loc+jj];
+      }
+      if (isfree) {
+        if (debs) fprintf(fdeb, "    to be replaced\n");
 
-        /* set default new separator */
-        if (ivtfform) {
-          sepkeep = '.';
-        } else {
-          sepkeep = ' ';
+        if (debs && leno > leni) {
+          fprintf(fdeb, "    inserting space for %2d chars\n", leno-leni);
         }
-        for (jj=0; jj<leni; jj++) {
-          if (modt[loc+jj] != ' ') isfree = 0;
-          if (text[loc+jj] == csep) sepkeep = spcs[loc+jj];
+        if (debs && leno < leni) {
+          fprintf(fdeb, "    removing %2d chars\n", leni-leno);
         }
-        if (isfree) {
-          if (debs) fprintf(fdeb, "    to be replaced\n");
-
-          newloc = loc + leno;
 
-          /* Shift the text in case there is a length change */
-          if (leno > leni) {
-            dlen = leno - leni;
-            if (debs) {
-              fprintf(fdeb, "    inserting space for %2d chars\n", dlen);
-            }
-            shiftr(loc,dlen);
-            lentext += dlen;
-          } 
-          if (leno < leni) {
-            dlen = leni - leno;
-            if (debs) fprintf(fdeb, "    removing %2d chars\n", dlen);
-            shiftl(loc,dlen);
-            lentext -= dlen;
-          } 
-          for (jj=0; jj<leno; jj++) {
-            text[loc+jj] = rulz[1][jpo+jj];
-            if (text[loc+jj] == csep) {
-              spcs[loc+jj] = sepkeep;
-            } else {
-              spcs[loc+jj] = ' ';
-              modt[loc+jj] = '-';
-            }
+        /* Room for the new line up to here, the output and the
+           rest of the old line */
+        dlen = loc - jsrc;
+        if (TextRoom(jdst+dlen+leno+lentext-loc-leni+1)) return 1;
+        memcpy(ntext+jdst, text+jsrc, dlen);
+        memcpy(nmodt+jdst, modt+jsrc, dlen);
+        memcpy(nspcs+jdst, spcs+jsrc, dlen);
+        jdst += dlen;
+
+        /* The output is protected, except for its separators */
+        for (jj=0; jj<leno; jj++) {
+          ntext[jdst+jj] = rulz[1][jpo+jj];
+          if (ntext[jdst+jj] == csep) {
+            nspcs[jdst+jj] = sepkeep;
+            nmodt[jdst+jj] = ' ';
+          } else {
+            nspcs[jdst+jj] = ' ';
+            nmodt[jdst+jj] = '-';
           }
-          if (debs) ShowLines( );
-        } else {
-          if (debs) fprintf(fdeb, "    cannot replace\n");
-          newloc = loc + leni;
         }
+        jdst += leno;
+        jsrc = loc + leni;
+        nrep += 1;
+        rescan = 1;
+        if (debs) ShowParts(jdst, jsrc);
+      } else {
+        if (debs) fprintf(fdeb, "    cannot replace\n");
       }
-
-    }    /* End of while loop for each token */
+      newloc = loc + leni;
+
+    }    /* End of loop over the occurrences of each token */
+
+    /* The rest of the line, with the final NULL */
+    if (nrep > 0) {
+      dlen = lentext - jsrc + 1;
+      memcpy(ntext+jdst, text+jsrc, dlen);
+      memcpy(nmodt+jdst, modt+jsrc, dlen);
+      memcpy(nspcs+jdst, spcs+jsrc, dlen);
+      lentext = jdst + dlen - 1;
+      swap = text; text = ntext; ntext = swap;
+      swap = modt; modt = nmodt; nmodt = swap;
+      swap = spcs; spcs = nspcs; nspcs = swap;
+    }
+    if (debs) fprintf(fdeb, "   not found\n");
 
   }     /* End for loop over all different tokens */
   return 0;
@@ -1437,6 +2053,312 @@ int ProcLine( )
 
 /*-----------------------------------------------------------*/
 
+int HashFile(char *fname, unsigned long long *hash)
+
+/* FNV-1a hash of the contents of a file */
+/* Return 0 if all OK, 1 if it cannot be read */
+
+{
+  FILE *fh;
+  char buf[4096];
+  size_t nb, jj;
+  unsigned long long h = 14695981039346656037ULL;
+
+  if ((fh = fopen(fname, "rb")) == NULL) return 1;
+  while ((nb = fread(buf, 1, sizeof(buf), fh)) > 0) {
+    for (jj=0; jj<nb; jj++) {
+      h ^= (unsigned char) buf[jj];
+      h *= 1099511628211ULL;
+    }
+  }
+  fclose(fh);
+  *hash = h;
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int PutSect(void *data, unsigned long long len)
+
+/* Write one section of the compiled rules file, padded to a
+   multiple of 8 bytes */
+/* Return 0 if all OK, 1 if error */
+
+{
+  static char pad[8];
+
+  if (len > 0 && fwrite(data, 1, (size_t) len, fout) != len) return 1;
+  if (len % 8 && fwrite(pad, 1, 8 - len % 8, fout) != 8 - len % 8) return 1;
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+void CompLens(struct bitc_head *hd, unsigned long long *len)
+
+/* Lengths of the sections of a compiled rules file that follow
+   from the counts in its header, all but that of the name of the
+   rules file. The counts must not be negative */
+
+{
+  unsigned long long nd = hd->ndef, no = hd->nout, ns = hd->nstate;
+
+  len[BITC_IP0] = len[BITC_LIP0] = nd * sizeof(int);
+  len[BITC_IP1] = len[BITC_LIP1] = no * sizeof(int);
+  len[BITC_LO] = len[BITC_HI] = nd * sizeof(int);
+  len[BITC_RUL0] = (unsigned long long) hd->lstr[0] + 1;
+  len[BITC_RUL1] = (unsigned long long) hd->lstr[1] + 1;
+  len[BITC_COM] = 2ULL * hd->ncom;
+  len[BITC_BYTE] = sizeof(acbyte);
+  len[BITC_KID] = (ns + 1) * sizeof(int);
+  len[BITC_CLS] = len[BITC_FAIL] = ns * sizeof(int);
+  len[BITC_OUT] = len[BITC_LINK] = ns * sizeof(int);
+  len[BITC_SRC] = 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int CheckComp(struct bitc_head *hd)
+
+/* Check the header of a compiled rules file: the counts must be
+   valid, and the sections must have the lengths that follow from
+   them and lie one after the other within the file */
+/* Return 0 if all OK, 1 if not */
+
+{
+  unsigned long long len[BITC_NSEC], off;
+  int js;
+
+  if (hd->ndef < 0 || hd->nout < 0 || hd->ncom < 0 || hd->nstate < 1 ||
+      hd->nclass < 1 || hd->nclass > 257 || hd->lstr[0] < 0 || hd->lstr[1] < 0) {
+    return 1;
+  }
+  CompLens(hd, len);
+  len[BITC_SRC] = hd->len[BITC_SRC];
+  if (len[BITC_SRC] < 1) return 1;
+
+  off = (sizeof(struct bitc_head) + 7) & ~7ULL;
+  for (js=0; js<BITC_NSEC; js++) {
+    if (hd->off[js] != off || hd->len[js] != len[js]) return 1;
+    if (off > hd->size || len[js] > hd->size - off) return 1;
+    off += (len[js] + 7) & ~7ULL;
+  }
+  return (off != hd->size);
+}
+
+/*-----------------------------------------------------------*/
+
+int WriteComp(char *srcname)
+
+/* Write the sorted rules and their matching automaton to the
+   compiled rules file, see struct bitc_head */
+/* Return 0 if all OK, 1 if error */
+
+{
+  struct bitc_head hd;
+  struct stat st;
+  unsigned long long *len, off;
+  char pbuf[PATH_MAX], *path;
+  int js, jr, nout, ierr;
+
+  memset(&hd, 0, sizeof(hd));
+  memcpy(hd.magic, BITC_MAGIC, 8);
+  hd.version = BITC_VERSION;
+  hd.endian = 0x01020304;
+  if (HashFile(srcname, &hd.srchash) || stat(srcname, &st) != 0) {
+    if (mute < 2) fprintf (stderr, "E: cannot read rules file again\n");
+    return 1;
+  }
+  hd.srcsize = (long long) st.st_size;
+  hd.srctime = (long long) st.st_mtim.tv_sec;
+  hd.srcnsec = (long long) st.st_mtim.tv_nsec;
+  /* The rules file is found again by its full name */
+  path = realpath(srcname, pbuf);
+  if (path == NULL) path = srcname;
+
+  /* The rules are no longer in the order of their output tokens */
+  nout = 0;
+  for (jr=0; jr<ndef; jr++) {
+    if (istrhi[jr] >= nout) nout = istrhi[jr] + 1;
+  }
+  hd.bitdir = bitdir;
+  hd.poly = poly;
+  hd.ndef = ndef;
+  hd.nout = nout;
+  hd.ncom = ncom;
+  hd.nstate = nstate;
+  hd.nclass = nclass;
+  hd.lstr[0] = lstr[0];
+  hd.lstr[1] = lstr[1];
+  hd.csep = csep;
+  memcpy(hd.rucodi, rucodi, 4);
+  memcpy(hd.rucodo, rucodo, 4);
+
+  /* The lengths are 64-bit, so they cannot wrap. The whole file
+     must still fit into memory when LoadComp maps it */
+  len = hd.len;
+  CompLens(&hd, len);
+  len[BITC_SRC] = strlen(path) + 1;
+  off = (sizeof(hd) + 7) & ~7ULL;
+  for (js=0; js<BITC_NSEC; js++) {
+    hd.off[js] = off;
+    off += (len[js] + 7) & ~7ULL;
+  }
+  hd.size = off;
+  if ((unsigned long long) (size_t) off != off || (long long) (off_t) off != (long long) off) {
+    if (mute < 2) fprintf (stderr, "E: compiled rules too large for this machine\n");
+    return 1;
+  }
+
+  ierr = PutSect(&hd, sizeof(hd));
+  ierr |= PutSect(ip[0], len[BITC_IP0]) || PutSect(lip[0], len[BITC_LIP0]) ||
+          PutSect(ip[1], len[BITC_IP1]) || PutSect(lip[1], len[BITC_LIP1]) ||
+          PutSect(istrlo, len[BITC_LO]) || PutSect(istrhi, len[BITC_HI]) ||
+          PutSect(rulz[0], len[BITC_RUL0]) || PutSect(rulz[1], len[BITC_RUL1]) ||
+          PutSect(lcom, len[BITC_COM]) || PutSect(acbyte, len[BITC_BYTE]) ||
+          PutSect(ackid, len[BITC_KID]) || PutSect(accls, len[BITC_CLS]) ||
+          PutSect(acfail, len[BITC_FAIL]) || PutSect(acout, len[BITC_OUT]) ||
+          PutSect(aclink, len[BITC_LINK]) || PutSect(path, len[BITC_SRC]);
+  if (fclose(fout) != 0) ierr = 1;
+  if (ierr) {
+    if (mute < 2) fprintf (stderr, "E: cannot write compiled rules file\n");
+    return 1;
+  }
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int LoadComp( )
+
+/* Take the rules from the rules file if it is a compiled one, see
+   WriteComp. A file that starts with the magic but is cut short
+   is refused as truncated. The header is checked against the size
+   of the file (see CheckComp), and then the tables of the rules
+   and the automaton are used where the file is mapped */
+/* Return -1 if it is not compiled, 0 if all OK, 1 if error */
+
+{
+  struct bitc_head hd;
+  struct stat st;
+  unsigned long long hash;
+  char *map, *src;
+  size_t nread;
+  int jc, js, ierr;
+
+  /* It is compiled if it starts with the magic, or with part of
+   it when the file is that short, whatever follows */
+  nread = fread(&hd, 1, sizeof(hd), frul);
+  if (nread == 0 || memcmp(hd.magic, BITC_MAGIC,
+                           (nread < sizeof(hd.magic)) ? nread : sizeof(hd.magic)) != 0) {
+    rewind(frul);
+    return -1;
+  }
+
+  if (mute == 0) fprintf(stderr,"\n%s\n","Reading compiled rules file");
+  if (nread != sizeof(hd)) {
+    if (mute < 2) fprintf (stderr, "E: compiled rules file is truncated\n");
+    return 1;
+  }
+  if (hd.endian != 0x01020304 || hd.version != BITC_VERSION) {
+    if (mute < 2) {
+      fprintf (stderr, "E: compiled rules file of another version or machine\n");
+    }
+    return 1;
+  }
+  if (hd.bitdir != bitdir) {
+    if (mute < 2) {
+      fprintf (stderr, "E: rules were compiled for direction %d\n", hd.bitdir);
+    }
+    return 1;
+  }
+  if (fstat(fileno(frul), &st) != 0 || (unsigned long long) st.st_size < hd.size) {
+    if (mute < 2) fprintf (stderr, "E: compiled rules file is truncated\n");
+    return 1;
+  }
+  if (CheckComp(&hd) || (unsigned long long) (size_t) hd.size != hd.size) {
+    if (mute < 2) fprintf (stderr, "E: compiled rules file is damaged\n");
+    return 1;
+  }
+  map = (char *) mmap(NULL, (size_t) hd.size, PROT_READ, MAP_PRIVATE, fileno(frul), 0);
+  if (map == MAP_FAILED) {
+    if (mute < 2) fprintf (stderr, "E: cannot map compiled rules file\n");
+    return 1;
+  }
+  src = map + hd.off[BITC_SRC];
+  memcpy(acbyte, map + hd.off[BITC_BYTE], sizeof(acbyte));
+  for (jc=0; jc<256; jc++) {
+    if (acbyte[jc] < 0 || acbyte[jc] >= hd.nclass) break;
+  }
+  if (src[hd.len[BITC_SRC] - 1] != 0 || jc < 256) {
+    if (mute < 2) fprintf (stderr, "E: compiled rules file is damaged\n");
+    return 1;
+  }
+
+  /* The rules file must be the one that was compiled. It is only
+     hashed again if its size or time changed */
+  if (stat(src, &st) != 0) {
+    if (mute < 2) {
+      fprintf (stderr, "E: rules file %s not found\n", src);
+      fprintf (stderr, "   compile it again, or keep it with the compiled rules\n");
+    }
+    return 1;
+  }
+  if ((long long) st.st_size != hd.srcsize ||
+      (long long) st.st_mtim.tv_sec != hd.srctime ||
+      (long long) st.st_mtim.tv_nsec != hd.srcnsec) {
+    if (HashFile(src, &hash) || hash != hd.srchash) {
+      if (mute < 2) {
+        fprintf (stderr, "E: rules file %s changed since it was compiled\n", src);
+      }
+      return 1;
+    }
+  }
+
+  poly = hd.poly;
+  ndef = hd.ndef;
+  ncom = hd.ncom;
+  nstate = hd.nstate;
+  lstr[0] = hd.lstr[0];
+  lstr[1] = hd.lstr[1];
+  csep = hd.csep;
+  memcpy(rucodi, hd.rucodi, 4);
+  memcpy(rucodo, hd.rucodo, 4);
+
+  ip[0] = (int *) (map + hd.off[BITC_IP0]);
+  lip[0] = (int *) (map + hd.off[BITC_LIP0]);
+  ip[1] = (int *) (map + hd.off[BITC_IP1]);
+  lip[1] = (int *) (map + hd.off[BITC_LIP1]);
+  istrlo = (int *) (map + hd.off[BITC_LO]);
+  istrhi = (int *) (map + hd.off[BITC_HI]);
+  rulz[0] = map + hd.off[BITC_RUL0];
+  rulz[1] = map + hd.off[BITC_RUL1];
+  lcom = map + hd.off[BITC_COM];
+
+  nclass = hd.nclass;
+  ackid = (int *) (map + hd.off[BITC_KID]);
+  accls = (int *) (map + hd.off[BITC_CLS]);
+  acfail = (int *) (map + hd.off[BITC_FAIL]);
+  acout = (int *) (map + hd.off[BITC_OUT]);
+  aclink = (int *) (map + hd.off[BITC_LINK]);
+
+  /* The children of state 0, looked up directly by class */
+  memset(acroot, 0, sizeof(acroot));
+  ierr = (ackid[0] != 1 || ackid[1] < 1 || ackid[1] > nstate);
+  for (js=1; !ierr && js<ackid[1]; js++) {
+    jc = accls[js];
+    ierr = (jc < 1 || jc >= nclass);
+    if (!ierr) acroot[jc] = js;
+  }
+  if (ierr) {
+    if (mute < 2) fprintf (stderr, "E: compiled rules file is damaged\n");
+    return 1;
+  }
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
 int main(int argc,char *argv[])
 
 {
@@ -1444,7 +2366,7 @@ int main(int argc,char *argv[])
   int eodata;
   int erropt, jj;
   int icomp, iretc;
-  int lprint;
+  int lprint, comp;
   char ctest[ ] = "#=IVTFF ";
 
   /* For reference: */
@@ -1471,9 +2393,24 @@ int main(int argc,char *argv[])
     return 2;
   }  
 
-  /* Read and analyse/sort the Rules file */
+  /* Set up the line buffers */
+  if (GrowBuf(&crul, &widrul, WIDRUL) || GrowBuf(&orig, &widorig, WIDTXT) ||
+      TextRoom(WIDTXT)) {
+    return 2;
+  }
+
+  /* Read and analyse/sort the Rules file, unless it is compiled */
   hascr = 0;
-  if (ReadRules( )) {
+  comp = LoadComp( );
+  if (comp > 0) {
+    if (mute < 2) fprintf (stderr, "%s\n", "  error reading compiled rules file");
+    return 2;
+  }
+  if (comp == 0 && compile) {
+    if (mute < 2) fprintf (stderr, "%s\n", "E: rules file is already compiled");
+    return 2;
+  }
+  if (comp < 0 && ReadRules( )) {
     if (mute < 2) fprintf (stderr, "%s\n", "  error reading rules file");
     return 2;
   }  
@@ -1493,13 +2430,30 @@ int main(int argc,char *argv[])
     }
   }
 
-  /* Temporary test output */
-  if (debr) ShowRules( );
+  if (comp < 0) {
 
-  if (SortRules( )) {
-    if (mute < 2) fprintf (stderr, "%s\n", "  error found in rules file");
-    return 2;
-  }  
+    /* Temporary test output */
+    if (debr) ShowRules( );
+
+    if (SortRules( )) {
+      if (mute < 2) fprintf (stderr, "%s\n", "  error found in rules file");
+      return 2;
+    }  
+  }
+
+  SetClass( );
+  if (comp < 0 && BuildMatch( )) return 2;
+  if (ScanInit( )) return 2;
+
+  /* Only write the compiled rules file */
+  if (compile) {
+    if (WriteComp(argv[rufarg])) {
+      if (mute < 2) fprintf (stderr, "%s\n", "  error writing compiled rules file");
+      return 2;
+    }
+    if (mute == 0) fprintf (stderr, "\n%3d rules compiled\n", ndef);
+    return 0;
+  }
 
   if (mute == 0) fprintf (stderr, "\n%s\n", "Starting...");
 
@@ -1510,7 +2464,7 @@ int main(int argc,char *argv[])
 
     /* Read one line to buffer. */
 
-    igetl = GetLine(orig,fin,WIDTXT);
+    igetl = GetLine(&orig,&widorig,fin);
     if (igetl == -2) {
       if (mute < 2) fprintf (stderr, "E: incomplete record before EOF\n");
       return 2;
@@ -1532,8 +2486,10 @@ int main(int argc,char *argv[])
     }
 
     /* Here a new line was read successfully */
-    (void) strcpy(text,orig);
     lenorig = strlen(orig);
+    /* Room for the line with a space added on either side */
+    if (TextRoom(lenorig+3)) return 4;
+    (void) strcpy(text,orig);
     lentext = lenorig;
 
     /* Check for an IVTFF header */
@@ -1,8 +1,44 @@
 #include "stdio.h"
+#include "stdlib.h"
 #include "string.h"
 #include "ctype.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include "ivtt.h"
 #define MAXLEN 4096
-#define MAXPGH 128
+#define INBLK 65536
+#define OUTBLK 65536
+#define MAXVAR 64
+#define MAXARG 32
+#define CACHEAGE 16       /* Runs after which an unused cache entry is dropped */
+#define CACHEMAX (256L << 20) /* Size of the cache file above which older entries are dropped */
+
+/* Character class bits, see SetClass */
+#define CC_TRACK 1        /* Bracket or separator seen by Track */
+#define CC_DELIM 2        /* Word delimiter */
+#define CC_WHITE 4        /* White space removed by PrepLine */
+#define CC_DROP 8         /* Ligature bracket removed by PrepLine */
+#define CC_HIGH 16        /* Part of a high Ascii code */
+#define CC_SPACE 32       /* Dot or comma, see ProcSpaces */
+#define CC_END 64         /* The terminating null */
+/* Characters that need more than a copy in PrepLine */
+#define CC_PREP (CC_TRACK | CC_DELIM | CC_WHITE | CC_DROP | CC_HIGH)
+
+/* What PutLine does with a whole comment span (see SetAction).
+   Any other value is written in place of the closing > */
+#define SA_KEEP 0         /* Copy the span */
+#define SA_DROP 1         /* Drop the span */
+
+/* Locus selection rules (see SetSelect) */
+#define LR_IN 1           /* Include only one locus type */
+#define LR_EX 2           /* Exclude one locus type */
+#define LR_TWO 4          /* The locus type has two characters */
+#define LR_TOP 8          /* Drop P loci that do not start a paragraph */
+#define LR_NTOP 16        /* Drop P loci that start a paragraph */
 
 /*
    Intermediate Voynich Transliteration Tool.
@@ -10,136 +46,161 @@
    by R.Zandbergen. ver 1.1, 10 April 2020.
 */
 
-/* Global variables */
+/* All state of one ivtt run is kept in a context, so that several
+   streams can be processed in one process (see ivtt.h).
+   Initial values are set in ivtt_open. */
+
+struct ivtt_ctx {
+
 /* The following capture the information from the command line options. */
 /* The specified defaults all imply doing nothing */
 
-int a_high=0;    /* High Ascii left as is */
-int kcomh=0;     /* Keep hash comment lines */
-int kcomi=0;     /* Keep inline comments */
-int s_hard=0;    /* Do not touch dot spaces */
-int s_uncn=0;    /* Do not touch comma spaces */
-int unr=0;       /* Keep unreadable characters: ?  (prev: * ) */
-int brack=0;     /* Do not modify uncertain reading brackets */
-int kfoli=0;     /* Keep foliation info */
-int folign=0;    /* Do not ignore locus format (to support old files) */
-int gaps=0;      /* Leave <-> sign (previously: - ) */
-int para=0;      /* Leave <$> sign (previously: = ) and <%> sign */
-int toppar=0;    /* Keep all normal paragraph text lines (P locus) */
-int liga=0;      /* Keep ligature indication as is */
-int white=0;     /* Leave white space */
-int wrap=0;      /* Maintain line wrapping as it is in the file */
+int a_high;      /* High Ascii left as is */
+int kcomh;       /* Keep hash comment lines */
+int kcomi;       /* Keep inline comments */
+int s_hard;      /* Do not touch dot spaces */
+int s_uncn;      /* Do not touch comma spaces */
+int unr;         /* Keep unreadable characters: ?  (prev: * ) */
+int brack;       /* Do not modify uncertain reading brackets */
+int kfoli;       /* Keep foliation info */
+int folign;      /* Do not ignore locus format (to support old files) */
+int gaps;        /* Leave <-> sign (previously: - ) */
+int para;        /* Leave <$> sign (previously: = ) and <%> sign */
+int toppar;      /* Keep all normal paragraph text lines (P locus) */
+int liga;        /* Keep ligature indication as is */
+int white;       /* Leave white space */
+int wrap;        /* Maintain line wrapping as it is in the file */
 int wwidth;      /* New line wrapping limit */
-int mute=0;      /* Normal output to stderr */
-int infarg= -1;  /* Argument of input file name */
-int oufarg= -1;  /* Argument of output file name */
-char auth=' ';   /* Name of transliterator */
-char uloc2=' ';  /* Second char of selected locus, if appl. */
-int authrm = 0;  /* Do not remove the transliterator ID */
+int mute;        /* Normal output to stderr */
+int outbg;       /* Write output from a background thread */
+int njob;        /* Number of threads for page-parallel processing */
+int infarg;      /* Argument of input file name */
+int oufarg;      /* Argument of output file name */
+int lstarg;      /* Argument of variant list file name */
+int idxopt;      /* Only build the locus index of the input file */
+int nlook;       /* Number of pages or loci to look up */
+int lkarg[MAXARG]; /* Arguments of the look-ups (=name) */
+int cachearg;    /* Argument of the page cache file (--cache=) */
+int corparg;     /* Argument of the binary corpus file (--corpus=) */
+int uncarg;      /* Argument of the uncertainty records file (--uncert=) */
+char auth;       /* Name of transliterator */
+char uloc2;      /* Second char of selected locus, if appl. */
+int authrm;      /* Do not remove the transliterator ID */
 char invar[27];  /* List of 'include page' options */
 char exvar[27];  /* List of 'exclude page' options */ 
-int npgopt = 0;  /* Number of page include/exclude options (0 to 26) */
-int nlcopt = 0;  /* Number of locus include/exclude options (0 or 1)*/
+int npgopt;      /* Number of page include/exclude options (0 to 26) */
+int nlcopt;      /* Number of locus include/exclude options (0 or 1)*/
+
+/* The selection options above in compiled form, see SetSelect */
+int nslot;         /* Number of page variables with an option */
+char selslot[26];  /* Their indices, in increasing order */
+long inmask;       /* Bit i set if invar[i] is given */
+long exmask;       /* Bit i set if exvar[i] is given */
+int locrule;       /* Locus type and paragraph rules (LR_*) */
 FILE *fin, *fout; /* File handles */
+FILE *ferr;      /* Where messages go, normally stderr */
 
 /* Some file stats */
-int nlpart = 0   /* Number of (partial) lines read from stdin */;
-int nlread = 0   /* Number of lines from stdin after unwrapping */;
-int nldrop = 0   /* Number of lines dropped */;
-int nlhash = 0   /* Number of hash lines suppressed */;
-int nlempt = 0   /* Number of empty lines suppressed */;
-int nlwrit = 0   /* Number of lines for output */;
-int nlwrap = 0   /* Number of wrapped lines written to output*/;
+int nlpart;      /* Number of (partial) lines read from stdin */
+int nlread;      /* Number of lines from stdin after unwrapping */
+int nldrop;      /* Number of lines dropped */
+int nlhash;      /* Number of hash lines suppressed */
+int nlempt;      /* Number of empty lines suppressed */
+int nlwrit;      /* Number of lines for output */
+int nlwrap;      /* Number of wrapped lines written to output*/
 
 /* These give info about a complete line, set in GetLine and/or PrepLine */
-int comlin=0        /* 1 if line starts with # - set in GetLine */;
-int filehead=0      /* ==2 if line 1 and a valid header - set in GetLine*/;
-int hastrtxt=0      /* 1 if there is transliterated text - set in GetLine */;
-int hasfoli=0       /* 1 if there are < > starting in the first position */;
-int newpage=0       /* 1 if there are < > without a period (i.e. a new page) */;
-int nwpar=0         /* 1 if the line includes a <%> code */;
-char cwarn=' '      /* Character  for which a warning is issued */;
-char folname[] = "      " ;  /* *folname= "      "   Folio name, e.g. f85r3 */
-int num = 0;        /* The locus number */
-char lineauth= ' ';          /* Name of transliterator or blank */
-char cator = ' ';            /* the locator character */
-char loc2[] = "   ";         /* the 2-character locus type */
-char pgvar[27]               /* List of page variable settings */;
-char txtag[27]               /* List of text tag settings */;
-int hastag          /* 1 if a page header indicates the use of text tags */;
+int comlin;         /* 1 if line starts with # - set in GetLine */
+int filehead;       /* ==2 if line 1 and a valid header - set in GetLine*/
+int hastrtxt;       /* 1 if there is transliterated text - set in GetLine */
+int hasfoli;        /* 1 if there are < > starting in the first position */
+int newpage;        /* 1 if there are < > without a period (i.e. a new page) */
+int nwpar;          /* 1 if the line includes a <%> code */
+int endpar;         /* 1 if the line includes a <$> code */
+char cwarn;         /* Character  for which a warning is issued */
+char folname[8];    /* Folio name, e.g. f85r3 */
+int num;            /* The locus number */
+char lineauth;      /* Name of transliterator or blank */
+char cator;         /* the locator character */
+char loc2[4];       /* the 2-character locus type */
+char pgvar[27];     /* List of page variable settings */
+char txtag[27];     /* List of text tag settings */
+int hastag;         /* 1 if a page header indicates the use of text tags */
 
 /* These track the text */
-int in_comm=0;    /* not 0 if inside < > comment */
-int in_foli=0;    /* not 0 if inside locus < > */
-int ind_ligo= -1; /* Position of ligatures { char */
-int ind_ligc= -1; /* Position of ligatures } char */
-int ind_alto= -1; /* Position of alt. readings [ char */
-int ind_altb= 0;  /* Position of first alt. readings : char */
-int ind_altc= -1; /* Position of alt. readings ] char */
-int word0 = -1;   /* Position of first char of a word */
-int word1 = -1;   /* Position of last char of a word */
-int weir0 = -1;   /* Position of 'weirdo' dollar (obsolescent) */
-int hasc0 = -1;   /* Position of high ascii starter (@) */
-int hasc1 = -1;   /* Position of high ascii  semicolon */
-int dedcom = 0;   /* Not 0 if this is a 3-char dedicated comment */
-int tagcom = 0;   /* Not 0 if this is a 6-char text tag comment */
-char comchr = ' '; /* The character defining the type of inl.comment */
-int indtag = 0;   /* Text tag index */
-
-/* Further global variables for certain options */
-int concat = 0;   /* In GetLine: used for judging CR and spaces */
-int highasc = 0;  /* In PrepLine: Ascii code of @...;  */
-int pend_hd = 0;  /* Set to 1 if a page header is waiting to be output */
-char cue = '.';   /* The 'space' after which wrapping is allowed */
-char pgh[MAXPGH];
-
-/*-----------------------------------------------------------*/
-
-void shiftl(char *b,int index,int nrlost)
-
-/* Shift left by (nrlost) bytes the part of string (b)
-   after (index) */
-
-/*char *b; 
-  int index, nrlost;*/
-
-{
-  int ii;
-  for (ii = index+1; ii<MAXLEN-nrlost; ii++) {
-    b[ii] = b[ii+nrlost];
-  }
-  return;
-}
-
-/*-----------------------------------------------------------*/
-
-int FindSpace(char *buf,int width)
-/* Locate rightmost hard space character in buf[0 .. width-1].
-   Return index, or zero if buf is shorter, or <0 if none
-   found */
-
-/*char *buf; 
-  int width;*/
-
-{
-  int result = -1, ii = 0, voycode = 1;
-  char cb;
-
-  while ((cb = buf[ii]) && ii < width) {
-    /* Dedicated check for comments.
-       Sets voycode if outside comments */
-    if (cb == '<') voycode = 0;
-    else if (cb == '>') voycode = 1;
-    else { 
-      if (cb == cue || cue == (char) 0) {
-        if (voycode) result = ii;
-      }  
-    }
-    ii += 1;
-  }
-  if (cb == 0) result = 0;
-  return result;
-}
+int in_comm;      /* not 0 if inside < > comment */
+int in_foli;      /* not 0 if inside locus < > */
+int ind_ligo;     /* Position of ligatures { char */
+int ind_ligc;     /* Position of ligatures } char */
+int ind_alto;     /* Position of alt. readings [ char */
+int ind_altb;     /* Position of first alt. readings : char */
+int ind_altc;     /* Position of alt. readings ] char */
+int word0;        /* Position of first char of a word */
+int word1;        /* Position of last char of a word */
+int weir0;        /* Position of 'weirdo' dollar (obsolescent) */
+int hasc0;        /* Position of high ascii starter (@) */
+int hasc1;        /* Position of high ascii  semicolon */
+int dedcom;       /* Not 0 if this is a 3-char dedicated comment */
+int tagcom;       /* Not 0 if this is a 6-char text tag comment */
+char comchr;      /* The character defining the type of inl.comment */
+int indtag;       /* Text tag index */
+
+/* Locus and comment spans of the line being processed (see Tokenize) */
+int spok;         /* 1 if the spans below are valid for the line */
+int nspan;        /* Number of spans */
+int *spbeg;       /* Position of the < */
+int *spend;       /* Position of the > */
+char *sptyp;      /* < for the locus, else the comment type */
+
+/* Further variables for certain options */
+int concat;       /* In GetLine: used for judging CR and spaces */
+int highasc;      /* In PrepLine: Ascii code of @...;  */
+int pend_hd;      /* Set to 1 if a page header is waiting to be output */
+char cue;         /* The 'space' after which wrapping is allowed */
+unsigned char ccls[256]; /* Class bits (CC_..) of each character */
+char spact[2][256]; /* Action (SA_..) for comments by type, [1] on page headers */
+char spout[2];    /* Dot and comma as ProcSpaces writes them, 0 if dropped */
+char *pgh;        /* Pending page header */
+struct ivtt_corpus *corp; /* Binary corpus being collected, or NULL */
+
+/* Page and locus selection, carried from line to line */
+int selpage, selloc;
+int midfile;      /* 1 if the input starts at a page inside the file */
+int status;       /* 0 while running, else the exit code of ivtt */
+
+/* Line buffers. They start at MAXLEN bytes and grow when a
+   longer line arrives (see LineRoom), so that normal lines never
+   cause any allocation. The span lists above grow with them */
+int lcap;         /* Size of each line buffer */
+char *obuf, *buf1, *buf2;
+char *work;       /* Work area of ProcRead */
+char *wrapbuf;    /* Output line of PutLine */
+
+/* Input window. This is the block passed to ivtt_feed, or the
+   own buffer when a partial record had to be kept (see KeepIn) */
+char *inbuf;      /* Start of the input window */
+long inlen;       /* Number of valid bytes in the window */
+long inpos;       /* Position of the next unread byte */
+char *inown;      /* Own buffer for partial records */
+long insize;      /* Allocated size of inown */
+int ineof;        /* Set to 1 when no more data will be fed */
+
+/* Output buffers. One is filled while the other may be written out
+   by the background thread (see OutSpan, OutFlush) */
+int (*outfn)(void *, char *, int); /* Output sink, or NULL for fout */
+void *outarg;     /* Argument passed to the output sink */
+char outbuf[2][OUTBLK];
+int outcur;       /* Buffer being filled */
+int outlen;       /* Number of bytes in it */
+int outpend;      /* Buffer handed to the writer thread, or -1 */
+int outplen;      /* Number of bytes in that buffer */
+int outstop;      /* Set to 1 to terminate the writer thread */
+int outerr;       /* Set to 1 when output could not be written */
+pthread_t outthr;
+pthread_mutex_t outmtx;
+pthread_cond_t outcnd;
+
+};
 
 /*-----------------------------------------------------------*/
         
@@ -163,17 +224,17 @@ int head;*/
 
 /*-----------------------------------------------------------*/
 
-void clearvar()
+void clearvar(IVTT *c)
 
 /* Reset all page variables and text tags */
 
 {
   int i;
   for (i=0; i<=26; i++) {
-     pgvar[i]=' ';
-     txtag[i]='@';
+     c->pgvar[i]=' ';
+     c->txtag[i]='@';
   }
-  hastag = 0;
+  c->hastag = 0;
   /*
     fprintf(stderr,"clearing variables...\n");
     showvar('P',pgvar,1);
@@ -182,7 +243,7 @@ void clearvar()
 
 /*-----------------------------------------------------------*/
 
-int usepgloc(int iopt)
+int usepgloc(IVTT *c,int iopt)
 
 /* This used to be called 'usepage'
    If called with iopt == 1 (once per page)
@@ -202,7 +263,8 @@ int usepgloc(int iopt)
 */
 
 {
-  int i, select, mat;
+  int i, k, select, mat;
+  long bit;
   char usevar;
   
   select = 1;
@@ -212,22 +274,15 @@ int usepgloc(int iopt)
   
     /* Here it is called for the whole page. Only look at the page
        variables. If a variable is set to @, ignore it  */
-    hastag = 0;
-    for (i=1; i<=26; i++) {
-      usevar = pgvar[i];
-      if (invar[i] != ' ') {
-        if (usevar == '@') {
-          hastag = 1;
-        } else {
-          if (invar[i] != usevar) select=0;
-        }
-      }
-      if (exvar[i] != ' ') {
-        if (usevar == '@') {
-          hastag = 1;
-        } else {
-          if (exvar[i] == usevar) select=0;
-        }
+    c->hastag = 0;
+    for (k=0; k<c->nslot; k++) {
+      i = c->selslot[k]; bit = 1L << i;
+      usevar = c->pgvar[i];
+      if (usevar == '@') {
+        c->hastag = 1;
+      } else {
+        if ((c->inmask & bit) && c->invar[i] != usevar) select=0;
+        if ((c->exmask & bit) && c->exvar[i] == usevar) select=0;
       }
     }
     /*  showvar('P',pgvar,1); 
@@ -237,55 +292,61 @@ int usepgloc(int iopt)
   } else {
 
     /* Here it is called for a locus (or the file header) */
-    if (filehead) return 1;
+    if (c->filehead) return 1;
 
-    /* First check the combination of page variables and text tags. */
-    for (i=1; i<=26; i++) {
+    /* First check the combination of page variables and text tags,
+       stopping at the first one that rejects the locus */
+    for (k=0; k<c->nslot && select; k++) {
       /* decide whether to go by page var. or by text tag */
-      usevar = pgvar[i];
-      if (usevar == '@') {
-        usevar = txtag[i];
-        /* fprintf(stderr,"Checking text tag %d : %c\n",i,usevar); */
-      } else {
-        if (usevar != ' ') {
-          /* fprintf(stderr,"Checking page var %d : %c\n",i,usevar); */
-        }
-      }
+      i = c->selslot[k]; bit = 1L << i;
+      usevar = c->pgvar[i];
+      if (usevar == '@') usevar = c->txtag[i];
       if (usevar == '@') usevar = ' ';
 
-      if (invar[i] != ' ') {
-        if (invar[i] != usevar) select=0;
-        /* fprintf(stderr,"Incl.ind: %d , val: %c , result: %d\n",i,invar[i],select); */
-      }
-      if (exvar[i] != ' ') {
-        if (exvar[i] == usevar) select=0;
-      }
+      if ((c->inmask & bit) && c->invar[i] != usevar) select=0;
+      if ((c->exmask & bit) && c->exvar[i] == usevar) select=0;
     }
 
     /* Only if it is selected, then also check the 
        locus type, 1 or 2 char */
-    if (select) {
-      if (invar[0] != ' ') {
-        mat = (invar[0] != loc2[0]);
-        if (uloc2) {
-          mat = (mat || (uloc2 != loc2[1]));
-        }
-        if (mat) select=0;
-      }
-      if (exvar[0] != ' ') {
-        mat = (exvar[0] == loc2[0]);
-        if (uloc2) {
-          mat = (mat && (uloc2 == loc2[1]));
-        }
-        if (mat) select=0;
+    if (select && c->locrule) {
+      switch (c->locrule & (LR_IN | LR_EX | LR_TWO)) {
+        case 0:
+        case LR_TWO:
+          break;
+        case LR_IN:
+          if (c->invar[0] != c->loc2[0]) select=0;
+          break;
+        case LR_IN | LR_TWO:
+          if (c->invar[0] != c->loc2[0] ||
+              c->uloc2 != c->loc2[1]) select=0;
+          break;
+        case LR_EX:
+          if (c->exvar[0] == c->loc2[0]) select=0;
+          break;
+        case LR_EX | LR_TWO:
+          if (c->exvar[0] == c->loc2[0] &&
+              c->uloc2 == c->loc2[1]) select=0;
+          break;
+        default:
+          /* Both given */
+          mat = (c->invar[0] != c->loc2[0]);
+          if (c->locrule & LR_TWO) {
+            mat = (mat || (c->uloc2 != c->loc2[1]));
+          }
+          if (mat) select=0;
+          mat = (c->exvar[0] == c->loc2[0]);
+          if (c->locrule & LR_TWO) {
+            mat = (mat && (c->uloc2 == c->loc2[1]));
+          }
+          if (mat) select=0;
+          break;
       }
-    }
 
-    /* Now handle processing related to -q option */
-    if (select && toppar) {
-      if (loc2[0] == 'P') {
-        if (toppar == 1 && nwpar == 0) select = 0;
-        if (toppar == 2 && nwpar) select = 0;
+      /* Now handle processing related to -q option */
+      if (select && c->loc2[0] == 'P') {
+        if ((c->locrule & LR_TOP) && c->nwpar == 0) select = 0;
+        if ((c->locrule & LR_NTOP) && c->nwpar) select = 0;
       }
     }
   
@@ -298,43 +359,124 @@ int usepgloc(int iopt)
 
 /*-----------------------------------------------------------*/
 
-void trackinit()
+void trackinit(IVTT *c)
 
 /* Initialise tracker */
 
 {
-    in_comm = 0;   /* >0 if inside < > comment */
-    dedcom = 0;    /* >0 if a dedicated comment */
-    tagcom = 0;    /* >0 if a text tag comment */
-    in_foli = 0;   /* >0 if inside locus < > */
-    ind_ligo = -1; /* Position of ligatures { char */
-    ind_ligc = -1; /* Position of ligatures } char */
-    ind_alto = -1; /* Position of alt. readings [ char */
-    ind_altb = 0;  /* Position of alt. readings : char */
-    ind_altc = -1; /* Position of alt. readings ] char */
-    word0 = - 1;   /* Position of first char of a word */
-    word1 = - 1;   /* Position of last char of a word */
-    comchr = ' ';  /* First character of a comment */
+    c->in_comm = 0;   /* >0 if inside < > comment */
+    c->dedcom = 0;    /* >0 if a dedicated comment */
+    c->tagcom = 0;    /* >0 if a text tag comment */
+    c->in_foli = 0;   /* >0 if inside locus < > */
+    c->ind_ligo = -1; /* Position of ligatures { char */
+    c->ind_ligc = -1; /* Position of ligatures } char */
+    c->ind_alto = -1; /* Position of alt. readings [ char */
+    c->ind_altb = 0;  /* Position of alt. readings : char */
+    c->ind_altc = -1; /* Position of alt. readings ] char */
+    c->word0 = - 1;   /* Position of first char of a word */
+    c->word1 = - 1;   /* Position of last char of a word */
+    c->comchr = ' ';  /* First character of a comment */
 }
 
 /*-----------------------------------------------------------*/
 
-int trackerr(char *buf,char cget)
+int trackerr(IVTT *c,char *buf,char cget)
 
 /* Print track error */
 
 /*char *buf, cget;*/
 {
-  if (mute < 2) {
-    fprintf(stderr, "Offending character: %c\n", cget);
-    fprintf(stderr, "Line parsed so far: %s\n", buf);
+  if (c->mute < 2) {
+    fprintf(c->ferr, "Offending character: %c\n", cget);
+    fprintf(c->ferr, "Line parsed so far: %s\n", buf);
     return 1;
   }
 }
 
 /*-----------------------------------------------------------*/
 
-int Track(char cb,int index)
+void SetClass(IVTT *c)
+/* Set up the class bits of all characters. Some depend on the
+   options, so this is done once they are known */
+{
+  int i;
+  unsigned char *cc = c->ccls;
+
+  memset(cc, 0, 256);
+  cc['<'] = cc['>'] = CC_TRACK;
+  cc['['] = cc[']'] = cc[':'] = cc['|'] = CC_TRACK;
+  cc['{'] = cc['}'] = CC_TRACK;
+  cc[','] = cc['.'] = CC_DELIM | CC_SPACE;
+  cc[' '] = cc['\n'] = cc['-'] = CC_DELIM;
+  cc[0] = CC_END;
+
+  if (c->white == 1) {
+    cc[' '] |= CC_WHITE; cc['\t'] |= CC_WHITE;
+  }
+  if (c->liga == 1) {
+    cc['{'] |= CC_DROP; cc['}'] |= CC_DROP;
+  }
+  if (c->a_high == 1) {
+    for (i=128; i<256; i++) cc[i] |= CC_HIGH;
+  } else if (c->a_high == 2) {
+    for (i='0'; i<='9'; i++) cc[i] |= CC_HIGH;
+    cc['@'] |= CC_HIGH; cc[';'] |= CC_HIGH;
+  }
+}
+
+/*-----------------------------------------------------------*/
+
+int PlainRun(IVTT *c,char *buf,int len,int mask)
+/* Return the number of characters at the start of buf[0 .. len-1]
+   that have none of the class bits in mask. A null always ends
+   the run. Most of a line is plain text, so this is where the
+   line steps skip ahead to the next character of interest */
+{
+  unsigned char *p = (unsigned char *) buf, *cc = c->ccls;
+  char *pnul;
+  int n = 0;
+
+  if (mask == 0) {
+    pnul = (char *) memchr(buf, 0, len);
+    return (pnul == NULL) ? len : pnul - buf;
+  }
+  mask |= CC_END;
+  while (n + 4 <= len) {
+    if (cc[p[n]] & mask) return n;
+    if (cc[p[n+1]] & mask) return n+1;
+    if (cc[p[n+2]] & mask) return n+2;
+    if (cc[p[n+3]] & mask) return n+3;
+    n += 4;
+  }
+  while (n < len && (cc[p[n]] & mask) == 0) n += 1;
+  return n;
+}
+
+/*-----------------------------------------------------------*/
+
+void TrackWord(IVTT *c,char cb,int index)
+/* Last part of Track and TrackLight: the locus length and
+   the word boundaries */
+{
+  /* Inside foliation keep track of index */
+  if (c->in_foli > 0) {
+    c->in_foli += 1;
+    return;
+  }
+  
+  /* Further checks of word boundaries, not in foliation */
+  if (c->in_foli == 0) {
+    if (c->ccls[(unsigned char) cb] & CC_DELIM) { /* Word delimiter */
+      if (c->word0 >= 0) c->word1 = index - 1;
+    } else { /* non-space char */
+      if (c->word0 < 0) c->word0 = index;
+    }
+  }
+}
+
+/*-----------------------------------------------------------*/
+
+int Track(IVTT *c,char cb,int index)
 /* Keep track of comments, foliation, ligatures, etc */
 /* Return 0 if OK, 1 if error */
 /* Will only be called for line without # comment */
@@ -344,14 +486,20 @@ int Track(char cb,int index)
 {
 
   /* Evolve previous reading of bracket */
-  if (in_comm == -1) in_comm = 1;
-  if (in_comm == -2) in_comm = 0;
-  if (in_foli == -1) in_foli = 1;
-  if (in_foli == -2) in_foli = 0;
+  if (c->in_comm == -1) c->in_comm = 1;
+  if (c->in_comm == -2) c->in_comm = 0;
+  if (c->in_foli == -1) c->in_foli = 1;
+  if (c->in_foli == -2) c->in_foli = 0;
   
   /* If a word was just finished, start a new one */
-  if (word1 >= 0) {
-    word0 = -1; word1 = -1;
+  if (c->word1 >= 0) {
+    c->word0 = -1; c->word1 = -1;
+  }
+
+  /* Outside comments, most characters only extend a word */
+  if (c->in_comm == 0 && (c->ccls[(unsigned char) cb] & CC_TRACK) == 0) {
+    TrackWord(c, cb, index);
+    return 0;
   }
   
   /* Check for in-line comments.
@@ -359,181 +507,169 @@ int Track(char cb,int index)
      warning if inside [ ] or { } */
 
   if (cb == '<' && index > 0) {
-    if (in_foli != 0 ) {
-      if (mute < 2) fprintf(stderr,"%s\n","Illegal bracket inside locus");
+    if (c->in_foli != 0 ) {
+      if (c->mute < 2) fprintf(c->ferr,"%s\n","Illegal bracket inside locus");
       return 1;
     }
-    if (ind_ligo > ind_ligc || ind_alto > ind_altc) cwarn='<';
-    if (in_comm != 0) { /* Already open */
-      if (mute < 2) fprintf(stderr,"%s\n","Illegal second open bracket");      
+    if (c->ind_ligo > c->ind_ligc || c->ind_alto > c->ind_altc) c->cwarn='<';
+    if (c->in_comm != 0) { /* Already open */
+      if (c->mute < 2) fprintf(c->ferr,"%s\n","Illegal second open bracket");      
       return 1;
     }
-    if (word0 >= 0 && word1 <0) word1 = index-1; /* End word here */ 
-    in_comm = -1; comchr = ' ';
+    if (c->word0 >= 0 && c->word1 <0) c->word1 = index-1; /* End word here */ 
+    c->in_comm = -1; c->comchr = ' ';
     return 0;
   }
 
   /* Check end of an in-line or dedicated comment */
   if (cb == '>') {
-    if (in_comm > 0) {
-      if (dedcom) {
-        if (in_comm > 2) {
-          if (mute < 2) fprintf(stderr,"%s\n","Dedicated comment >1 character");      
+    if (c->in_comm > 0) {
+      if (c->dedcom) {
+        if (c->in_comm > 2) {
+          if (c->mute < 2) fprintf(c->ferr,"%s\n","Dedicated comment >1 character");      
           return 1;
         }
-        dedcom = 0;
+        c->dedcom = 0;
         /* Check for first line of paragraph */
-        if (comchr == '%') {
-          nwpar = 1;
+        if (c->comchr == '%') {
+          c->nwpar = 1;
+        } else if (c->comchr == '$') {
+          c->endpar = 1;
         }
       }
-      if (tagcom) {
-        if (in_comm > 5) {
-          if (mute < 2) fprintf(stderr,"%s\n","Text tag >4 characters");      
+      if (c->tagcom) {
+        if (c->in_comm > 5) {
+          if (c->mute < 2) fprintf(c->ferr,"%s\n","Text tag >4 characters");      
           return 1;
         }
-        tagcom = 0; indtag = 0;
+        c->tagcom = 0; c->indtag = 0;
       }
-      word0 = -1; word1 = -1; /* Prepare for new word */
-      in_comm = -2; return 0;
+      c->word0 = -1; c->word1 = -1; /* Prepare for new word */
+      c->in_comm = -2; return 0;
     }
   }
 
   /* New < > comment, decode its type */
-  if (in_comm == 1) {
-    comchr = cb;
-    tagcom = (comchr == '@');
-    if (tagcom == 0) dedcom = (comchr != '!');
+  if (c->in_comm == 1) {
+    c->comchr = cb;
+    c->tagcom = (c->comchr == '@');
+    if (c->tagcom == 0) c->dedcom = (c->comchr != '!');
 
     /* if (dedcom) fprintf(stderr,"%s\n","Dedicated commment found");
        if (tagcom) fprintf(stderr,"%s\n","Text tag found"); */
   }
 
   /* Process text tag */
-  if (tagcom) {
-    if (in_comm == 2) {
+  if (c->tagcom) {
+    if (c->in_comm == 2) {
       if (cb < 'A' || cb > 'Z') {
-        cwarn = '@';
-        if (mute < 2) fprintf(stderr,"%s\n","Illegal text tag");    
+        c->cwarn = '@';
+        if (c->mute < 2) fprintf(c->ferr,"%s\n","Illegal text tag");    
         return 1;
       } else {
-        indtag = cb - 64;
+        c->indtag = cb - 64;
       }
       /* fprintf(stderr,"Found text tag index %d\n",indtag); */
     }
-    if (in_comm == 4) {
-      if (indtag) txtag[indtag] = cb;
+    if (c->in_comm == 4) {
+      if (c->indtag) c->txtag[c->indtag] = cb;
       /* fprintf(stderr,"Found text tag value %c\n",cb); */
     }
   }
 
   /* Continue checks only outside < > comments */
-  if (in_comm != 0) {
-    if (in_comm > 0) in_comm += 1;
+  if (c->in_comm != 0) {
+    if (c->in_comm > 0) c->in_comm += 1;
     return 0;
   }
 
   /* Check for foliation. It is already guaranteed that nothing
      else is open */
   if (cb == '<' && index == 0) {
-    in_foli = -1; return 0;
+    c->in_foli = -1; return 0;
   }
 
   /* A > now has to be the end of foliation */
   if (cb == '>') {
-    if (in_foli == 0) {
+    if (c->in_foli == 0) {
       /* It was not */
-      cwarn = '>';
-      if (mute < 2) fprintf(stderr,"%s\n","Illegal close bracket:");    
+      c->cwarn = '>';
+      if (c->mute < 2) fprintf(c->ferr,"%s\n","Illegal close bracket:");    
       return 1;
     }
-    if (in_foli < 3) { /* Should really be longer */
-      if (mute < 2) fprintf(stderr, "%s\n", "Foliation field too short");
+    if (c->in_foli < 3) { /* Should really be longer */
+      if (c->mute < 2) fprintf(c->ferr, "%s\n", "Foliation field too short");
       return 1;
     }
-    in_foli = -2; return 0;
+    c->in_foli = -2; return 0;
   }
 
   /* Check for alternate reading brackets */
   if (cb == '[') {
-    if (in_foli != 0) { /* Not allowed inside < > */
-      cwarn = '[';
-      if (mute < 2) fprintf(stderr, "%s\n", "Illegal bracket inside foliation ");
+    if (c->in_foli != 0) { /* Not allowed inside < > */
+      c->cwarn = '[';
+      if (c->mute < 2) fprintf(c->ferr, "%s\n", "Illegal bracket inside foliation ");
       return 1;
     }
-    if (ind_alto > ind_altc) { /* Unclosed bracket already open */
-      cwarn = '[';
-      if (mute < 2) fprintf(stderr, "%s\n", "Illegal second open bracket: [");
+    if (c->ind_alto > c->ind_altc) { /* Unclosed bracket already open */
+      c->cwarn = '[';
+      if (c->mute < 2) fprintf(c->ferr, "%s\n", "Illegal second open bracket: [");
       return 1;
     }
-    ind_alto = index; ind_altb = -1; ind_altc = -1;
+    c->ind_alto = index; c->ind_altb = -1; c->ind_altc = -1;
   } else if ((cb == '|') || (cb == ':')) {
     /* Support old files where this is a separator. However, outside [ ]
        it is always a legal character */
-    if (ind_alto > 0) {
+    if (c->ind_alto > 0) {
       /* Here a [ bracket was already open */
-      if (ind_altb < 0) ind_altb = index;   /* Keep only left-most */
+      if (c->ind_altb < 0) c->ind_altb = index;   /* Keep only left-most */
     }
   } else if (cb == ']') {
-    if (ind_alto <= 0) { /* No bracket open */
-      cwarn = ']';       
-      if (mute < 2) fprintf(stderr, "%s\n", "Illegal close bracket");
+    if (c->ind_alto <= 0) { /* No bracket open */
+      c->cwarn = ']';       
+      if (c->mute < 2) fprintf(c->ferr, "%s\n", "Illegal close bracket");
       return 1;
     }
-    if (ind_altb < 0) { /* Separator : sign missing, issue warning */ 
-      cwarn = ':';       
-      ind_altb = ind_alto + 2; /* To continue reasonably */
+    if (c->ind_altb < 0) { /* Separator : sign missing, issue warning */ 
+      c->cwarn = ':';       
+      c->ind_altb = c->ind_alto + 2; /* To continue reasonably */
     }
-    ind_altc = index;
+    c->ind_altc = index;
   }
 
   /* Check for ligature brackets, not allowed inside < > */
 
   if (cb == '{') {
-    if (in_foli != 0) { /* not allowed inside < > */
-      cwarn = '{';
-      if (mute < 2) fprintf(stderr, "%s\n", "Illegal bracket inside locus < >");
+    if (c->in_foli != 0) { /* not allowed inside < > */
+      c->cwarn = '{';
+      if (c->mute < 2) fprintf(c->ferr, "%s\n", "Illegal bracket inside locus < >");
       return 1;
     }
-    if (ind_ligo > ind_ligc) { /* Unclosed paren already open */
-      cwarn = '{';
-      if (mute < 2) fprintf(stderr, "%s\n", "Illegal second open bracket");
+    if (c->ind_ligo > c->ind_ligc) { /* Unclosed paren already open */
+      c->cwarn = '{';
+      if (c->mute < 2) fprintf(c->ferr, "%s\n", "Illegal second open bracket");
       return 1;
     }
-    ind_ligo = index; ind_ligc = -1;
+    c->ind_ligo = index; c->ind_ligc = -1;
     return 0;
   }
   if (cb == '}') {
-    if (ind_ligo < 0) {
-      cwarn = '}';
-      if (mute < 2) fprintf(stderr,"%s\n","Illegal close bracket");
+    if (c->ind_ligo < 0) {
+      c->cwarn = '}';
+      if (c->mute < 2) fprintf(c->ferr,"%s\n","Illegal close bracket");
       return 1; /* No bracket open */
     }
-    ind_ligc = index;
+    c->ind_ligc = index;
     return 0;
   }
 
-  /* Inside foliation keep track of index */
-  if (in_foli > 0) in_foli += 1;
-  
-  /* Further checks of word boundaries, not in foliation */
-  if (in_foli == 0) {
-  
-    if (cb == ',' || cb == '.' || cb == ' ' ||
-        cb == '\n' || cb == '-') { /* Word delimiter */
-      if (word0 >= 0) word1 = index - 1;
-    } else { /* non-space char */
-      if (word0 < 0) word0 = index;
-    }
-
-  }
-  
+  TrackWord(c, cb, index);
   return 0;
 }
 
 /*-----------------------------------------------------------*/
 
-void TrackLight(char cb,int index)
+void TrackLight(IVTT *c,char cb,int index)
 /* Same as track, but do not do error checking */
 /* Will only be called for line without # comment */
 
@@ -542,111 +678,306 @@ int index;*/
 {
 
   /* Evolve previous reading of bracket */
-  if (in_comm == -1) in_comm = 1;
-  if (in_comm == -2) in_comm = 0;
-  if (in_foli == -1) in_foli = 1;
-  if (in_foli == -2) in_foli = 0;
+  if (c->in_comm == -1) c->in_comm = 1;
+  if (c->in_comm == -2) c->in_comm = 0;
+  if (c->in_foli == -1) c->in_foli = 1;
+  if (c->in_foli == -2) c->in_foli = 0;
   
   /* If a word was just finished, start a new one */
-  if (word1 >= 0) {
-    word0 = -1; word1 = -1;
+  if (c->word1 >= 0) {
+    c->word0 = -1; c->word1 = -1;
+  }
+
+  /* Outside comments, most characters only extend a word */
+  if (c->in_comm == 0 && (c->ccls[(unsigned char) cb] & CC_TRACK) == 0) {
+    TrackWord(c, cb, index);
+    return;
   }
   
   /* Check for in-line comments. */
   if (cb == '<' && index > 0) {
-   if (word0 >= 0 && word1 < 0) word1 = index - 1; /* End word here */ 
-    in_comm = -1; return;
+   if (c->word0 >= 0 && c->word1 < 0) c->word1 = index - 1; /* End word here */ 
+    c->in_comm = -1; return;
   }
-  if (cb == '>' && in_foli == 0) {
-    word0 = -1; word1 = -1; /* Prepare for new word */
-    in_comm = -2; return;
+  if (cb == '>' && c->in_foli == 0) {
+    c->word0 = -1; c->word1 = -1; /* Prepare for new word */
+    c->in_comm = -2; return;
   }
 
   /* Check end of an in-line comment */
   if (cb == '>') {
-    if (in_comm > 0) {
-      word0 = -1; word1 = -1; /* Prepare for new word */
-      in_comm = -2; return;
+    if (c->in_comm > 0) {
+      c->word0 = -1; c->word1 = -1; /* Prepare for new word */
+      c->in_comm = -2; return;
     }
   }
 
   /* Decode type of < > comment */
-  if (in_comm == 1) {
-    comchr = cb;
-    tagcom = (comchr == '@');
-    if (tagcom == 0) dedcom = (comchr != '!');
+  if (c->in_comm == 1) {
+    c->comchr = cb;
+    c->tagcom = (c->comchr == '@');
+    if (c->tagcom == 0) c->dedcom = (c->comchr != '!');
   }
 
   /* Continue only outside < > comments */
-  if (in_comm != 0) {
-    if (in_comm > 0) in_comm += 1;
+  if (c->in_comm != 0) {
+    if (c->in_comm > 0) c->in_comm += 1;
     return;
   }
 
   /* Check for foliation */
   if (cb == '<' && index == 0) {
-    in_foli = -1; return;
+    c->in_foli = -1; return;
   }
-  if (cb == '>' && in_foli > 0) {
-    in_foli = -2; return;
+  if (cb == '>' && c->in_foli > 0) {
+    c->in_foli = -2; return;
   }
 
   /* Check for alternate reading brackets */
   if (cb == '[') {
-    ind_alto = index; ind_altb = -1; ind_altc = -1;
+    c->ind_alto = index; c->ind_altb = -1; c->ind_altc = -1;
   } else if (cb == ':') {
-    if (ind_altb < 0) ind_altb = index; /* Keep only left-most */
+    if (c->ind_altb < 0) c->ind_altb = index; /* Keep only left-most */
   } else if (cb == ']') {
-    ind_altc = index;
+    c->ind_altc = index;
   }
 
   /* Check for ligature brackets */
 
   if (cb == '{') {
-    ind_ligo = index; ind_ligc = -1;
+    c->ind_ligo = index; c->ind_ligc = -1;
     return;
   }
   if (cb == '}') {
-    ind_ligc = index;
+    c->ind_ligc = index;
     return;
   }
 
-  /* Inside foliation keep track of index */
-  if (in_foli > 0) {
-    in_foli += 1; 
+  TrackWord(c, cb, index);
+  return;
+}
+
+/*-----------------------------------------------------------*/
+
+void Tokenize(IVTT *c,char *buf)
+/* Split a line into its locus and comment spans, which is what
+   TrackLight works out again for every character. Later steps
+   use the spans instead of tracking the line themselves.
+   The spans are only set up (spok = 1) for a regular line: a
+   locus at the start and comments, each from < to >, with
+   nothing nested or unclosed. Otherwise the steps track as before */
+{
+  int ii = 0, beg = -1;
+  char *pb;
+
+  c->spok = 0; c->nspan = 0;
+  if (c->comlin != 0) return;
+
+  /* Only the brackets matter, so jump from one to the next */
+  while ((pb = strpbrk(buf+ii, "<>")) != NULL) {
+    ii = pb - buf;
+    if (*pb == '<') {
+      if (beg >= 0) return;       /* Nested */
+      beg = ii;
+    } else {
+      if (beg < 0) return;        /* Not open */
+      c->spbeg[c->nspan] = beg;
+      c->spend[c->nspan] = ii;
+      c->sptyp[c->nspan] = (beg == 0) ? '<' : buf[beg+1];
+      c->nspan += 1; beg = -1;
+    }
+    ii += 1;
   }
-  
-  /* Further checks of word boundaries, not in foliation */
-  if (in_foli == 0) {
-  
-    if (cb == ',' || cb == '.' || cb == ' ' ||
-        cb == '\n' || cb == '-') { /* Word delimiter */
-      if (word0 >= 0) word1 = index - 1;
-    } else { /* non-space char */
-      if (word0 < 0) word0 = index;
+  if (beg >= 0) return;           /* Unclosed */
+  c->spok = 1;
+}
+
+/*-----------------------------------------------------------*/
+
+void OutWrite(IVTT *c,char *buf,int len)
+
+/* Write len bytes to the output sink, or to the output file
+   retrying short writes. After a failure nothing more is
+   written, and outerr is set for OutClose */
+
+{
+  ssize_t nput;
+
+  if (c->outerr) return;
+  if (c->outfn != NULL) {
+    if ((*c->outfn)(c->outarg, buf, len) != 0) c->outerr = 1;
+    return;
+  }
+  while (len > 0) {
+    nput = write(fileno(c->fout), buf, len);
+    if (nput < 0 && errno == EINTR) continue;
+    if (nput <= 0) {
+      c->outerr = 1;
+      return;
     }
+    buf += nput; len -= nput;
+  }
+  return;
+}
+
+/*-----------------------------------------------------------*/
 
+void *OutThread(void *arg)
+
+/* Background writer: write out each buffer handed over
+   by OutFlush until told to stop */
+
+{
+  IVTT *c = (IVTT *) arg;
+  int ib, len;
+
+  pthread_mutex_lock(&c->outmtx);
+  while (1) {
+    while (c->outpend < 0 && c->outstop == 0) pthread_cond_wait(&c->outcnd, &c->outmtx);
+    if (c->outpend < 0) break;
+    ib = c->outpend; len = c->outplen;
+    pthread_mutex_unlock(&c->outmtx);
+    OutWrite(c, c->outbuf[ib], len);
+    pthread_mutex_lock(&c->outmtx);
+    c->outpend = -1;
+    pthread_cond_broadcast(&c->outcnd);
+  }
+  pthread_mutex_unlock(&c->outmtx);
+  return NULL;
+}
+
+/*-----------------------------------------------------------*/
+
+void OutFlush(IVTT *c)
+
+/* Write out the current output buffer. With the background
+   writer, hand it over and continue in the other buffer */
+
+{
+  if (c->outlen == 0) return;
+  if (c->outbg == 0) {
+    OutWrite(c, c->outbuf[c->outcur], c->outlen);
+  } else {
+    pthread_mutex_lock(&c->outmtx);
+    while (c->outpend >= 0) pthread_cond_wait(&c->outcnd, &c->outmtx);
+    c->outpend = c->outcur; c->outplen = c->outlen;
+    pthread_cond_broadcast(&c->outcnd);
+    pthread_mutex_unlock(&c->outmtx);
+    c->outcur = 1 - c->outcur;
+  }
+  c->outlen = 0;
+  return;
+}
+
+/*-----------------------------------------------------------*/
+
+int OutClose(IVTT *c)
+
+/* Flush all output and stop the writer thread */
+/* Return 1 if some output could not be written, else 0 */
+
+{
+  OutFlush(c);
+  if (c->outbg) {
+    pthread_mutex_lock(&c->outmtx);
+    c->outstop = 1;
+    pthread_cond_broadcast(&c->outcnd);
+    pthread_mutex_unlock(&c->outmtx);
+    pthread_join(c->outthr, NULL);
+    c->outbg = 0;
+  }
+  return c->outerr;
+}
+
+/*-----------------------------------------------------------*/
+
+int OutEnd(IVTT *c,int iret)
+
+/* Close the output as OutClose, for a run that ended with
+   exit code iret */
+/* Return iret, or 2 if the run was fine but some output
+   could not be written */
+
+{
+  if (OutClose(c)) {
+    if (c->mute < 2) fprintf (c->ferr, "%s\n", "Error writing the output");
+    if (iret == 3) iret = 2;
+  }
+  return iret;
+}
+
+/*-----------------------------------------------------------*/
+
+void OutInit(IVTT *c)
+
+/* Prepare output buffering, starting the writer thread
+   if requested */
+
+{
+  if (c->outbg) {
+    if (pthread_create(&c->outthr, NULL, OutThread, c) != 0) c->outbg = 0;
+  }
+  return;
+}
+
+/*-----------------------------------------------------------*/
+
+void OutBlock(IVTT *c,char *buf,long len)
+
+/* Write len bytes from buf to the output buffer */
+
+{
+  long nput;
+
+  while (len > 0) {
+    nput = OUTBLK - c->outlen;
+    if (nput > len) nput = len;
+    memcpy(c->outbuf[c->outcur]+c->outlen, buf, nput);
+    c->outlen += nput; buf += nput; len -= nput;
+    if (c->outlen == OUTBLK) OutFlush(c);
   }
-  
   return;
 }
 
 /*-----------------------------------------------------------*/
 
-void OutChar(char cb)
+int OutSpan(IVTT *c,char *buf,int len)
+
+/* Write len bytes from buf to the output buffer.
+   Return the number of newlines written */
+
+{
+  int nnl = 0;
+  char *pnl, *pend;
+
+  /* Every newline implies an extra 'wrapped line' */
+  pend = buf + len;
+  pnl = buf;
+  while ((pnl = (char *) memchr(pnl, '\n', pend-pnl)) != NULL) {
+    nnl += 1; pnl += 1;
+  }
+  c->nlwrap += nnl;
+
+  OutBlock(c, buf, len);
+  return nnl;
+}
+
+/*-----------------------------------------------------------*/
+
+void OutChar(IVTT *c,char cb)
 
 /* Write character cb to Ascii file */
 
 /*char cb; */
 
 {
-  /* Print the character itself */
-  fputc (cb, fout);
+  if (c->outlen == OUTBLK) OutFlush(c);
+  c->outbuf[c->outcur][c->outlen++] = cb;
   
   /* If character just written was newline: */
   if (cb == '\n') {
     /* Every newline implies an extra 'wrapped line' */
-    nlwrap += 1;
+    c->nlwrap += 1;
   }
   
   return;
@@ -654,51 +985,99 @@ void OutChar(char cb)
 
 /*-----------------------------------------------------------*/
 
-void OutString(char *buf)
+void OutString(IVTT *c,char *buf)
 
 /* Write string of characters to Ascii file */
 
 /*char *buf;*/ 
 
 {
-  int index = 0;
+  /* Complete lines are identified by a newline
+     passed via routine OutString */ 
+  c->nlwrit += OutSpan(c, buf, strlen(buf));
+  return;
+}
+
+/*-----------------------------------------------------------*/
+
+int OutWrap(IVTT *c,char *buf,int width)
+/* Write string buf to the output in pieces of at most width
+   characters, each broken after the rightmost hard space character
+   (outside comments) that fits, and continued with "/ ".
+   The line is scanned once: the break candidates are tracked while
+   the cursor moves forward, so nothing is shifted or rescanned.
+   Return 0 if all OK, <0 if no space was found for a break */
+
+/*char *buf; 
+  int width;*/
+
+{
+  int iseg = 0, ii = 0, last = -1, voycode = 1;
   char cb;
-  
-  while (cb = buf[index]) {
-/*  if (comlin == 0) {
-      TrackLight(cb, index);
-    }                                  */
-    OutChar(buf[index++]);
-    /* Complete lines are identified by a newline
-       passed via routine OutString */ 
-    if (cb == '\n') nlwrit += 1;
+
+  while ((cb = buf[ii])) {
+    if (ii - iseg == width) {
+      /* The piece is full: break at the last candidate */
+      if (last <= 0) break;
+      OutSpan(c, buf+iseg, last+1);
+      OutSpan(c, "/\n/ ", 4);
+      /* The next piece starts with a blank in place of the
+         break character. That blank is itself a candidate */
+      iseg += last; buf[iseg] = ' ';
+      last = (c->cue == ' ' || c->cue == (char) 0) ? 0 : -1;
+      continue;
+    }
+    /* Dedicated check for comments.
+       Sets voycode if outside comments */
+    if (cb == '<') voycode = 0;
+    else if (cb == '>') voycode = 1;
+    else { 
+      if (cb == c->cue || c->cue == (char) 0) {
+        if (voycode) last = ii - iseg;
+      }  
+    }
+    ii += 1;
   }
-  return;
+  /* Write the last bit, unless no break could be found */
+  if (cb != 0 && last < 0) return -1;
+  c->nlwrit += OutSpan(c, buf+iseg, strlen(buf+iseg));
+  return 0;
 }
 
 /*-----------------------------------------------------------*/
 
-int ParseOpts(int argc,char *argv[])
+int ParseOpts(IVTT *c,int argc,char *argv[])
 /* Parse command line options. There can be many and each should be
    of one of the following types:
    -pv with lower case p: one of:
-     a,b,c,f,h,l,m,p,q,s,u,w,x where v can be 0-9, plus optionally -tC where 
+     a,b,c,f,h,j,l,m,o,p,q,s,u,w,x where v can be 0-9, plus optionally -tC where 
      C is the transliterator code. This can also be +tC.
    -Pc or +Pc with upper case P: page variable where c is A-Z or
      0-9. If P=<at> then used for locus type, c=P for normal loci.
    <filename>:
      Maximum two, where first is input file name and second is
-     output file name  */
+     output file name
+   @<filename>:
+     List of variants, each with its own options and output file.
+   --index:
+     Build the locus index of the input file (see MakeIndex).
+   --cache=<filename>:
+     Keep the output per page in this file, and only process pages
+     that changed since (see RunCache).
+   --corpus=<filename>:
+     Also write the output text as a binary corpus (see CorpLine).
+   --uncert=<filename>:
+     Write the uncertain words of the output as JSON lines (see WriteUnc).
+   =<page> or =<page>.<num>:
+     Look up one page or locus, through the index. May be repeated.
+   Options are added to those already set, so this may be called
+   more than once for one context */
 /*int argc;
   char *argv[];*/
 {
   int i;
   char sign, optn, val, val2;
 
-  for (i=0; i<=26; i++) {
-    invar[i]=' '; exvar[i]=' ';
-  }
-
   /* Suppress uninformative message until further notice */
   /* if (mute == 0) fprintf (stderr,"Parsing Command Line Options\n"); */
 
@@ -709,6 +1088,22 @@ int ParseOpts(int argc,char *argv[])
       /* Normal option, not file name */
       
       optn=argv[i][1]; val=argv[i][2];
+      if (optn == '-') {
+        /* The long options */
+        if (strcmp(argv[i], "--index") == 0) {
+          c->idxopt = 1;
+        } else if (strncmp(argv[i], "--cache=", 8) == 0 && argv[i][8]) {
+          c->cachearg = i;
+        } else if (strncmp(argv[i], "--corpus=", 9) == 0 && argv[i][9]) {
+          c->corparg = i;
+        } else if (strncmp(argv[i], "--uncert=", 9) == 0 && argv[i][9]) {
+          c->uncarg = i;
+        } else {
+          if (c->mute < 2) fprintf (c->ferr, "Unknown option %s\n", argv[i]);
+          return 1;
+        }
+        continue;
+      }
       if (val) {
         /* Get any additional character, usually a null */
         val2 =argv[i][3];
@@ -720,175 +1115,192 @@ int ParseOpts(int argc,char *argv[])
 
         /* Upper case: */
         if (sign == '+') {
-          invar[optn-64]=val;
+          c->invar[optn-64]=val;
         } else {
-          exvar[optn-64]=val;
+          c->exvar[optn-64]=val;
         }
         /* One special case */
         if (optn == '@') {
-          uloc2 = val2; /* NULL or char */
-          kcomh = 1;   /* By default, suppress # comment lines */
+          c->uloc2 = val2; /* NULL or char */
+          c->kcomh = 1;   /* By default, suppress # comment lines */
         }
       } else {
       
         /* Lower case: */
         switch (optn) {
            case 'a':
-             if (val == '0') a_high = 0; /* High ascii as is */
-             else if (val == '1') a_high = 1;  /* High ascii to @123; */
-             else if (val == '2') a_high = 2;  /* @123; to high ascii */
+             if (val == '0') c->a_high = 0; /* High ascii as is */
+             else if (val == '1') c->a_high = 1;  /* High ascii to @123; */
+             else if (val == '2') c->a_high = 2;  /* @123; to high ascii */
              break;
            case 'b':
              /* this no longer looks at % and ! placeholders */
              if (val == '0') {
-               white = 0;               /* Keep blanks */
+               c->white = 0;               /* Keep blanks */
              }
              else if (val == '1') {
-               white = 1;               /* Strip blanks */
+               c->white = 1;               /* Strip blanks */
              }
              break;
            case 'c':
-             if (val == '0') { kcomh=0; kcomi=0; } /* Keep comments */
-             else if (val == '1') { kcomh=1; kcomi=0; }/* Strip # */
-             else if (val == '2') { kcomh=0; kcomi=1; }/* Strip <! > */
-             else if (val == '3') { kcomh=0; kcomi=2; }/* Strip all */
-             else if (val == '4') { kcomh=1; kcomi=1; }/* Strip all */
-             else if (val == '5') { kcomh=1; kcomi=2; }/* Strip all */
+             if (val == '0') { c->kcomh=0; c->kcomi=0; } /* Keep comments */
+             else if (val == '1') { c->kcomh=1; c->kcomi=0; }/* Strip # */
+             else if (val == '2') { c->kcomh=0; c->kcomi=1; }/* Strip <! > */
+             else if (val == '3') { c->kcomh=0; c->kcomi=2; }/* Strip all */
+             else if (val == '4') { c->kcomh=1; c->kcomi=1; }/* Strip all */
+             else if (val == '5') { c->kcomh=1; c->kcomi=2; }/* Strip all */
              break;
            case 'f':
-             if (val == '0') kfoli=0; /* Keep foliation info */
-             else if (val == '1') kfoli=1; /* Strip it */
-             else if (val == '9') folign=1; /* Ignore locus layout */
+             if (val == '0') c->kfoli=0; /* Keep foliation info */
+             else if (val == '1') c->kfoli=1; /* Strip it */
+             else if (val == '9') c->folign=1; /* Ignore locus layout */
                           /* but still process page headers */
              break;
+           case 'j':
+             if (val >= '0' && val <= '9') c->njob = val - '0'; /* Threads */
+             break;
            case 'm':
              if (val == '0') {
-               mute=0; /* All output to stderr */
+               c->mute=0; /* All output to stderr */
              } else if (val == '1') {
-               mute=1; /* suppress warnings */
+               c->mute=1; /* suppress warnings */
              } else if (val == '2') {
-               mute=2; /* suppress everything */
+               c->mute=2; /* suppress everything */
              }
              /* The setting of this option is not reported */
              break;
+           case 'o':
+             if (val == '0') c->outbg = 0;      /* Write output directly */
+             else if (val == '1') c->outbg = 1; /* Write from background thread */
+             break;
            case 'p':
              if (val == '0') {
-               gaps=0; para=0; /* Keep <-> and <%> , <$> */
+               c->gaps=0; c->para=0; /* Keep <-> and <%> , <$> */
              } else if (val == '1') {
-               gaps=1; para=1; /* Gaps and <%> , <$> stripped */
+               c->gaps=1; c->para=1; /* Gaps and <%> , <$> stripped */
              } else if (val == '2') {
-               gaps=1; para=2; /* Gaps to extra space and <$> to extra NL */
+               c->gaps=1; c->para=2; /* Gaps to extra space and <$> to extra NL */
              }
              break;
            case 'q':
              if (val == '0') {
-               toppar=0; /* Keep all P locus lines */
+               c->toppar=0; /* Keep all P locus lines */
              } else if (val == '1') {
-               toppar=1; /* Keep only top P locus lines */
-               para=1; /* and remove paragraph markers */
+               c->toppar=1; /* Keep only top P locus lines */
+               c->para=1; /* and remove paragraph markers */
              } else if (val == '2') {
-               toppar=2; /* Delete all top P locus lines */
-               para=1; /* and remove paragraph markers */
+               c->toppar=2; /* Delete all top P locus lines */
+               c->para=1; /* and remove paragraph markers */
              }
              break;
            case 'l':
-             if (val == '0')  liga=0;     /* Leave ligature brackets */
-             else if (val == '1') liga=1; /* Strip them */
-             else if (val == '2') liga=2; /* This option will be ignored*/
-             else if (val == '3') liga=3; /* Change to capitalisation rule */
-             else if (val == '4') liga=4; /* As 3, but change cth to CTh.. */
+             if (val == '0')  c->liga=0;     /* Leave ligature brackets */
+             else if (val == '1') c->liga=1; /* Strip them */
+             else if (val == '2') c->liga=2; /* This option will be ignored*/
+             else if (val == '3') c->liga=3; /* Change to capitalisation rule */
+             else if (val == '4') c->liga=4; /* As 3, but change cth to CTh.. */
              break;
            case 'h':
-             if (val == '0') s_uncn = 0;      /* Keep comma for uncertain space*/
-             else if (val == '1') s_uncn = 1; /* Treat comma as dot */
-             else if (val == '2') s_uncn = 2; /* Strip uncertain spaces */
+             if (val == '0') c->s_uncn = 0;      /* Keep comma for uncertain space*/
+             else if (val == '1') c->s_uncn = 1; /* Treat comma as dot */
+             else if (val == '2') c->s_uncn = 2; /* Strip uncertain spaces */
              else if (val == '3') {
-               s_uncn = 3;                    /* Turn uncertain spaces to ? */
-               unr = 1;                       /* And turn words with ? into ??? */
+               c->s_uncn = 3;                    /* Turn uncertain spaces to ? */
+               c->unr = 1;                       /* And turn words with ? into ??? */
              }
              break;
            case 's':
              if (val == '0') {
-               s_hard = 0; cue = '.';      /* Keep dot for hard space*/
+               c->s_hard = 0; c->cue = '.';      /* Keep dot for hard space*/
              } else if (val == '1') {
-               s_hard = 1; cue = ' ';      /* Turn hard space to blank */
+               c->s_hard = 1; c->cue = ' ';      /* Turn hard space to blank */
              } else if (val == '2') {
-               s_hard = 2; cue = (char) 0; /* Strip hard space */
-               s_uncn = 2;        /* And also uncertain spaces of course */
+               c->s_hard = 2; c->cue = (char) 0; /* Strip hard space */
+               c->s_uncn = 2;        /* And also uncertain spaces of course */
              } else if (val == '3') {
-               s_hard = 3; cue = '.';     /* Convert space to newline */
-               kfoli = 1;         /* For this also remove foliation ... */
-               wrap = 1;         /* ... and force line unwrapping */
+               c->s_hard = 3; c->cue = '.';     /* Convert space to newline */
+               c->kfoli = 1;         /* For this also remove foliation ... */
+               c->wrap = 1;         /* ... and force line unwrapping */
              }
              break;
            case 't':
-             auth = val;  /* This also used to strip placeholders */
+             c->auth = val;  /* This also used to strip placeholders */
              /* New:  +tX keeps transliterator code, but -tX removes it */
-             if (sign == '-') authrm = 1;
+             if (sign == '-') c->authrm = 1;
              break;
            case 'u':
              if (val == '0') {
-               unr=0; brack=0; /* leave ? and [] as is */
+               c->unr=0; c->brack=0; /* leave ? and [] as is */
              } else if (val == '1') {
-               unr=0; brack=1; /* Take first of [] */
+               c->unr=0; c->brack=1; /* Take first of [] */
              } else if (val == '2') {
-               unr=0; brack=2; /* Turn [] to ? */
+               c->unr=0; c->brack=2; /* Turn [] to ? */
              } else if (val == '3') {
-               unr=1; brack=2; /* Turn word with * into ??? */
+               c->unr=1; c->brack=2; /* Turn word with * into ??? */
              } else if (val == '4') {
-               unr=2; brack=2; /* Remove ? or word with * */
+               c->unr=2; c->brack=2; /* Remove ? or word with * */
              } else if (val == '5') {
-               unr=3; brack=2; /* Remove line with ? * or [..] */}
+               c->unr=3; c->brack=2; /* Remove line with ? * or [..] */}
              break;
            case 'w':
              /* Completely ignore option if spaces converted to line breaks */
-             if (s_hard != 3) {
-               if (val == '0') wrap=0;       /* Maintain line wrapping */
-               else if (val == '1') wrap=1;  /* Unwrap all continuation lines */
+             if (c->s_hard != 3) {
+               if (val == '0') c->wrap=0;       /* Maintain line wrapping */
+               else if (val == '1') c->wrap=1;  /* Unwrap all continuation lines */
                else {
-                 wrap=2;                     /* Re-wrap */
-                 wwidth = 20 * (val - '0');
+                 c->wrap=2;                     /* Re-wrap */
+                 c->wwidth = 20 * (val - '0');
                }
              } 
              break;
            case 'x':
              if (val == '0') {
-               kcomh = 1; kcomi = 0; gaps = 1; para = 1;
-               wrap = 1; white = 1; 
+               c->kcomh = 1; c->kcomi = 0; c->gaps = 1; c->para = 1;
+               c->wrap = 1; c->white = 1; 
              } else if (val == '1') {
-               kcomh = 1; kcomi = 2; kfoli = 1; gaps = 1;
-               para = 1; white = 1; 
+               c->kcomh = 1; c->kcomi = 2; c->kfoli = 1; c->gaps = 1;
+               c->para = 1; c->white = 1; 
              } else if (val == '2') {
-               kcomh = 1; kcomi = 2; kfoli = 1; gaps = 1;
-               para = 1; white = 1; brack = 1;
+               c->kcomh = 1; c->kcomi = 2; c->kfoli = 1; c->gaps = 1;
+               c->para = 1; c->white = 1; c->brack = 1;
              } else if (val == '3') {
-               s_hard = 1; s_uncn = 1; cue = ' ';
+               c->s_hard = 1; c->s_uncn = 1; c->cue = ' ';
              } else if (val == '4') {
-               s_hard = 1; s_uncn = 2; cue = ' ';
+               c->s_hard = 1; c->s_uncn = 2; c->cue = ' ';
              } else if (val == '5') {
-               liga = 1; a_high = 2;
+               c->liga = 1; c->a_high = 2;
              } else if (val == '6') {
-               liga = 4; a_high = 2;
+               c->liga = 4; c->a_high = 2;
              } else if (val == '7') {
-               kcomh = 1; kcomi = 2; kfoli = 1; brack = 1; liga = 1; 
-               white = 1; gaps = 1; para = 1;
-               s_hard = 1; cue = ' '; s_uncn = 1;
+               c->kcomh = 1; c->kcomi = 2; c->kfoli = 1; c->brack = 1; c->liga = 1; 
+               c->white = 1; c->gaps = 1; c->para = 1;
+               c->s_hard = 1; c->cue = ' '; c->s_uncn = 1;
              } else if (val == '8') {
-               kcomh = 1; kcomi = 2; kfoli = 1; brack = 1; liga = 1; 
-               white = 1; gaps = 1; para = 1;
-               s_hard = 1; cue = ' '; s_uncn = 2;
+               c->kcomh = 1; c->kcomi = 2; c->kfoli = 1; c->brack = 1; c->liga = 1; 
+               c->white = 1; c->gaps = 1; c->para = 1;
+               c->s_hard = 1; c->cue = ' '; c->s_uncn = 2;
              }
              break;
         }
       }
+    } else if (sign == '@') {
+      /* The variant list */
+      c->lstarg = i;
+    } else if (sign == '=') {
+      /* A page or locus to look up */
+      if (c->nlook >= MAXARG) {
+        if (c->mute < 2) fprintf (c->ferr, "%s\n", "Too many look-ups");
+        return 1;
+      }
+      c->lkarg[c->nlook++] = i;
     } else {
       /* A file name. Check which of two */
-      if (infarg < 0) {
-        infarg = i;
-      } else if (oufarg < 0) {
-        oufarg = i;
+      if (c->infarg < 0) {
+        c->infarg = i;
+      } else if (c->oufarg < 0) {
+        c->oufarg = i;
       } else {
-        if (mute < 2) fprintf (stderr, "%s\n", "Only two file names allowed");
+        if (c->mute < 2) fprintf (c->ferr, "%s\n", "Only two file names allowed");
         return 1;
       }
     }
@@ -898,235 +1310,298 @@ int ParseOpts(int argc,char *argv[])
 
 /*-----------------------------------------------------------*/
 
-int DumpOpts(int argc,char *argv[])
+int DumpOpts(IVTT *c,int argc,char *argv[])
 /* Print information on selected options
    and open input and output files if required */
 /*int argc;
 char *argv[];*/
   {
   int i;
-  if (mute == 0) {
-    fprintf (stderr,"%s\n","Summary of options:");
+  if (c->mute == 0) {
+    fprintf (c->ferr,"%s\n","Summary of options:");
 
     /* Process each one */
-    switch (a_high) {
-       case 0: fprintf (stderr,"%s\n","Leave high ascii as is");
+    switch (c->a_high) {
+       case 0: fprintf (c->ferr,"%s\n","Leave high ascii as is");
            break;
-       case 1: fprintf (stderr,"%s\n","Expand high ascii to @...; notation");
+       case 1: fprintf (c->ferr,"%s\n","Expand high ascii to @...; notation");
            break;
-       case 2: fprintf (stderr,"%s\n","Convert @...; notation to 1 byte");
+       case 2: fprintf (c->ferr,"%s\n","Convert @...; notation to 1 byte");
            break;
     }
-    switch (kcomh) {
-       case 0: fprintf (stderr,"%s\n","Keep hash comment lines");
+    switch (c->kcomh) {
+       case 0: fprintf (c->ferr,"%s\n","Keep hash comment lines");
            break;
-       case 1: fprintf (stderr,"%s\n","Remove hash comment lines");
+       case 1: fprintf (c->ferr,"%s\n","Remove hash comment lines");
            break;
     }
-    switch (kcomi) {
-       case 0: fprintf (stderr,"%s\n","Keep all inline comments");
+    switch (c->kcomi) {
+       case 0: fprintf (c->ferr,"%s\n","Keep all inline comments");
            break;
-       case 1: fprintf (stderr,"%s\n","Remove inline comments except page headers");
+       case 1: fprintf (c->ferr,"%s\n","Remove inline comments except page headers");
            break;
-       case 2: fprintf (stderr,"%s\n","Remove inline comments, page headers and text tags");
+       case 2: fprintf (c->ferr,"%s\n","Remove inline comments, page headers and text tags");
            break;
     }
-    switch (kfoli) {
-       case 0: fprintf (stderr,"%s\n","Keep foliation");
+    switch (c->kfoli) {
+       case 0: fprintf (c->ferr,"%s\n","Keep foliation");
            break;
-       case 1: fprintf (stderr,"%s\n","Remove foliation and file header");
+       case 1: fprintf (c->ferr,"%s\n","Remove foliation and file header");
            break;
     }
-    switch (folign) {
-       case 1: fprintf (stderr,"%s\n","Ignore locus format (parse old file)");
+    switch (c->folign) {
+       case 1: fprintf (c->ferr,"%s\n","Ignore locus format (parse old file)");
            break;
     }
-    switch (liga) {
-       case 0: fprintf (stderr,"%s\n","Keep ligature brackets");
+    switch (c->liga) {
+       case 0: fprintf (c->ferr,"%s\n","Keep ligature brackets");
            break;
-       case 1: fprintf (stderr,"%s\n","Remove ligature brackets");
+       case 1: fprintf (c->ferr,"%s\n","Remove ligature brackets");
            break;
-       case 2: fprintf (stderr,"%s\n","Invalid option, ignored");
-           liga = 0;
+       case 2: fprintf (c->ferr,"%s\n","Invalid option, ignored");
+           c->liga = 0;
            break;
-       case 3: fprintf (stderr,"%s\n","Change ligature brackets to capitalisation");
+       case 3: fprintf (c->ferr,"%s\n","Change ligature brackets to capitalisation");
             break;     
-       case 4: fprintf (stderr,"%s\n","Use extended EVA capitalisation");
+       case 4: fprintf (c->ferr,"%s\n","Use extended EVA capitalisation");
             break;
     }
-    switch (s_uncn) {
-       case 0: fprintf (stderr,"%s\n","Use comma for uncertain spaces");
+    switch (c->s_uncn) {
+       case 0: fprintf (c->ferr,"%s\n","Use comma for uncertain spaces");
            break;
-       case 1: fprintf (stderr,"%s\n","Treat uncertain spaces as normal spaces (see below)");
+       case 1: fprintf (c->ferr,"%s\n","Treat uncertain spaces as normal spaces (see below)");
            break;
-       case 2: fprintf (stderr,"%s\n","Remove uncertain spaces");
+       case 2: fprintf (c->ferr,"%s\n","Remove uncertain spaces");
            break;
-       case 3: fprintf (stderr,"%s\n","Turn words next to uncertain spaces to ?");
+       case 3: fprintf (c->ferr,"%s\n","Turn words next to uncertain spaces to ?");
            break;
     }
-    switch (s_hard) {
-       case 0: fprintf (stderr,"%s\n","Use dot for normal spaces");
+    switch (c->s_hard) {
+       case 0: fprintf (c->ferr,"%s\n","Use dot for normal spaces");
            break;
-       case 1: fprintf (stderr,"%s\n","Use space for normal spaces");
+       case 1: fprintf (c->ferr,"%s\n","Use space for normal spaces");
            break;
-       case 2: fprintf (stderr,"%s\n","Remove normal spaces");
+       case 2: fprintf (c->ferr,"%s\n","Remove normal spaces");
            break;
-       case 3: fprintf (stderr,"%s\n","Convert normal spaces to line breaks");
+       case 3: fprintf (c->ferr,"%s\n","Convert normal spaces to line breaks");
            break;
     }
-    switch (white) {
-       case 0: fprintf (stderr,"%s\n","Keep white space");
+    switch (c->white) {
+       case 0: fprintf (c->ferr,"%s\n","Keep white space");
            break;
-       case 1: fprintf (stderr,"%s\n","Remove white space");
+       case 1: fprintf (c->ferr,"%s\n","Remove white space");
            break;
     }
-    switch (brack) {
-       case 0: fprintf (stderr,"%s\n","Keep alternate readings notation");
+    switch (c->brack) {
+       case 0: fprintf (c->ferr,"%s\n","Keep alternate readings notation");
            break;
-       case 1: fprintf (stderr,"%s\n","Take first of alternate readings");
+       case 1: fprintf (c->ferr,"%s\n","Take first of alternate readings");
            break;
-       case 2: fprintf (stderr,"%s\n","Turn alternate readings into ?");
+       case 2: fprintf (c->ferr,"%s\n","Turn alternate readings into ?");
            break;
     }
-    switch (unr) {
-       case 0: fprintf (stderr,"%s\n","Keep words containing ?");
+    switch (c->unr) {
+       case 0: fprintf (c->ferr,"%s\n","Keep words containing ?");
            break;
-       case 1: fprintf (stderr,"%s\n","Turn words containing ? into ???");
+       case 1: fprintf (c->ferr,"%s\n","Turn words containing ? into ???");
            break;
-       case 2: fprintf (stderr,"%s\n","Remove words containing ?");
+       case 2: fprintf (c->ferr,"%s\n","Remove words containing ?");
            break;
-       case 3: fprintf (stderr,"%s\n","Remove lines containing ?");
+       case 3: fprintf (c->ferr,"%s\n","Remove lines containing ?");
            break;
     }
-    switch (para) {
-       case 0: fprintf (stderr,"%s\n","Keep paragraph start / end code");
+    switch (c->para) {
+       case 0: fprintf (c->ferr,"%s\n","Keep paragraph start / end code");
            break;
-       case 1: fprintf (stderr,"%s\n","Remove paragraph start / end code");
+       case 1: fprintf (c->ferr,"%s\n","Remove paragraph start / end code");
            break;
-       case 2: fprintf (stderr,"%s\n","Replace para end code by extra newline");
+       case 2: fprintf (c->ferr,"%s\n","Replace para end code by extra newline");
            break;
     }
-    switch (gaps) {
-       case 0: fprintf (stderr,"%s\n","Keep drawing intrusion code");
+    switch (c->gaps) {
+       case 0: fprintf (c->ferr,"%s\n","Keep drawing intrusion code");
            break;
-       case 1: fprintf (stderr,"%s\n","Remove drawing intrusion code");
+       case 1: fprintf (c->ferr,"%s\n","Remove drawing intrusion code");
            break;
-       case 2: fprintf (stderr,"%s\n","Change drawing intrusion code into extra space");
+       case 2: fprintf (c->ferr,"%s\n","Change drawing intrusion code into extra space");
            break;
     }
-    switch (wrap) {
-       case 0: fprintf (stderr,"%s\n","Maintain line wrapping");
+    switch (c->wrap) {
+       case 0: fprintf (c->ferr,"%s\n","Maintain line wrapping");
+           break;
+       case 1: fprintf (c->ferr,"%s\n","Unwrap continuation lines");
            break;
-       case 1: fprintf (stderr,"%s\n","Unwrap continuation lines");
+       default: fprintf (c->ferr,"(Re)wrap lines at %3d \n", c->wwidth);
            break;
-       default: fprintf (stderr,"(Re)wrap lines at %3d \n", wwidth);
+    }
+    switch (c->outbg) {
+       case 1: fprintf (c->ferr,"%s\n","Write output from background thread");
            break;
     }
+    if (c->njob > 1) {
+      fprintf (c->ferr,"Process pages on %d threads\n", c->njob);
+    }
 
     /* Locus handling */
-    fprintf (stderr,"\nLine selection options:\n");
-    if (auth == ' ') {
-      fprintf (stderr,"%s\n","Ignore transliterator ID");
+    fprintf (c->ferr,"\nLine selection options:\n");
+    if (c->auth == ' ') {
+      fprintf (c->ferr,"%s\n","Ignore transliterator ID");
     } else {
-      fprintf (stderr,"%s %c\n","Use only data from transliterator",auth);
-      if (authrm) {
-        fprintf (stderr,"%s\n","Transliterator ID will be removed");
+      fprintf (c->ferr,"%s %c\n","Use only data from transliterator",c->auth);
+      if (c->authrm) {
+        fprintf (c->ferr,"%s\n","Transliterator ID will be removed");
       } else {
-        fprintf (stderr,"%s\n","Transliterator ID will be kept");
+        fprintf (c->ferr,"%s\n","Transliterator ID will be kept");
       }
     }
-    if (invar[0] != ' ') {
-      if (uloc2) {
-        fprintf (stderr,"Include only locus type %c%c\n", invar[0], uloc2);
+    if (c->invar[0] != ' ') {
+      if (c->uloc2) {
+        fprintf (c->ferr,"Include only locus type %c%c\n", c->invar[0], c->uloc2);
       } else {
-        fprintf (stderr,"Include only locus type %c\n", invar[0]);
+        fprintf (c->ferr,"Include only locus type %c\n", c->invar[0]);
       }
-      nlcopt = 1;
     }
-    if (exvar[0] != ' ') {
-      if (uloc2) {
-        fprintf (stderr,"Exclude only locus type %c%c\n", invar[0], uloc2);
+    if (c->exvar[0] != ' ') {
+      if (c->uloc2) {
+        fprintf (c->ferr,"Exclude only locus type %c%c\n", c->invar[0], c->uloc2);
       } else {
-        fprintf (stderr,"Exclude locus type %c\n", exvar[0]);
+        fprintf (c->ferr,"Exclude locus type %c\n", c->exvar[0]);
       }
-      nlcopt = 1;
     }
-    switch (toppar) {
-       case 0: fprintf (stderr,"%s\n","Keep all normal paragraph text lines");
+    switch (c->toppar) {
+       case 0: fprintf (c->ferr,"%s\n","Keep all normal paragraph text lines");
            break;
-       case 1: fprintf (stderr,"%s\n","Keep only first normal paragraph text lines");
+       case 1: fprintf (c->ferr,"%s\n","Keep only first normal paragraph text lines");
            break;
-       case 2: fprintf (stderr,"%s\n","Keep all but first normal paragraph text lines");
+       case 2: fprintf (c->ferr,"%s\n","Keep all but first normal paragraph text lines");
            break;
     }
   
     /* Page splitter */
-    fprintf (stderr,"\nPage/tag selection options (exclude overrules include):\n");
+    fprintf (c->ferr,"\nPage/tag selection options (exclude overrules include):\n");
 
     for (i=1; i<=26; i++) {
-      if (invar[i] != ' ') {
-        fprintf (stderr, "- Include if variable %c set to %c\n", i+64, invar[i]);
-        npgopt += 1;
+      if (c->invar[i] != ' ') {
+        fprintf (c->ferr, "- Include if variable %c set to %c\n", i+64, c->invar[i]);
       }
-      if (exvar[i] != ' ') {
-        fprintf (stderr, "- Exclude if variable %c set to %c\n", i+64, exvar[i]);
-        npgopt += 1;
+      if (c->exvar[i] != ' ') {
+        fprintf (c->ferr, "- Exclude if variable %c set to %c\n", i+64, c->exvar[i]);
       }
     }
-    if (npgopt == 0) fprintf (stderr, "- Include all.\n");
+    if (c->npgopt == 0) fprintf (c->ferr, "- Include all.\n");
 
   }  /* End of: if (mute == 0) */
 
   /* Files */
-  if (mute == 0) fprintf (stderr,"\nInput file: ");
-  if (infarg >= 0) {
-    if (mute == 0) fprintf(stderr, "%s\n",argv[infarg]);
-    if ((fin = fopen(argv[infarg], "r")) == NULL) {
-      if (mute < 2) fprintf(stderr, "Input file does not exist\n");
+  if (c->mute == 0) fprintf (c->ferr,"\nInput file: ");
+  if (c->infarg >= 0) {
+    if (c->mute == 0) fprintf(c->ferr, "%s\n",argv[c->infarg]);
+    if ((c->fin = fopen(argv[c->infarg], "r")) == NULL) {
+      if (c->mute < 2) fprintf(c->ferr, "Input file does not exist\n");
       return 1;
     }
   } else {
-    fin = stdin;
-    if (mute == 0) fprintf (stderr,"<stdin>\n");
+    c->fin = stdin;
+    if (c->mute == 0) fprintf (c->ferr,"<stdin>\n");
   }
   
-  if (mute == 0) fprintf (stderr,"Output file: ");
-  if (oufarg >= 0) {
-    if (mute == 0) fprintf(stderr, "%s\n", argv[oufarg]);
-    if ((fout = fopen(argv[oufarg], "w")) == NULL) {
-      if (mute < 2) fprintf(stderr, "Cannot open output file\n");
+  if (c->lstarg >= 0) {
+    /* The output files are in the variant list */
+    if (c->mute == 0) fprintf(c->ferr, "Variant list: %s\n", argv[c->lstarg]+1);
+    return 0;
+  }
+  if (c->mute == 0) fprintf (c->ferr,"Output file: ");
+  if (c->oufarg >= 0) {
+    if (c->mute == 0) fprintf(c->ferr, "%s\n", argv[c->oufarg]);
+    if ((c->fout = fopen(argv[c->oufarg], "w")) == NULL) {
+      if (c->mute < 2) fprintf(c->ferr, "Cannot open output file\n");
       return 1;
     }
   } else {
-    fout = stdout;
-    if (mute == 0) fprintf (stderr, "<stdout>\n");
+    c->fout = stdout;
+    if (c->mute == 0) fprintf (c->ferr, "<stdout>\n");
   } 
   return 0;
 }
 
 /*-----------------------------------------------------------*/
 
-int GetLine(char *buf)
-/* Get line from stdin to buffer */
+int ResizeMem(void **pmem,long size)
+/* Change the size of a block, keeping it if this fails */
+/* Return 0 if all OK, 1 if out of memory */
+{
+  void *nmem;
+
+  nmem = realloc(*pmem, size);
+  if (nmem == NULL) return 1;
+  *pmem = nmem;
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int LineRoom(IVTT *c,long size)
+/* Make sure that all line buffers have at least size bytes.
+   They grow by doubling and keep their contents */
+/* Return 0 if all OK, 1 if out of memory */
+{
+  long ncap;
+  char **pb[6];
+  int i;
+
+  if (size <= c->lcap) return 0;
+  ncap = (c->lcap < MAXLEN) ? MAXLEN : c->lcap;
+  while (ncap < size) ncap *= 2;
+
+  pb[0] = &c->obuf; pb[1] = &c->buf1; pb[2] = &c->buf2;
+  pb[3] = &c->work; pb[4] = &c->wrapbuf; pb[5] = &c->pgh;
+  for (i=0; i<6; i++) {
+    if (ResizeMem((void **) pb[i], ncap)) return 1;
+  }
+  /* A span takes at least two characters */
+  if (ResizeMem((void **) &c->spbeg, (ncap/2+1) * sizeof(int)) ||
+      ResizeMem((void **) &c->spend, (ncap/2+1) * sizeof(int)) ||
+      ResizeMem((void **) &c->sptyp, ncap/2+1)) return 1;
+  c->lcap = (int) ncap;
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+long LineSize(IVTT *c,long len)
+/* Buffer size needed for a record of len characters. With -h1
+   PrepLine can turn each character into five */
+{
+  return ((c->a_high == 1) ? 5 * len : len) + 2;
+}
+
+/*-----------------------------------------------------------*/
+
+int UnwrapLine(IVTT *c,int *len)
+/* Read a record character by character from the input window
+   to c->obuf, concatenating lines ending in slash if wrap option >0 */
 /* Return 0 if all OK, <0 if EOF, 1 if error */
-/* Concatenate lines ending in slash if wrap option >0 */
+/* Return -3 if the window ends before the record does, but more
+   input is still to come. The record is then left unread */
 /* Avoid confusion with / locator in locus using ugly hack */
 
-/*char *buf;*/
 {
   int cr = 0, eod = 0, index = 0, iget, blank, ignore;
-  int ii;
-  char cget;
-  char ctest[8] = "#=IVTFF ";
-
-  /* Set these global parameters */
-  comlin = 0; hastrtxt = 0; concat = 0; cator = ' '; loc2[0]='\0'; loc2[1]='\0';
+  int nlpart0 = c->nlpart;
+  long inpos0 = c->inpos;
+  char cget, *buf = c->obuf;
 
   while (cr == 0 && eod == 0) {
     ignore = 0;
-    iget = fgetc(fin);
+    if (c->inpos < c->inlen) {
+      iget = (unsigned char) c->inbuf[c->inpos++];
+    } else if (c->ineof == 0) {
+      c->inpos = inpos0; c->nlpart = nlpart0;
+      return -3;
+    } else {
+      iget = EOF;
+    }
     /* fprintf(stderr, "Index %3d,  char %3d\n", index, iget); */
-
     /* Check for end of file. Only allowed at first read */
     eod = (iget == EOF);
     if (eod) {
@@ -1134,9 +1609,9 @@ int GetLine(char *buf)
         return -1;       /* Correct EOF */
       } else {
         buf[index] = 0;  /* Add a null character for safety */
-        if (mute < 2) {
-          fprintf (stderr, "EOF at record pos. %3d\n", index);        
-          fprintf (stderr, "Line read so far: %s\n", buf); 
+        if (c->mute < 2) {
+          fprintf (c->ferr, "EOF at record pos. %3d\n", index);        
+          fprintf (c->ferr, "Line read so far: %s\n", buf); 
         }
         return -2;
       }
@@ -1153,43 +1628,43 @@ int GetLine(char *buf)
 
     if (cget == '#') {
       /* A hash symbol. Not allowed when unwrapping */
-      if (concat > 0) {
+      if (c->concat > 0) {
         buf[index] = 0;  /* Add a null character for safety */
-        if (mute < 2) {
-          fprintf (stderr, "Hash comment after continuation\n");        
-          fprintf (stderr, "Line read so far: %s\n", buf); 
+        if (c->mute < 2) {
+          fprintf (c->ferr, "Hash comment after continuation\n");        
+          fprintf (c->ferr, "Line read so far: %s\n", buf); 
         }
         return 1;
       }
       /* Check hash comment line */
       if (index == 0) {
-        comlin = 1;
+        c->comlin = 1;
         /* Later on also check for file header */
       }
     }
     
     /* Unwrap-processing only if this is not a hash comment */
-    if (comlin == 0 && wrap > 0) {
-      if (concat == 0) { /* Search for slash */
+    if (c->comlin == 0 && c->wrap > 0) {
+      if (c->concat == 0) { /* Search for slash */
         if (cget == '/') {  /* avoid confusion with / locator code */
           if (index > 11) {
-            concat = 1;
+            c->concat = 1;
             ignore = 1;
           }
         }
-      } else if (concat == 1) { /* Search for newline */
+      } else if (c->concat == 1) { /* Search for newline */
         ignore = 1;
         if (cget == '\n') {
-          concat = 2;
+          c->concat = 2;
         } else if (blank == 0) {
-          concat = 0;
+          c->concat = 0;
           ignore = 0;
         }
-      } else if (concat == 2) { /* Search for non-blank */
+      } else if (c->concat == 2) { /* Search for non-blank */
         if (blank == 0 && cget != '/') {
           /* This actualy skips any nr of / at the start, not just 1 */
-          concat = 0;
-          nlpart += 1; /* Only here count continuation */
+          c->concat = 0;
+          c->nlpart += 1; /* Only here count continuation */
         } else {
           ignore = 1;
         }        
@@ -1200,20 +1675,18 @@ int GetLine(char *buf)
     if (ignore == 0) {
 
       /* Should add the character to the buffer */
-      /* However, first check for buffer overflow */
-      if (index >= (MAXLEN-2)) {
-        buf[index] = '\n';
-        buf[index+1] = 0;
-        if (mute < 2) {
-          fprintf (stderr, "Record too long.\n");        
-          fprintf (stderr, "Line read so far: %s\n", buf); 
+      /* However, first make room for a longer record */
+      if (LineSize(c, index+1) > c->lcap) {
+        if (LineRoom(c, 2 * LineSize(c, index+1))) {
+          if (c->mute < 2) fprintf (c->ferr, "Out of memory\n");
+          return 1;
         }
-        return 1;
+        buf = c->obuf;
       }
 
       /* Now safe to add */
       buf[index++] = cget;
-      if (blank == 0) hastrtxt = 1;
+      if (blank == 0) c->hastrtxt = 1;
      
       /* Check for newline */
       if (cget == '\n') {
@@ -1223,30 +1696,89 @@ int GetLine(char *buf)
     } /* End if ignore == 0 */
   }
 
-  /* Now initiase filehead based on the first line of the file.
+  *len = index;
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int GetLine(IVTT *c,char **line,int *len)
+/* Get line from the input window */
+/* Return 0 if all OK, <0 if EOF, 1 if error */
+/* Return -3 if the record is not complete yet (see ivtt_feed) */
+/* On return, line and len describe the line including its
+   newline. This points directly into the input window, unless
+   the line had to be assembled in c->obuf by UnwrapLine.
+   The line buffers are made large enough for it */
+
+{
+  int ii, iget;
+  long nrec;
+  char cget, *rec, *eol;
+  char ctest[8] = "#=IVTFF ";
+
+  /* Set these global parameters */
+  c->comlin = 0; c->hastrtxt = 0; c->concat = 0; c->cator = ' '; c->loc2[0]='\0'; c->loc2[1]='\0';
+
+  /* Locate the end of this record in the window */
+  if (c->inpos >= c->inlen) {
+    if (c->ineof == 0) return -3;
+    return -1;       /* Correct EOF */
+  }
+  eol = (char *) memchr(c->inbuf+c->inpos, '\n', c->inlen-c->inpos);
+  if (eol == NULL && c->ineof == 0) return -3;
+
+  /* A complete record that needs no unwrapping is handed over
+     as it is. Unwrapping is only needed if there is a slash
+     beyond the locus */
+  rec = c->inbuf+c->inpos;
+  nrec = (eol == NULL) ? 0 : eol - rec + 1;
+  if (nrec > 0 && (rec[0] == '#' || c->wrap == 0 || nrec <= 12 ||
+       memchr(rec+12, '/', nrec-12) == NULL)) {
+    if (LineRoom(c, LineSize(c, nrec))) {
+      if (c->mute < 2) fprintf (c->ferr, "Out of memory\n");
+      return 1;
+    }
+    c->comlin = (rec[0] == '#');
+    for (ii=0; ii<nrec; ii++) {
+      cget = rec[ii];
+      if (cget != ' ' && cget != '\t' && cget != '\n') {
+        c->hastrtxt = 1; break;
+      }
+    }
+    c->inpos += nrec;
+    *line = rec; *len = (int) nrec;
+  } else {
+    iget = UnwrapLine(c, len);
+    if (iget != 0) return iget;
+    *line = c->obuf;
+  }
+
+  /* Now initiase filehead based on the first line of the file.
      Value 2 if it is a complete header, 1, if it is a comment,
      or 0 if it is neither.
      After this it can only decrease */
-  if (nlread == 0) {
-    filehead = 2;
+  if (c->nlread == 0 && c->midfile == 0) {
+    c->filehead = 2;
     for (ii=1; ii<=7; ii++) {
-      if (buf[ii] != ctest[ii]) filehead = 1;
+      if (ii >= *len || (*line)[ii] != ctest[ii]) c->filehead = 1;
     }
-    if (comlin == 0) filehead = 0;
-    if (filehead != 2) {
-      if (mute == 0) fprintf (stderr, "Input file has no IVTFF header.\n");        
+    if (c->comlin == 0) c->filehead = 0;
+    if (c->filehead != 2) {
+      if (c->mute == 0) fprintf (c->ferr, "Input file has no IVTFF header.\n");        
     }
   } else {
-    if (filehead == 2) filehead = 1;
-    if (comlin == 0) filehead = 0;
+    if (c->filehead == 2) c->filehead = 1;
+    if (c->comlin == 0) c->filehead = 0;
   }
   return 0;
 }
 
 /*-----------------------------------------------------------*/
 
-int PrepLine(char *buf1,char *buf2)
-/* Preprocess line that was just read from file or stdin to buffer */
+int PrepLine(IVTT *c,char *buf1,int len1,char *buf2)
+/* Preprocess line that was just read from file or stdin to buffer.
+   The input line has length len1 and need not be null-terminated */
 /* This completely decodes the locus ID information */
 /* Return 0 if all OK, <0 if EOF, 1 if error */
 
@@ -1260,21 +1792,37 @@ int PrepLine(char *buf1,char *buf2)
   int in_loc = 0;   /* Track locator and locus type (new) */
   int in_auth = 0;  /* Track transliterator */
   int ignore;       /* Processing white space */
+  unsigned char cls; /* Class bits of cget */
+  int nrun;         /* Length of a run that is just copied */
   int ii;           /* Used to convert char(ijk) to @ijk; */
 
   /* Set these global parameters */
-  hasfoli = 0; newpage = 0; nwpar = 0;
+  c->hasfoli = 0; c->newpage = 0; c->nwpar = 0; c->endpar = 0;
 
   /* comlin and hastrtxt were already set in GetLine */
   
-  trackinit();
+  trackinit(c);
 
-  while (cget = buf1[ind1]) {
+  while (ind1 < len1 && (cget = buf1[ind1])) {
     
     /* For hash comment just copy: */
-    if (comlin) {
-      buf2[ind2++] = cget;
-      /* fprintf(stderr, "Index %3d,  char %3d\n", ind2, cget); */
+    if (c->comlin) {
+      nrun = PlainRun(c, buf1+ind1, len1-ind1, 0);
+      memcpy(buf2+ind2, buf1+ind1, nrun);
+      ind1 += nrun; ind2 += nrun;
+      continue;
+    } else if (c->in_comm == 0 && c->in_foli == 0 && c->newpage != 1 &&
+               (c->ccls[cget] & CC_PREP) == 0) {
+      /* Plain text is copied as it is, up to the next character
+         that needs attention. It can only start or extend a word */
+      nrun = PlainRun(c, buf1+ind1, len1-ind1, CC_PREP);
+      if (c->word1 >= 0) {
+        c->word0 = -1; c->word1 = -1;
+      }
+      if (c->word0 < 0) c->word0 = ind1;
+      memcpy(buf2+ind2, buf1+ind1, nrun);
+      ind1 += nrun; ind2 += nrun;
+      continue;
     } else {
       /* No comment line: do all the processing */
       
@@ -1284,37 +1832,34 @@ int PrepLine(char *buf1,char *buf2)
       /* 2. Check for white space, leaving it untouched inside
          inline comments */
       ignore = 0;
-      if (cget == ' ' || cget == '\t') {
-        if (in_comm == 0 && white == 1) ignore = 1;
-      }
+      cls = c->ccls[cget];
+      if ((cls & CC_WHITE) && c->in_comm == 0) ignore = 1;
 
       /* 3. Process ligature brackets if desired */
-      if (liga == 1) {
-        if (cget == '{' || cget == '}' ) ignore = 1;
-      }
+      if (cls & CC_DROP) ignore = 1;
 
       /* Process this char only if ignore not set */
       if (ignore == 0) {
 
         /* Check for open caret in 1st position */
-        if (cget == '<' && in_comm == 0) {
+        if (cget == '<' && c->in_comm == 0) {
           if (ind1 == 0) {
-            hasfoli = 1;
+            c->hasfoli = 1;
           }
         }
   
         /* Track the text */
-        if (Track(cget, ind1)) {
+        if (Track(c, cget, ind1)) {
           /* Returned with an error. Add a null. */
           buf2[ind2] = 0;
-          return trackerr(buf2, cget);
+          return trackerr(c, buf2, cget);
         }
 
         /* If necessary, replace old style alt.reading separator */
-        if ((cget == '|') && (ind_altc < ind_alto)) cget = ':';
+        if ((cget == '|') && (c->ind_altc < c->ind_alto)) cget = ':';
 
         /* Process Ascii(128-255) if desired */
-        if (in_comm == 0 && a_high == 1) {
+        if (c->in_comm == 0 && (cls & CC_HIGH) && c->a_high == 1) {
           if (cget > 127) {
             buf2[ind2++]= '@';  
             ii = cget / 100; buf2[ind2++] = ii + 48;
@@ -1327,39 +1872,39 @@ int PrepLine(char *buf1,char *buf2)
       
         /* Process @...; if desired */
 
-        if (in_comm == 0 && a_high == 2) {
-          if (hasc0 >= 0 && hasc1 < 0) {
+        if (c->in_comm == 0 && (cls & CC_HIGH) && c->a_high == 2) {
+          if (c->hasc0 >= 0 && c->hasc1 < 0) {
             if (cget >= '0' && cget <= '9') {
               /* Process numbers between & and ; */
-              highasc = 10 * highasc + (cget - '0');
+              c->highasc = 10 * c->highasc + (cget - '0');
               /* fprintf(stderr, "Hiasc(I): %3d\n", highasc); */
             }
           }
           if (cget == '@') {
-            if (in_foli == 0) { /* Do not get confused by locator code */
-              if (hasc0 >= 0) { /* Already open */
-                if (mute < 2) fprintf(stderr, "Illegal %c after @ \n", cget);      
+            if (c->in_foli == 0) { /* Do not get confused by locator code */
+              if (c->hasc0 >= 0) { /* Already open */
+                if (c->mute < 2) fprintf(c->ferr, "Illegal %c after @ \n", cget);      
                 return 1;
               }
-              hasc0 = ind2;
-              hasc1 = -1;
-              highasc = 0;
+              c->hasc0 = ind2;
+              c->hasc1 = -1;
+              c->highasc = 0;
             }
           }
 
           if (cget == ';') {
-            if (in_foli == 0) { /* Do not get confused by transliterator code */
-              if (hasc0 <= 0) { /* Not open */
-                if (mute < 2) fprintf(stderr, "%s\n", "Illegal semi-colon");    
+            if (c->in_foli == 0) { /* Do not get confused by transliterator code */
+              if (c->hasc0 <= 0) { /* Not open */
+                if (c->mute < 2) fprintf(c->ferr, "%s\n", "Illegal semi-colon");    
                 return 1;
               }
-              hasc1 = ind2; /* This will trigger code at end */
+              c->hasc1 = ind2; /* This will trigger code at end */
             }
           }
         }
 
         /* Process all locus details inside foliation brackets */
-        if (in_foli != 0) {
+        if (c->in_foli != 0) {
 
           /* Evolve pointers */
           if (in_num == -1) in_num = 1;
@@ -1374,20 +1919,20 @@ int PrepLine(char *buf1,char *buf2)
              If folign is set, only look for < and > with no other
              puctuation in between */
 
-          if (folign == 0) {
+          if (c->folign == 0) {
             /* This is the case where locus details are interpreted */
             switch (cget) {
               case '<':
-                *folname = '\0';
-                cator = ' ';
-                *loc2 = '\0';
-                lineauth = ' ';
-                newpage = -1;
+                *c->folname = '\0';
+                c->cator = ' ';
+                *c->loc2 = '\0';
+                c->lineauth = ' ';
+                c->newpage = -1;
                 break;
               case '>': /* Terminate (as needed) locus ID */
-                if (newpage < 0) {
+                if (c->newpage < 0) {
                   /* Not a new locus but a new page. Prepare for var. reading */
-                  newpage = 1; clearvar();
+                  c->newpage = 1; clearvar(c);
                 } else {
                   /* End of locus. */
                   /* Did it end with a transliterator ID? */
@@ -1395,28 +1940,28 @@ int PrepLine(char *buf1,char *buf2)
                     in_auth = -2;
                   } else {  /* must be end of locus type */
                     if (in_loc != 4) {
-                      if (mute < 2) fprintf(stderr, "%s\n", "Illegal > after incomplete locus");
+                      if (c->mute < 2) fprintf(c->ferr, "%s\n", "Illegal > after incomplete locus");
                       return 1;
                     }
                     /* Terminate locus ID */
                     in_loc = -2;
                   }
                 }
-                in_foli = -2;
+                c->in_foli = -2;
                 break;
               case '.': /* Start of locus number */
                 if (in_num != 0) {  /* this test must be improved */
-                  if (mute < 2) fprintf(stderr, "%s\n", "Illegal second . inside locus ID");
+                  if (c->mute < 2) fprintf(c->ferr, "%s\n", "Illegal second . inside locus ID");
                   return 1;
                 }
                 /* Start of the locus number */
-                newpage = 0;
+                c->newpage = 0;
                 in_num = -1;
-                num = 0;
+                c->num = 0;
                 break;
               case ',': /* Start of locus type, with locator */
                 if (in_num <= 0) { /* should have been decoding number */
-                  if (mute < 2) fprintf(stderr, "%s\n", "Illegal , without locus num");
+                  if (c->mute < 2) fprintf(c->ferr, "%s\n", "Illegal , without locus num");
                   return 1;
                 }
                 in_num = -2;
@@ -1424,7 +1969,7 @@ int PrepLine(char *buf1,char *buf2)
                 break;
               case ';': 
                 if (in_loc != 4) {
-                  if (mute < 2) fprintf(stderr, "%s\n", "Illegal ; after incomplete locus");
+                  if (c->mute < 2) fprintf(c->ferr, "%s\n", "Illegal ; after incomplete locus");
                   return 1;
                 }
                 /* Terminate locus ID */
@@ -1436,24 +1981,24 @@ int PrepLine(char *buf1,char *buf2)
                 /* Any other char. Check to which field it belongs */
                 /* Part of transliterator ID ? */
                 if (in_auth > 1) {
-                  if (mute < 2) fprintf(stderr, "%s\n", "Illegal author ID length");
+                  if (c->mute < 2) fprintf(c->ferr, "%s\n", "Illegal author ID length");
                   return 1;
                 }
                 if (in_auth == 1) { /* Get author ID */
-                  lineauth = cget;
+                  c->lineauth = cget;
                   in_auth = 2;
                   break;
                 }  
                 /* Part of locus ? */
                 if (in_loc > 0) {
                   if (in_loc > 3) {
-                    if (mute < 2) fprintf(stderr, "%s\n", "Locus type more than 3 char");
+                    if (c->mute < 2) fprintf(c->ferr, "%s\n", "Locus type more than 3 char");
                     return 1;
                   }
                   if (in_loc > 1) {
-                    loc2[in_loc-2] = cget;
+                    c->loc2[in_loc-2] = cget;
                   } else {  /* The locator character */
-                    cator = cget;
+                    c->cator = cget;
                   }
                   in_loc += 1;
                   break;
@@ -1461,20 +2006,22 @@ int PrepLine(char *buf1,char *buf2)
                 /* Part of number ? */
                 if (in_num > 0) {
                   if (in_num > 3) {
-                    if (mute < 2) fprintf(stderr, "%s\n", "Locus number more than 3 char");
+                    if (c->mute < 2) fprintf(c->ferr, "%s\n", "Locus number more than 3 char");
                     return 1;
                   }
-                  num = 10 * num + (cget - '0');
+                  c->num = 10 * c->num + (cget - '0');
                   in_num += 1;
                   break;
                 }
                 /* If we are here it must be part of the page name */
-                if (in_foli > 7) {
-                  if (mute < 2) fprintf(stderr, "%s\n", "Page name more than 6 char");
+                if (c->in_foli > 7) {
+                  if (c->mute < 2) fprintf(c->ferr, "%s\n", "Page name more than 6 char");
                   return 1;
                 } 
-                folname[in_foli-1] = cget;
-                folname[in_foli] = 0;
+                c->folname[c->in_foli-1] = cget;
+                c->folname[c->in_foli] = 0;
+                /* A full-length name has always raised a ^@ warning */
+                if (c->in_foli == 7) c->cwarn = 0;
 
             } /* End Case (for folign == 0) */
 
@@ -1482,19 +2029,19 @@ int PrepLine(char *buf1,char *buf2)
             /* This is the case where most locus details are ignored */
             switch (cget) {
               case '<':
-                newpage = -1;
+                c->newpage = -1;
                 break;
               case '>':
-                if (newpage < 0) {
+                if (c->newpage < 0) {
                   /* Not a new locus but a new page. Prepare for var. reading */
-                  newpage = 1; clearvar();
+                  c->newpage = 1; clearvar(c);
                 }
-                in_foli = -2;
+                c->in_foli = -2;
                 break;
               case '.':
               case ',':
               case ';':
-                newpage = 0;
+                c->newpage = 0;
                 break;
               default:
                 /* Nothing to be done */
@@ -1506,17 +2053,17 @@ int PrepLine(char *buf1,char *buf2)
         } /* End of: if in_foli != 0 */
 
         /* Check for page variables, only if start of new page found */
-        if (newpage == 1) {
+        if (c->newpage == 1) {
 
           if (varpt == -3) {
             if (cget < 'A' || cget > 'Z') {
-              cwarn = '$'; varpt = 0;
+              c->cwarn = '$'; varpt = 0;
             } else {
               varid = cget;
             }
           }
 
-          if (varpt == -1) pgvar[varid-64] = cget;
+          if (varpt == -1) c->pgvar[varid-64] = cget;
 
           /* Advance pointer */
           if (varpt < 0) varpt += 1;
@@ -1532,12 +2079,12 @@ int PrepLine(char *buf1,char *buf2)
         /* Add the character to the buffer */
         buf2[ind2++] = cget;
         /* Check for complete &..; code */
-        if (a_high == 2) {
-          if (hasc1 >= 0) {
+        if (c->a_high == 2) {
+          if (c->hasc1 >= 0) {
             /* fprintf(stderr, "Hiasc(F): %3d\n", highasc); */
-            buf2[hasc0] = (char) highasc;
-            ind2 = hasc0 + 1;
-            hasc0 = hasc1 = -1;
+            buf2[c->hasc0] = (char) c->highasc;
+            ind2 = c->hasc0 + 1;
+            c->hasc0 = c->hasc1 = -1;
           }
         }  
       } /* End if ignore == 0 */
@@ -1550,189 +2097,198 @@ int PrepLine(char *buf1,char *buf2)
 
   /* Now the entire line was read, do some more checks */
 
-  if (comlin == 0) {
-    if (in_comm) {
-      if (mute < 2) fprintf(stderr, "%s", "Unclosed comment\n");
+  if (c->comlin == 0) {
+    if (c->in_comm) {
+      if (c->mute < 2) fprintf(c->ferr, "%s", "Unclosed comment\n");
       return 1;
     }
-    if (in_foli) {
-      if (mute < 2) fprintf(stderr, "%s", "Unclosed foliation comment\n");
+    if (c->in_foli) {
+      if (c->mute < 2) fprintf(c->ferr, "%s", "Unclosed foliation comment\n");
       return 1;
     }
-    if (ind_alto > ind_altc) {
-      if (mute < 2) fprintf(stderr, "%s", "Unclosed alternate reading\n");
+    if (c->ind_alto > c->ind_altc) {
+      if (c->mute < 2) fprintf(c->ferr, "%s", "Unclosed alternate reading\n");
       return 1;
     }
-    if (ind_ligo > ind_ligc) {
-      if (mute < 2) fprintf(stderr, "%s", "Unclosed ligature\n");
+    if (c->ind_ligo > c->ind_ligc) {
+      if (c->mute < 2) fprintf(c->ferr, "%s", "Unclosed ligature\n");
       return 1;
     }
     
     /* Set pgvar[0] if a new locus was read */
     /* May not be needed anymore */
-    if (hasfoli && (newpage == 0)) {
-      pgvar[0] = loc2[0];
+    if (c->hasfoli && (c->newpage == 0)) {
+      c->pgvar[0] = c->loc2[0];
     }
   }
 
   /* No transliterated text on page header, only needed if foliation removed */
-  if (newpage && (kfoli == 1)) hastrtxt = 0;
+  if (c->newpage && (c->kfoli == 1)) c->hastrtxt = 0;
 
   return 0;
 }
 
 /*-----------------------------------------------------------*/
 
-int ProcRead(char *buf)
+int ProcRead(IVTT *c,char *buf)
 /* Process uncertain readings and/or ligature capitalisation rule.
    Read and write to same buffer
    Return 0 if all OK, -1 if line to be deleted,
    1 if error */
+
+/* Each loop copies the line to a work buffer one character at
+   a time. When a bracket group or word is complete, it is at the
+   end of what was copied, so it can be rewritten there and the
+   copy simply continues after the result. This replaces shifting
+   the rest of the line for every group */
    
 /*char *buf;*/
 {
-  int index, ii, ret=0, locq;
+  int index, isrc, ii, ret=0, locq;
 
   char cb;
+  char *work = c->work;
 
   /* Check if anything needs to be done at all */
-  if (brack == 0 && unr == 0 && liga < 3) return ret;
+  if (c->brack == 0 && c->unr == 0 && c->liga < 3) return ret;
 
   /* If it is empty, nothing either */
-  if (hastrtxt == 0) return ret;
+  if (c->hastrtxt == 0) return ret;
 
   /* If it is a hash line , nothing either */
-  if (comlin != 0) return ret;
+  if (c->comlin != 0) return ret;
 
   /* First loop over line takes care of ligature
-     matters and the [] brackets */
+     matters and the [] brackets. Skip it if there are none */
   /* Initialise a few things */
-  trackinit(); index = 0;
+  trackinit(c);
+  if (strpbrk(buf, (c->liga == 4) ? "[]{}h" : "[]{}") != NULL) {
+    c->spok = 0;
+    index = 0;
 
-  while (cb = buf[index]) {
+    for (isrc = 0; (cb = buf[isrc]); isrc++) {
+      work[index] = cb;
 
-    /* Track the text */
-    TrackLight(cb, index);
+      /* Track the text */
+      TrackLight(c, cb, index);
     
-    /* If extended capitalisation is used and the character is h */
-    if (liga == 4 && cb == 'h' && index > 0) {
-      /* Only if not inside {..} and not inside <! ..> */
-      if (in_comm == 0 && ind_ligo <0) {
-        switch (buf[index-1]) {
-          case 's':
-          case 't':
-          case 'k':
-          case 'p': 
-          case 'f':
-            buf[index-1] = toupper(buf[index-1]);
+      /* If extended capitalisation is used and the character is h */
+      if (c->liga == 4 && cb == 'h' && index > 0) {
+        /* Only if not inside {..} and not inside <! ..> */
+        if (c->in_comm == 0 && c->ind_ligo <0) {
+          switch (work[index-1]) {
+            case 's':
+            case 't':
+            case 'k':
+            case 'p': 
+            case 'f':
+              work[index-1] = toupper(work[index-1]);
+          }
         }
       }
-    }
      
-    /* If a complete set of liga parens found: */
-    if (ind_ligc >= 0) {
-      if (liga >= 3) {
-
-        /* Capitalise all but last char */
-        index = ind_ligc - 2;
-        for (ii=ind_ligo; ii<index; ii++) {
-          buf[ii] = toupper(buf[ii+1]);
+      /* If a complete set of liga parens found: */
+      if (c->ind_ligc >= 0) {
+        if (c->liga >= 3) {
+
+          /* Capitalise all but last char */
+          index = c->ind_ligc - 2;
+          for (ii=c->ind_ligo; ii<index; ii++) {
+            if (ii >= 0) work[ii] = toupper(work[ii+1]);
+          }
+          if (index >= 0) {
+            work[index] = work[index+1];
+            /* If it ends with a quote, un-capitalise the one before */
+            if (work[index] == '\'' && index > 0) work[index-1] = tolower(work[index-1]);
+          }
+          /* The two characters after index are dropped */
         }
-        buf[index] = buf[index+1];
-        /* If it ends with a quote, un-capitalise the one before */
-        if (buf[index] == '\'') buf[index-1] = tolower(buf[index-1]);
 
-        /* Shift left remainder of line */
-        shiftl(buf, index, 2);
+        /* reset pointers */
+        c->ind_ligo = -1; c->ind_ligc = -1;
       }
 
-      /* reset pointers */
-      ind_ligo = -1; ind_ligc = -1;
-    }
-
-    /* If a complete set of alt.read brackets found: */
-    if (ind_altc >= 0) {
-      if (brack == 1) {
+      /* If a complete set of alt.read brackets found: */
+      if (c->ind_altc >= 0) {
+        if (c->brack == 1) {
 
-        /* Process into best guess: */
-        index = ind_altb - 2;
-        for (ii=ind_alto; ii<=index; ii++) {
-          buf[ii] = buf[ii+1];
-        }
+          /* Process into best guess. Without separator take the
+             first character, as PrepLine assumes in its warning */
+          if (c->ind_altb < 0) c->ind_altb = c->ind_alto + 2;
+          index = c->ind_altb - 2;
+          for (ii=c->ind_alto; ii<=index; ii++) {
+            work[ii] = work[ii+1];
+          }
 
-      } else if (brack == 2) {
+        } else if (c->brack == 2) {
 
-        /* Process into unreadable or
-           prepare for processing into ??? */
-        if (unr == 0) {
-          index = ind_alto;
-        } else if (unr == 1) {
-          index = ind_altc;
+          /* Process into unreadable or
+             prepare for processing into ??? */
+          if (c->unr == 0) {
+            index = c->ind_alto;
+          } else if (c->unr == 1) {
+            index = c->ind_altc;
+          }
+          work[index] = '?'; 
         }
-        buf[index] = '?'; 
-      }
-
-      /* Shift left remainder of line if needed */
-      if (index < ind_altc) {
-        shiftl(buf, index, ind_altc-index);
-      }
+        /* Anything copied after index is dropped */
       
-      /* reset pointers */
-      ind_alto= -1; ind_altb= 0; ind_altc= -1;
+        /* reset pointers */
+        c->ind_alto= -1; c->ind_altb= 0; c->ind_altc= -1;
+      }
+      index += 1;
     }
-    index += 1;
+    work[index] = 0;
+    memcpy(buf, work, index+1);
   }
   
   /* If necessary, second loop over line takes care
      of uncertain word readings */
   locq= -1; 
-  if (unr == 0) return ret;
+  if (c->unr == 0 || strchr(buf, '?') == NULL) {
+    if (c->spok == 0) Tokenize(c, buf);
+    return ret;
+  }
   
   /* Initialise tracker */
-  trackinit(); index = 0;
+  trackinit(c); index = 0;
   /* fprintf(stderr,"%s\n",buf); */
-  while (cb = buf[index]) {
+  for (isrc = 0; (cb = buf[isrc]); isrc++) {
+    work[index] = cb;
 
     /* Track the text */
-    TrackLight(cb, index);
+    TrackLight(c, cb, index);
 
     /* Look for unreadable */
     if (cb == '?') locq = index; 
 
-    if (word1 >= 0) {
+    if (c->word1 >= 0) {
       /* A complete word was read: check ? */
+      /* The word is followed by the delimiter just copied */
       /* fprintf(stderr,"word from %d to %d\n",word0,word1); */
       if (locq >= 0) {
         /* fprintf(stderr,"q:  %d\n",locq); */
-        if (unr == 1) {
-          /* Action: change word into ??? */
-          index = word0;
-          buf[index] = '?';
-          if (word1 > index) {
-            word0 += 1; index = word0; buf[index] = '?';
+        if (c->unr == 1) {
+          /* Action: change word into ??? (at most 3) */
+          index = c->word0;
+          work[index] = '?';
+          while (index < c->word1 && index < c->word0 + 2) {
+            index += 1; work[index] = '?';
           }
-          if (word1 > index) {
-            word0 += 1; index = word0; buf[index] = '?';
-          }
-          /* Shift left remainder of line */
-          if (word1 > word0) {
-            shiftl(buf, index, word1-word0);
-          }
-          index += 1; word0 = -1; word1 = -1;
+          index += 1; work[index] = cb;
         
-        } else  if (unr == 2) {
+        } else  if (c->unr == 2) {
           
           /* Action: drop this word */
-          index = word0 - 1;
-          shiftl(buf, index, word1 - word0 + 1);
-          index += 1; word0 = -1; word1 = -1;
+          index = c->word0;
+          work[index] = cb;
         
-        } else  if (unr == 3) {
+        } else  if (c->unr == 3) {
           
           /* Action: drop this line. */  
           return -1;    
         }  
-        /* fprintf(stderr,"%s\n\n",buf); */
+        c->word0 = -1; c->word1 = -1;
         /* Reset pointers */
         locq = -1;  
       }        
@@ -1740,12 +2296,15 @@ int ProcRead(char *buf)
     }
     index += 1;
   }
+  work[index] = 0;
+  memcpy(buf, work, index+1);
+  Tokenize(c, buf);
   return 0;
 }
 
 /*-----------------------------------------------------------*/
 
-int ProcSpaces(char *buf1,char *buf2)
+int ProcSpaces(IVTT *c,char *buf1,char *buf2)
 /* Process spaces in buffer. This treats occurrences of
    comma and dot (but not % !) in input text, but also
    dedicated comments related to drawing intrusions and end
@@ -1754,26 +2313,49 @@ int ProcSpaces(char *buf1,char *buf2)
    Return 0 if all OK, 1 if error */
 /*char *buf1, *buf2;*/
 {
-  int indin=0, indout=0, eol=0;
-  int addchar;
-  char cb, cbo;
+  int indin=0, indout=0, eol=0, isp=0, nsp, lenin=0;
+  int addchar, spmask = 0;
+  char cb;
 
   /* Some standard 'track' initialisations per line */
-  trackinit();
+  trackinit(c);
 
   /* If no text, do little */
-  if (hastrtxt == 0) {
-    buf2[0] = 0;
+  if (c->hastrtxt == 0) {
+    buf2[0] = 0; c->nspan = 0;
     return 0;
   }
 
+  /* Dots and commas only stop a copied run if they are changed */
+  if (c->spok) {
+    lenin = strlen(buf1);
+    spmask = (c->s_hard == 0 && c->s_uncn == 0) ? 0 : CC_SPACE;
+  }
+
   while (eol == 0) {
     cb = buf1[indin];
     eol = (cb == (char) 0);
 
-    if (comlin == 0) {
+    if (c->spok) {
+      /* Copy a locus or comment as it is, and move its span */
+      if (isp < c->nspan && indin == c->spbeg[isp]) {
+        nsp = c->spend[isp] - indin + 1;
+        memcpy(buf2+indout, buf1+indin, nsp);
+        c->spbeg[isp] = indout; c->spend[isp] = indout + nsp - 1;
+        indin += nsp; indout += nsp; isp += 1;
+        continue;
+      }
+      /* Copy text up to the next span or space to be changed */
+      nsp = ((isp < c->nspan) ? c->spbeg[isp] : lenin) - indin;
+      if (nsp > 0) {
+        nsp = PlainRun(c, buf1+indin, nsp, spmask);
+        memcpy(buf2+indout, buf1+indin, nsp);
+        indin += nsp; indout += nsp;
+        if (nsp > 0) continue;
+      }
+    } else if (c->comlin == 0) {
       /* Track the text */
-      TrackLight(cb, indin);
+      TrackLight(c, cb, indin);
     }
 
 /*  if (in_comm == -1) fprintf(stderr,"%s","Start of comment\n");
@@ -1785,34 +2367,421 @@ int ProcSpaces(char *buf1,char *buf2)
     addchar = 1;
 
     /* Check outside comments only */
-    if (comlin == 0 && in_comm == 0 && in_foli == 0) {
-
-      /* Check hard and uncertain spaces */
-      cbo = cb;
-      if (cb == ',') {
-        if (s_uncn == 1) cb = cbo = '.';  /* Treat same as dot space*/
-        else if (s_uncn == 2) addchar=0;  /* Convert to blank */
-        else if (s_uncn == 3) cbo = '?';  /* Convert to unreadable */
-      }
-      if (cb == '.') {
-        if (s_hard == 1) cbo = ' ';       /* Just use blank instead */
-        else if (s_hard == 2) addchar=0;  /* Convert to nothing */
-        else if (s_hard == 3) cbo = '\n';  /* Convert to line break */
+    if (c->comlin == 0 && c->in_comm == 0 && c->in_foli == 0) {
+
+      /* Check hard and uncertain spaces, as set up in SetAction */
+      if (c->ccls[(unsigned char) cb] & CC_SPACE) {
+        cb = c->spout[cb == ','];
+        if (cb == 0) addchar = 0;
       }
-      cb = cbo;
-      
+
     }
 
     while (addchar--) {
       buf2[indout++] = cb;
     }
   }
+
+  /* A comment can only move to the start if all before it
+     was removed. It would then count as locus */
+  if (c->spok && c->nspan > 0 && c->spbeg[0] == 0 && c->sptyp[0] != '<') {
+    c->spok = 0;
+  }
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+/* The binary corpus (--corpus=<file>). Every line that PutLine
+   writes is also cut into tokens, which are collected here and
+   written out by WriteCorp. The layout of the file is given in
+   ivtt.h. The uncertain tokens among them are listed by MakeUnc,
+   for the corpus and for the JSON lines of --uncert=<file> */
+
+struct ivtt_corpus {
+  char *fname;                /* Name of the corpus file, or NULL */
+  char *uname;                /* Name of the uncertainty file, or NULL */
+  unsigned int *tok;          /* Word ID of each token */
+  unsigned char *flag;        /* IVTT_F_.. bits of each token */
+  long ntok, mtok, mflag;
+  unsigned int *line, *lloc;  /* First token and locus of each line */
+  long nline, mline, mlloc;
+  unsigned int *par;          /* First line of each paragraph */
+  long npar, mpar;
+  unsigned int *lfol, *lnum;  /* Folio and number of each locus */
+  long nloc, mlfol, mlnum;
+  char (*fol)[8];             /* Folio names */
+  long nfol, mfol;
+  unsigned int *voff;         /* Start of each word in the pool */
+  long nword, mword;
+  char *pool;                 /* The words, each ending in 0 */
+  long npool, mpool;
+  unsigned int *hash;         /* Word ID+1 by hash, 0 if free */
+  long hsize;
+  char *wbuf;                 /* The token being cut */
+  long wmax;
+  int endpar;                 /* 1 if the last line ended a paragraph */
+  struct ivtt_urec *unc;      /* The uncertain tokens */
+  long nunc, munc;
+};
+
+/*-----------------------------------------------------------*/
+
+int CorpRoom(void **pmem,long *pmax,long need,long size)
+/* Make sure that a growing array of elements of size bytes
+   has room for need elements */
+/* Return 0 if all OK, 1 if out of memory */
+{
+  long n;
+
+  if (need <= *pmax) return 0;
+  n = (*pmax < 256) ? 256 : *pmax;
+  while (n < need) n *= 2;
+  if (ResizeMem(pmem, n * size)) return 1;
+  *pmax = n;
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+long CorpWord(struct ivtt_corpus *cp,char *w,int len)
+/* Find the ID of a word, adding it to the vocabulary if it is new */
+/* Return the ID, or -1 if out of memory */
+{
+  unsigned int h, *nhash;
+  unsigned int k, ulen = (unsigned int) len;
+  long i, id, nsize;
+
+  /* Keep the table at most half full */
+  if (2 * (cp->nword + 1) > cp->hsize) {
+    nsize = (cp->hsize == 0) ? 1024 : 2 * cp->hsize;
+    nhash = (unsigned int *) calloc(nsize, sizeof(unsigned int));
+    if (nhash == NULL) return -1;
+    for (id=0; id<cp->nword; id++) {
+      h = 2166136261U;
+      for (k=cp->voff[id]; k<cp->voff[id+1]-1; k++) {
+        h = (h ^ (unsigned char) cp->pool[k]) * 16777619U;
+      }
+      for (i=h & (nsize-1); nhash[i]; i=(i+1) & (nsize-1)) ;
+      nhash[i] = (unsigned int) id + 1;
+    }
+    free(cp->hash);
+    cp->hash = nhash; cp->hsize = nsize;
+  }
+
+  h = 2166136261U;
+  for (k=0; k<ulen; k++) h = (h ^ (unsigned char) w[k]) * 16777619U;
+  for (i=h & (cp->hsize-1); cp->hash[i]; i=(i+1) & (cp->hsize-1)) {
+    id = cp->hash[i] - 1;
+    if (cp->voff[id+1] - cp->voff[id] == ulen + 1 &&
+        memcmp(cp->pool + cp->voff[id], w, len) == 0) return id;
+  }
+
+  /* A new word */
+  if (CorpRoom((void **) &cp->voff, &cp->mword, cp->nword+2,
+               sizeof(unsigned int)) ||
+      CorpRoom((void **) &cp->pool, &cp->mpool, cp->npool+len+1, 1)) {
+    return -1;
+  }
+  memcpy(cp->pool + cp->npool, w, len);
+  cp->npool += len;
+  cp->pool[cp->npool++] = 0;
+  id = cp->nword++;
+  cp->voff[id] = (unsigned int) (cp->npool - len - 1);
+  cp->voff[id+1] = (unsigned int) cp->npool;
+  cp->hash[i] = (unsigned int) id + 1;
+  return id;
+}
+
+/*-----------------------------------------------------------*/
+
+int CorpLine(IVTT *c,char *buf,int len)
+/* Add one output line to the corpus. Tokens are separated by
+   blanks, dots and new lines. Loci and comments are left out,
+   and nothing inside an alternate reading separates tokens.
+   A new folio or a <%> code starts a paragraph, and so does the
+   line after a <$> code */
+/* Return 0 if all OK, 1 if out of memory */
+{
+  struct ivtt_corpus *cp = c->corp;
+  char *fol = c->folname+1;
+  int i = 0, n, k, run, inalt, newfol;
+  unsigned char fl;
+  long id;
+  char cb;
+
+  if (CorpRoom((void **) &cp->wbuf, &cp->wmax, len, 1)) return 1;
+
+  /* The folio and locus of the line */
+  newfol = (cp->nfol == 0 || strncmp(cp->fol[cp->nfol-1], fol, 7) != 0);
+  if (newfol) {
+    if (CorpRoom((void **) &cp->fol, &cp->mfol, cp->nfol+1, 8)) return 1;
+    memset(cp->fol[cp->nfol], 0, 8);
+    strncpy(cp->fol[cp->nfol], fol, 7);
+    cp->nfol += 1;
+  }
+  if (newfol || cp->lnum[cp->nloc-1] != (unsigned int) c->num) {
+    if (CorpRoom((void **) &cp->lfol, &cp->mlfol, cp->nloc+1,
+                 sizeof(unsigned int)) ||
+        CorpRoom((void **) &cp->lnum, &cp->mlnum, cp->nloc+1,
+                 sizeof(unsigned int))) return 1;
+    cp->lfol[cp->nloc] = (unsigned int) cp->nfol - 1;
+    cp->lnum[cp->nloc] = (unsigned int) c->num;
+    cp->nloc += 1;
+  }
+  if (newfol || c->nwpar || cp->endpar) {
+    if (CorpRoom((void **) &cp->par, &cp->mpar, cp->npar+1,
+                 sizeof(unsigned int))) return 1;
+    cp->par[cp->npar++] = (unsigned int) cp->nline;
+  }
+  if (CorpRoom((void **) &cp->line, &cp->mline, cp->nline+1,
+               sizeof(unsigned int)) ||
+      CorpRoom((void **) &cp->lloc, &cp->mlloc, cp->nline+1,
+               sizeof(unsigned int))) return 1;
+  cp->line[cp->nline] = (unsigned int) cp->ntok;
+  cp->lloc[cp->nline] = (unsigned int) cp->nloc - 1;
+  cp->nline += 1;
+  cp->endpar = c->endpar;
+
+  /* The tokens */
+  while (i < len) {
+    n = 0; fl = 0; inalt = 0;
+    while (i < len) {
+      cb = buf[i];
+      if (cb == '<') {
+        /* Skip the locus or comment */
+        while (i < len && buf[i] != '>') i += 1;
+        i += 1;
+        continue;
+      }
+      if (inalt == 0 && (cb == ' ' || cb == '.' || cb == '\t' ||
+                         cb == '\n' || cb == '\r')) break;
+      if (cb == '[') {
+        inalt = 1; fl |= IVTT_F_ALT;
+      } else if (cb == ']') {
+        inalt = 0;
+      } else if (cb == ',') {
+        fl |= IVTT_F_SPACE;
+      } else if (cb == '{' || cb == '}') {
+        fl |= IVTT_F_LIGA;
+      } else if (cb == '@' || (cb & 0x80)) {
+        fl |= IVTT_F_HIGH;
+      }
+      cp->wbuf[n++] = cb;
+      i += 1;
+    }
+    i += 1;
+    if (n == 0) continue;
+
+    /* Runs of ? */
+    for (k=0; k<n; k+=run) {
+      for (run=0; k+run<n && cp->wbuf[k+run] == '?'; run++) ;
+      if (run == 1) fl |= IVTT_F_SINGLE;
+      else if (run > 1) fl |= IVTT_F_SEQ;
+      else run = 1;
+    }
+
+    if ((id = CorpWord(cp, cp->wbuf, n)) < 0) return 1;
+    if (CorpRoom((void **) &cp->tok, &cp->mtok, cp->ntok+1,
+                 sizeof(unsigned int)) ||
+        CorpRoom((void **) &cp->flag, &cp->mflag, cp->ntok+1, 1)) return 1;
+    cp->tok[cp->ntok] = (unsigned int) id;
+    cp->flag[cp->ntok] = fl;
+    cp->ntok += 1;
+  }
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int MakeUnc(struct ivtt_corpus *cp)
+/* List the uncertain tokens of the corpus, with their line,
+   paragraph and locus */
+/* Return 0 if all OK, 1 if out of memory */
+{
+  struct ivtt_urec *pu;
+  long il, ip = 0, it, lend, pend;
+  char *w;
+  int run, k;
+
+  for (il=0; il<cp->nline; il++) {
+    /* Paragraphs start at a line */
+    while (ip+1 < cp->npar && cp->par[ip+1] <= il) ip += 1;
+    lend = (il+1 < cp->nline) ? cp->line[il+1] : cp->ntok;
+    pend = (ip+1 < cp->npar) ? cp->line[cp->par[ip+1]] : cp->ntok;
+    for (it=cp->line[il]; it<lend; it++) {
+      if ((cp->flag[it] & IVTT_F_UNC) == 0) continue;
+      if (CorpRoom((void **) &cp->unc, &cp->munc, cp->nunc+1,
+                   sizeof(struct ivtt_urec))) return 1;
+      pu = cp->unc + cp->nunc++;
+      memset(pu, 0, sizeof(*pu));
+      pu->tok = (unsigned int) it;
+      pu->word = cp->tok[it];
+      pu->lbeg = cp->line[il]; pu->lend = (unsigned int) lend;
+      pu->pbeg = cp->line[cp->par[ip]]; pu->pend = (unsigned int) pend;
+      pu->locus = cp->lloc[il];
+      pu->flag = cp->flag[it];
+      w = cp->pool + cp->voff[pu->word];
+      for (k=0; w[k]; k+=run) {
+        for (run=0; w[k+run] == '?'; run++) ;
+        if (run > pu->qrun) pu->qrun = (unsigned char) (run < 255 ? run : 255);
+        if (run == 0) run = 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+void JsonText(FILE *fu,char *txt)
+/* Write a string as the contents of a JSON string. Bytes above 127
+   are taken as Latin-1 */
+{
+  unsigned char cb;
+
+  for ( ; (cb = (unsigned char) *txt); txt++) {
+    if (cb == '"' || cb == '\\') {
+      fputc('\\', fu); fputc(cb, fu);
+    } else if (cb < 32 || cb > 126) {
+      fprintf(fu, "\\u%04x", cb);
+    } else {
+      fputc(cb, fu);
+    }
+  }
+}
+
+/*-----------------------------------------------------------*/
+
+int WriteUnc(IVTT *c)
+/* Write one JSON line for each uncertain token. The types are
+   named as in uncertainties.py, and the context is given as token
+   positions in the corpus */
+/* Return 0 if all OK, 1 if the file could not be written */
+{
+  struct ivtt_corpus *cp = c->corp;
+  struct ivtt_urec *pu;
+  FILE *fu;
+  long iu;
+  int nt;
+
+  if ((fu = fopen(cp->uname, "w")) == NULL) return 1;
+  for (iu=0; iu<cp->nunc; iu++) {
+    pu = cp->unc + iu;
+    fputs("{\"word\": \"", fu);
+    JsonText(fu, cp->pool + cp->voff[pu->word]);
+    fputs("\", \"types\": [", fu);
+    nt = 0;
+    if (pu->qrun >= 1) fprintf(fu, "%s\"SINGLE_UNCERTAINTY\"", nt++ ? ", " : "");
+    if (pu->qrun >= 2) fprintf(fu, "%s\"DOUBLE_UNCERTAINTY\"", nt++ ? ", " : "");
+    if (pu->qrun >= 3) fprintf(fu, "%s\"UNCERTAIN_SEQUENCE\"", nt++ ? ", " : "");
+    if (pu->flag & IVTT_F_SPACE) fprintf(fu, "%s\"UNCERTAIN_SPACE\"", nt++ ? ", " : "");
+    if (pu->flag & IVTT_F_ALT) fprintf(fu, "%s\"ALTERNATE_READING\"", nt++ ? ", " : "");
+    fprintf(fu, "], \"token\": %u, \"left\": [%u, %u], \"right\": [%u, %u], ",
+            pu->tok, pu->lbeg, pu->tok, pu->tok+1, pu->lend);
+    fprintf(fu, "\"paragraph\": [%u, %u], \"locus\": %u, \"name\": \"",
+            pu->pbeg, pu->pend, pu->locus);
+    JsonText(fu, cp->fol[cp->lfol[pu->locus]]);
+    fprintf(fu, ".%u\"}\n", cp->lnum[pu->locus]);
+  }
+  if (fclose(fu) != 0) return 1;
+
+  if (c->mute == 0) {
+    fprintf (c->ferr, "%7ld uncertain words written to %s\n", cp->nunc, cp->uname);
+  }
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int CorpSection(FILE *fc,long *pos,unsigned int *off,void *data,long len,
+                unsigned int last,int haslast)
+/* Write one section of the corpus at the next multiple of 8 bytes,
+   optionally followed by one more number */
+/* Return 0 if all OK, 1 if the write failed */
+{
+  static char zero[8];
+  int pad;
+
+  pad = (int) ((8 - *pos % 8) % 8);
+  if (pad > 0 && fwrite(zero, 1, pad, fc) != (size_t) pad) return 1;
+  *pos += pad;
+  *off = (unsigned int) *pos;
+  if (len > 0 && fwrite(data, 1, len, fc) != (size_t) len) return 1;
+  *pos += len;
+  if (haslast) {
+    if (fwrite(&last, sizeof(last), 1, fc) != 1) return 1;
+    *pos += sizeof(last);
+  }
   return 0;
 }
 
 /*-----------------------------------------------------------*/
 
-int PutLine(char *buf)
+int WriteCorp(IVTT *c)
+/* Write the collected corpus to its file. The header is written
+   last, once the offsets of all sections are known */
+/* Return 0 if all OK, 1 if the file could not be written */
+{
+  struct ivtt_corpus *cp = c->corp;
+  struct ivtt_corphead hd;
+  FILE *fc;
+  long pos;
+  unsigned int u = sizeof(unsigned int);
+  int err;
+
+  memset(&hd, 0, sizeof(hd));
+  memcpy(hd.magic, IVTT_CORPUS, 8);
+  hd.version = 1; hd.endian = 0x01020304;
+  hd.ntok = cp->ntok; hd.nline = cp->nline; hd.npar = cp->npar;
+  hd.nlocus = cp->nloc; hd.nfolio = cp->nfol;
+  hd.nword = cp->nword; hd.npool = cp->npool; hd.nunc = cp->nunc;
+
+  if ((fc = fopen(cp->fname, "wb")) == NULL) return 1;
+  pos = sizeof(hd);
+  err = fseek(fc, pos, SEEK_SET) != 0 ||
+    CorpSection(fc, &pos, &hd.off[IVTT_C_TOK], cp->tok, cp->ntok*u, 0, 0) ||
+    CorpSection(fc, &pos, &hd.off[IVTT_C_FLAG], cp->flag, cp->ntok, 0, 0) ||
+    CorpSection(fc, &pos, &hd.off[IVTT_C_LINE], cp->line, cp->nline*u,
+                (unsigned int) cp->ntok, 1) ||
+    CorpSection(fc, &pos, &hd.off[IVTT_C_LLOC], cp->lloc, cp->nline*u, 0, 0) ||
+    CorpSection(fc, &pos, &hd.off[IVTT_C_PAR], cp->par, cp->npar*u,
+                (unsigned int) cp->nline, 1) ||
+    CorpSection(fc, &pos, &hd.off[IVTT_C_LFOL], cp->lfol, cp->nloc*u, 0, 0) ||
+    CorpSection(fc, &pos, &hd.off[IVTT_C_LNUM], cp->lnum, cp->nloc*u, 0, 0) ||
+    CorpSection(fc, &pos, &hd.off[IVTT_C_FOL], cp->fol, cp->nfol*8, 0, 0) ||
+    CorpSection(fc, &pos, &hd.off[IVTT_C_VOFF], cp->voff, cp->nword*u,
+                (unsigned int) cp->npool, 1) ||
+    CorpSection(fc, &pos, &hd.off[IVTT_C_POOL], cp->pool, cp->npool, 0, 0) ||
+    CorpSection(fc, &pos, &hd.off[IVTT_C_UNC], cp->unc,
+                cp->nunc * (long) sizeof(struct ivtt_urec), 0, 0) ||
+    fseek(fc, 0L, SEEK_SET) != 0 ||
+    fwrite(&hd, sizeof(hd), 1, fc) != 1;
+  if (fclose(fc) != 0) err = 1;
+
+  if (err == 0 && c->mute == 0) {
+    fprintf (c->ferr, "%7ld tokens of %ld words written to the corpus\n",
+             cp->ntok, cp->nword);
+  }
+  return err;
+}
+
+/*-----------------------------------------------------------*/
+
+void FreeCorp(struct ivtt_corpus *cp)
+/* Release the corpus collected by a context */
+{
+  if (cp == NULL) return;
+  free(cp->tok); free(cp->flag); free(cp->line); free(cp->lloc);
+  free(cp->par); free(cp->lfol); free(cp->lnum); free(cp->fol);
+  free(cp->voff); free(cp->pool); free(cp->hash); free(cp->wbuf);
+  free(cp->unc);
+  free(cp);
+}
+
+/*-----------------------------------------------------------*/
+
+int PutLine(IVTT *c,char *buf)
 /* Write buffer to output, optionally skipping foliation info,
    all types of comments and a few other things.
    If foliation is suppressed, blank spaces before transliterated text
@@ -1823,76 +2792,136 @@ int PutLine(char *buf)
 
 /*char *buf;*/
 {
-  int index=0, indout=0, eol=0, output, ii;
+  int index=0, indout=0, eol=0, output;
   int leftjust;
   int authch = 0;
+  int isp = 0, infoli, inloc, incomm, nrun;
   char cb;
-  char cbo;
-  char wrapbuf[MAXLEN];
+  char cbo, act;
+  char *pb;
+  char *wrapbuf = c->wrapbuf;
 
   leftjust = 0;
 
   /* check if this is a hash comment line, but not the file header */
-  if (comlin != 0 && filehead != 2) {
+  if (c->comlin != 0 && c->filehead != 2) {
     /*  Print immediately or exit  */
-    if (kcomh == 1) {
-      nlhash +=1;
+    if (c->kcomh == 1) {
+      c->nlhash +=1;
     } else {
       /* do not output if there is a pending header */
-      if (pend_hd) {
-        nlhash += 1;
+      if (c->pend_hd) {
+        c->nlhash += 1;
       } else {
-        OutString(buf);
+        OutString(c, buf);
       }
     }
     return 0;
   }
 
   /* Separate test for file header */
-  if (filehead) {
+  if (c->filehead) {
     /*  Print immediately or exit  */
-    if (kfoli == 1) {
-      nldrop +=1;
+    if (c->kfoli == 1) {
+      c->nldrop +=1;
     } else {
-      OutString(buf);
+      OutString(c, buf);
     }
     return 0;
   }
 
   /* If the line is empty, only print if whitespace kept */
-  if (white == 1 && hastrtxt == 0) {
-    nlempt +=1 ; return 0;
+  if (c->white == 1 && c->hastrtxt == 0) {
+    c->nlempt +=1 ; return 0;
   }
      
   /* For 'wrong author': same thing */
-  if (auth != ' ') {
-    if (lineauth != ' ' && lineauth != auth) {
-      nldrop += 1; return 0;
+  if (c->auth != ' ') {
+    if (c->lineauth != ' ' && c->lineauth != c->auth) {
+      c->nldrop += 1; return 0;
     }
   }
 
   /* Now print any pending page header */
-  if (pend_hd) {
+  if (c->pend_hd) {
     /* fprintf(stderr, "%s\n", "Pending header output (if allowed)"); */
-    pend_hd = 0;
+    c->pend_hd = 0;
     /* Really output only if foliation is not suppressed */
-    if (kfoli == 0) {
-      OutString(pgh);
-      nldrop -= 1;
+    if (c->kfoli == 0) {
+      OutString(c, c->pgh);
+      c->nldrop -= 1;
     }
   }
 
   /* The usual initialisation for 'track' */
-  trackinit();
+  trackinit(c);
 
   while (cb = buf[index]) {
-    TrackLight(cb, index);
+    if (c->spok) {
+      /* Whole spans and the text between them are handled at once.
+         Each span starts with <, which ends skipping blanks */
+      if (isp < c->nspan && c->spbeg[isp] == index) {
+        nrun = c->spend[isp] - index + 1;
+        leftjust = 0;
+        if (c->sptyp[isp] == '<') {
+          /* The locus */
+          if (c->kfoli == 1) {
+            leftjust = 1;
+          } else if (c->authrm &&
+                     (pb = memchr(buf+index+1, ';', nrun-2)) != NULL) {
+            /* Drop the transliterator ID, from ; up to the > */
+            memcpy(wrapbuf+indout, buf+index, pb-buf-index);
+            indout += pb-buf-index;
+            wrapbuf[indout++] = '>';
+          } else {
+            memcpy(wrapbuf+indout, buf+index, nrun);
+            indout += nrun;
+          }
+        } else {
+          /* A comment, see SetAction */
+          c->comchr = c->sptyp[isp];
+          act = c->spact[c->newpage != 0][(unsigned char) c->comchr];
+          if (act == SA_KEEP) {
+            memcpy(wrapbuf+indout, buf+index, nrun);
+            indout += nrun;
+          } else if (act != SA_DROP) {
+            wrapbuf[indout++] = act;
+          }
+        }
+        index += nrun; isp += 1;
+        continue;
+      }
+      /* Text outside the spans is written as it is, once blanks
+         after a removed locus have been skipped */
+      if (leftjust > 0) {
+        if (cb == ' ' || cb == '\t') {
+          index += 1;
+          continue;
+        }
+        leftjust = 0;
+      }
+      nrun = (isp < c->nspan) ? c->spbeg[isp] - index :
+             (int) strlen(buf+index);
+      memcpy(wrapbuf+indout, buf+index, nrun);
+      index += nrun; indout += nrun;
+      continue;
+    } else {
+      TrackLight(c, cb, index);
+      /* Need to decode the type of comment by looking ahead */
+      if (c->in_comm == -1) c->comchr = buf[index+1];
+      infoli = (c->in_foli != 0);
+      inloc = (c->in_foli > 0);
+      incomm = (c->in_comm != 0);
+    }
+
+    /* Lines that could not be split into spans (see Tokenize)
+       go through all the options for every character */
     cbo = cb;
     output = 1;
 
     /* Check suppression of foliation comments */
-    if (kfoli == 1) {
-      if (in_foli != 0) {
+    if (c->kfoli == 1) {
+      if (infoli) {
         output = 0;
         if (cb == '>') leftjust = 2; /* triggered at the end */
       }
@@ -1907,48 +2936,45 @@ int PutLine(char *buf)
     }
 
     /* Check suppresion of transliterator ID */
-    if (authrm && in_foli > 0) {
+    if (c->authrm && inloc) {
       if (cb == ';') authch = 1;  /* stays set until close caret */
       if (authch == 1) output = 0;
     }
 
     /* Check all types of inline comments. */
-    /* Need to decode the type by looking ahead */
-    if (in_comm == -1) comchr = buf[index+1];
-
-    if (kcomi > 0 && in_comm != 0) {
+    if (c->kcomi > 0 && incomm) {
       /* separate checks for loci and page headers */
-      if (newpage) {
-        if (kcomi == 2) output = 0;
+      if (c->newpage) {
+        if (c->kcomi == 2) output = 0;
       } else {
-        if (comchr == '!' || comchr == '~' || comchr == '@') output = 0;
+        if (c->comchr == '!' || c->comchr == '~' || c->comchr == '@') output = 0;
       }
     }
 
     /* handle drawing intrusion */
-    if (in_comm && comchr == '-') {
-      if (gaps == 1) output = 0;
-      else if (gaps == 2) {
+    if (incomm && c->comchr == '-') {
+      if (c->gaps == 1) output = 0;
+      else if (c->gaps == 2) {
         if (cb == '>') cbo = '.';
         else output = 0;
       }
     }
 
     /* handle paragraph start and end codes */
-    if (in_comm && comchr == '%') {
-      if (para == 1 || para == 2) output = 0;  
+    if (incomm && c->comchr == '%') {
+      if (c->para == 1 || c->para == 2) output = 0;  
     }
-    if (in_comm && comchr == '$') {
-      if (para == 1) output = 0;  
-      else if (para == 2) {
+    if (incomm && c->comchr == '$') {
+      if (c->para == 1) output = 0;  
+      else if (c->para == 2) {
         if (cb == '>') cbo = '\n';
         else output = 0;
       }
     }
 
     /* handle text tags */
-    if (in_comm && comchr == '@') {
-      if (kfoli == 1 || kcomi == 2) output = 0;
+    if (incomm && c->comchr == '@') {
+      if (c->kfoli == 1 || c->kcomi == 2) output = 0;
     }
 
     /* Now output if required */
@@ -1960,44 +2986,27 @@ int PutLine(char *buf)
   
   /* All characters processed and added to wrapbuf */
   if (indout == 0) {
-    nlempt += 1;
+    c->nlempt += 1;
     return 0;
-  } else if (wrapbuf[0] == '\n' && white == 1) {
-    nlempt += 1;
+  } else if (wrapbuf[0] == '\n' && c->white == 1) {
+    c->nlempt += 1;
     return 0;
   } else {
     wrapbuf[indout] = 0;
   }
 
+  /* Page header lines are not part of the corpus */
+  if (c->corp != NULL && c->newpage == 0 && CorpLine(c, wrapbuf, indout)) {
+    if (c->mute < 2) fprintf(c->ferr, "%s", "Out of memory for the corpus\n");
+    return 1;
+  }
+
   /* Now write wrapbuf whole or in pieces */
-  /* Another initialisation for 'track' needed first */
-  trackinit();
-  
-  if (wrap < 2) {
-    OutString(wrapbuf);
-  } else {
-    /* First write all the parts */
-    while ((index = FindSpace(wrapbuf, wwidth)) > 0) {
-      for (ii=0; ii<=index; ii++) {
-        cb = wrapbuf[ii];
-        TrackLight(cb, index);
-        OutChar(cb);
-      }
-      OutChar('/');
-      OutChar('\n');
-      OutChar('/');
-      OutChar(' ');
-      wrapbuf[0] = ' ';
-      shiftl(wrapbuf, 0, index);
-    }
-    /* Write the last bit or handle the 'no dot found' case */
-    if (index == 0) {
-      OutString(wrapbuf);
-    }
-    if (index < 0) {
-      if (mute < 2) fprintf(stderr, "%s", "No space found for line wrapping\n");
-      return 1;
-    }
+  if (c->wrap < 2) {
+    OutString(c, wrapbuf);
+  } else if (OutWrap(c, wrapbuf, c->wwidth) < 0) {
+    if (c->mute < 2) fprintf(c->ferr, "%s", "No space found for line wrapping\n");
+    return 1;
   }
 
   return 0;
@@ -2005,175 +3014,1718 @@ int PutLine(char *buf)
 
 /*-----------------------------------------------------------*/
 
-int main(int argc,char *argv[])
-/*int argc;
-char *argv[];*/
+int StartLine(IVTT *c,char *orig,int lorig)
+/* Preprocess one line that was read by GetLine into c->buf1 */
+/* Return 0 if all OK, else the exit code for the error */
 {
-  char orig[MAXLEN], buf1[MAXLEN], buf2[MAXLEN];
-  int igetl = 0, iprepl = 0, iproc = 0, iout = 0;
-  int selpage, selloc;
-  int erropt;
+  int iprepl = 0;
+  char *buf1 = c->buf1;
 
-  /* For reference: */
-  char *what = "@(#)ivtt\t\t1.1\t2020/04/10 RZ\n";
+  /* here a new line was read successfully */
 
-  /* Parse command line options */
-  /* Do this first, in order to get the "mute" option first */
-  erropt = ParseOpts(argc, argv);
-  if (mute == 0) {
-    fprintf (stderr,"Intermediate Voynich Transliteration Tool (v 1.1)\n\n");
+  c->nlread += 1; c->nlpart += 1;
+  /* fprintf (stderr, "%2d %s\n", nlread, orig); */
+    
+  /* Preprocess line */
+  /* This also keeps track of foliation and comments, and warns
+     about unclosed brackets */
+  c->cwarn = ' ';
+  iprepl = PrepLine(c, orig, lorig, buf1);
+  /* fprintf (stderr, "Line: %s\n", orig);  */
+  /* fprintf (stderr, "Out : %s\n", buf1);  */
+  if (iprepl != 0) {
+    if (c->mute < 2) {
+      fprintf (c->ferr, "%s\n", "Error preprocessing line");
+      fprintf (c->ferr, "Line: %.*s\n", lorig, orig);
+    }
+    return 5;
   }
-
-  if (erropt) {
-    if (mute < 2) fprintf (stderr, "%s\n", "Error parsing command line");
-    return 8;
+  if (c->cwarn != ' ') {
+    if (c->mute == 0) {
+      fprintf (c->ferr, "%c %s\n", c->cwarn, "warning for line:");
+      fprintf (c->ferr, "%.*s\n", lorig, orig);
+    }
+    c->cwarn = ' ';
   }
+  return 0;
+}
 
-  /* List summary of options and open files as needed */  
-  if (DumpOpts(argc, argv)) {
-    if (mute < 2) fprintf (stderr, "%s\n", "Error opening file(s)");
-    return 2;
-  }  
-  if (mute == 0) fprintf (stderr, "\n%s\n", "Starting...");
+/*-----------------------------------------------------------*/
 
-  clearvar();
+int EndLine(IVTT *c,char *buf1,char *orig,int lorig)
+/* Process one preprocessed line in buf1 up to output */
+/* Return 0 if all OK, else the exit code for the error */
+{
+  int iproc = 0;
+  char *buf2 = c->buf2;
+
+  /* Check page variables when new page read */
+  if (c->newpage == 1) {
+    c->pend_hd = 0;
+    c->selpage = usepgloc(c, 1);
+    if (c->nlcopt || c->hastag) {
+      c->selloc = 0;
+      c->pend_hd = 1;
+      /* fprintf(stderr, "%s\n", "Pending header saved:");
+      fprintf(stderr, "%s\n", buf1);            */
+      (void) strcpy(c->pgh, buf1);
+    } else {
+      c->selloc = 1;
+    }
+    /*
+      fprintf (stderr,"Variables on this new folio:\n");
+      (void) showvar();
+      fprintf (stderr,"Select page: %d\n",selpage);
+    */
+  }
 
-  /* The initial value of selpage (i.e. before the first 'new folio')
-     depends on whether page selection options were specified */
-  if (npgopt == 0) {
-    selpage = 1;
-  } else {
-    selpage = 0;
+  /* Check page variables, text tags and locus types for all
+     transliteration items */
+  if (c->newpage == 0) {
+    c->selpage = 1;
+    c->selloc = usepgloc(c, 0);
   }
   
-  /* Main loop through input file */
-
-  while (igetl == 0) {
+  /* Only continue if page and locus pass the criteria */
+  if ((c->selpage == 0) || (c->selloc == 0)) {
+    c->nldrop += 1;
+    return 0;
+  }
 
-    /* Read one line to buffer. 
-       This concatenates lines if required but nothing more */
+  /* Process spaces */
+  Tokenize(c, buf1);
+  if (ProcSpaces(c, buf1, buf2) != 0) {
+    if (c->mute < 2) {
+      fprintf (c->ferr, "%s", "Error processing spaces\n");
+      fprintf (c->ferr, "Line: %.*s\n", lorig, orig);
+    }
+    return 6;
+  }
 
-    igetl = GetLine(orig);
-    if (igetl < 0) {  /* Normal EOF */
+  /* Process uncertain readings */
 
-      /* Print statistics */
-      if (mute == 0) {
-        if (wrap == 0) {
-          fprintf (stderr, "\n%7d lines read in\n", nlread);
-        } else {
-          fprintf (stderr, "\n%7d lines read in\n", nlpart);
-          fprintf (stderr, "%7d lines after unwrapping\n", nlread);
-        }
-        fprintf (stderr, "%7d lines de-selected\n", nldrop);
-        fprintf (stderr, "%7d hash comment lines suppressed\n", nlhash);
-        fprintf (stderr, "%7d empty lines suppressed\n", nlempt);
-        fprintf (stderr, "%7d lines written to output\n", nlwrit);
-        if (wrap > 1) {
-          fprintf (stderr, "%7d lines after wrapping\n", nlwrap);
-        }
-      }
-      return 3;
-    }
-    else if (igetl > 0) {
-      if (mute < 2) fprintf (stderr, "%s\n", "Error reading line from stdin");
-      return 4;
+  iproc = ProcRead(c, buf2);
+  if (iproc > 0) {
+    if (c->mute < 2) {
+      fprintf (c->ferr, "%s\n", "Error processing uncertain readings");
+      fprintf (c->ferr, "Line: %.*s\n", lorig, orig);
     }
+    return 7;
+  }
 
-    /* here a new line was read successfully */
+  /* Further processing and output are skipped if
+     locus was not selected */
+  if (iproc < 0) {
+    c->nldrop += 1;
+    return 0;
+  }
+      
+  /* Write line to stdout. Here the optional comment and/or
+     foliation removal and/or author selection is handled, 
+     as well as any re-wrapping. */
 
-    nlread += 1; nlpart += 1;
-    /* fprintf (stderr, "%2d %s\n", nlread, orig); */
-    
-    /* Preprocess line */
-    /* This also keeps track of foliation and comments, and warns
-       about unclosed brackets */
-    cwarn = ' ';
-    iprepl = PrepLine(orig, buf1);
-    /* fprintf (stderr, "Line: %s\n", orig);  */
-    /* fprintf (stderr, "Out : %s\n", buf1);  */
-    if (iprepl != 0) {
-      if (mute < 2) {
-        fprintf (stderr, "%s\n", "Error preprocessing line");
-        fprintf (stderr, "Line: %s\n", orig);
-      }
-      return 5;
+  if (PutLine(c, buf2) != 0) {
+    if (c->mute < 2) fprintf (c->ferr, "Line: %.*s\n", lorig, orig);
+    return 9;
+  }
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int DoLine(IVTT *c,char *orig,int lorig)
+/* Process one line that was read by GetLine, from preprocessing
+   up to output */
+/* Return 0 if all OK, else the exit code for the error */
+{
+  int iret;
+
+  iret = StartLine(c, orig, lorig);
+  if (iret != 0) return iret;
+  return EndLine(c, c->buf1, orig, lorig);
+}
+
+/*-----------------------------------------------------------*/
+
+void PrintStats(IVTT *c)
+/* Print statistics at the end of the run */
+{
+  if (c->mute == 0) {
+    if (c->wrap == 0) {
+      fprintf (c->ferr, "\n%7d lines read in\n", c->nlread);
+    } else {
+      fprintf (c->ferr, "\n%7d lines read in\n", c->nlpart);
+      fprintf (c->ferr, "%7d lines after unwrapping\n", c->nlread);
     }
-    if (cwarn != ' ') {
-      if (mute == 0) {
-        fprintf (stderr, "%c %s\n", cwarn, "warning for line:");
-        fprintf (stderr, "%s\n", orig);
-      }
-      cwarn = ' ';
-    }
-
-    /* Check page variables when new page read */
-    if (newpage == 1) {
-      pend_hd = 0;
-      selpage = usepgloc(1);
-      if (nlcopt || hastag) {
-        selloc = 0;
-        pend_hd = 1;
-        /* fprintf(stderr, "%s\n", "Pending header saved:");
-        fprintf(stderr, "%s\n", buf1);            */
-        (void) strcpy(pgh, buf1);
-      } else {
-        selloc = 1;
-      }
-      /*
-        fprintf (stderr,"Variables on this new folio:\n");
-        (void) showvar();
-        fprintf (stderr,"Select page: %d\n",selpage);
-      */
+    fprintf (c->ferr, "%7d lines de-selected\n", c->nldrop);
+    fprintf (c->ferr, "%7d hash comment lines suppressed\n", c->nlhash);
+    fprintf (c->ferr, "%7d empty lines suppressed\n", c->nlempt);
+    fprintf (c->ferr, "%7d lines written to output\n", c->nlwrit);
+    if (c->wrap > 1) {
+      fprintf (c->ferr, "%7d lines after wrapping\n", c->nlwrap);
     }
+  }
+}
 
-    /* Check page variables, text tags and locus types for all
-       transliteration items */
-    if (newpage == 0) {
-      selpage = 1;
-      selloc = usepgloc(0);
-    }
-  
-    /* Only continue if page and locus pass the criteria */
-    if ((selpage == 0) || (selloc == 0)) {
-      nldrop += 1;
-    } else {
+/*-----------------------------------------------------------*/
 
-      /* Process spaces */
-      if (ProcSpaces(buf1, buf2) != 0) {
-        if (mute < 2) {
-          fprintf (stderr, "%s", "Error processing spaces\n");
-          fprintf (stderr, "Line: %s\n", orig);
-        }
-        return 6;
-      }
+int RunLines(IVTT *c)
+/* Process all complete records in the input window */
+/* Return 0 if more input is needed, 3 at the end of the input,
+   or the exit code for an error */
+{
+  int igetl, iret;
+  char *orig;
+  int lorig;
 
-      /* Process uncertain readings */
+  while (1) {
 
-      iproc = ProcRead(buf2);
-      if (iproc > 0) {
-        if (mute < 2) {
-          fprintf (stderr, "%s\n", "Error processing uncertain readings");
-          fprintf (stderr, "Line: %s\n", orig);
-        }
-        return 7;
-      } else {
+    /* Read one line to buffer. 
+       This concatenates lines if required but nothing more */
 
-        /* Further processing and output are skipped if
-           locus was not selected */
-        if (iproc == 0) {
-      
-          /* Write line to stdout. Here the optional comment and/or
-             foliation removal and/or author selection is handled, 
-             as well as any re-wrapping. */
+    igetl = GetLine(c, &orig, &lorig);
+    if (igetl == -3) return 0;  /* Wait for more input */
+    if (igetl < 0) return 3;    /* Normal EOF */
+    else if (igetl > 0) {
+      if (c->mute < 2) fprintf (c->ferr, "%s\n", "Error reading line from stdin");
+      return 4;
+    }
 
-          if (PutLine(buf2) != 0) {
-            if (mute < 2) fprintf (stderr, "Line: %s\n", orig);
-            return 9;
-          }
-        } else {
-          nldrop += 1;
-        }
-      }
-    }  
+    iret = DoLine(c, orig, lorig);
+    if (iret != 0) return iret;
+  }
+}
+
+/*-----------------------------------------------------------*/
+
+int KeepIn(IVTT *c,char *data,long len)
+/* Move the unread part of the input window to the own buffer,
+   followed by len bytes of new data */
+/* Return 0 if all OK, 1 if out of memory */
+{
+  long nkeep, need;
+  int own;
+  char *nbuf;
+
+  nkeep = c->inlen - c->inpos;
+  need = nkeep + len;
+  own = (c->inbuf == c->inown);
+
+  if (own && c->inpos > 0) memmove(c->inown, c->inown+c->inpos, nkeep);
+  if (need > c->insize) {
+    nbuf = (char *) realloc(c->inown, need + INBLK);
+    if (nbuf == NULL) return 1;
+    c->inown = nbuf; c->insize = need + INBLK;
   }
+  if (!own && nkeep > 0) memcpy(c->inown, c->inbuf+c->inpos, nkeep);
+  if (len > 0) memcpy(c->inown+nkeep, data, len);
+  c->inbuf = c->inown; c->inpos = 0; c->inlen = need;
+  return 0;
 }
+
+/*-----------------------------------------------------------*/
+
+void FreeCtx(IVTT *c)
+/* Release a context */
+{
+  pthread_mutex_destroy(&c->outmtx);
+  pthread_cond_destroy(&c->outcnd);
+  free(c->inown);
+  free(c->obuf); free(c->buf1); free(c->buf2);
+  free(c->work); free(c->wrapbuf); free(c->pgh);
+  free(c->spbeg); free(c->spend); free(c->sptyp);
+  FreeCorp(c->corp);
+  free(c);
+}
+
+/*-----------------------------------------------------------*/
+
+IVTT *CloneCtx(IVTT *m,int midfile)
+/* Create a context with the options of m, which must not have
+   processed any input yet. It starts at the beginning of the file,
+   or at a page header inside it if midfile is 1 */
+/* Return NULL if out of memory */
+{
+  IVTT *c;
+
+  c = (IVTT *) malloc(sizeof(IVTT));
+  if (c == NULL) return NULL;
+  memcpy(c, m, sizeof(IVTT));
+
+  c->midfile = midfile;
+  c->lcap = 0;
+  c->obuf = c->buf1 = c->buf2 = c->work = c->wrapbuf = c->pgh = NULL;
+  c->spbeg = c->spend = NULL; c->sptyp = NULL;
+  c->corp = NULL;
+  c->inbuf = NULL; c->inown = NULL; c->insize = 0;
+  c->inlen = 0; c->inpos = 0; c->ineof = 0;
+  c->outfn = NULL; c->outarg = NULL;
+  c->outbg = 0; c->outcur = 0; c->outlen = 0;
+  c->outpend = -1; c->outstop = 0; c->outerr = 0;
+  pthread_mutex_init(&c->outmtx, NULL);
+  pthread_cond_init(&c->outcnd, NULL);
+  if (LineRoom(c, MAXLEN)) {
+    FreeCtx(c);
+    return NULL;
+  }
+  return c;
+}
+
+/*-----------------------------------------------------------*/
+
+void AddStats(IVTT *to,IVTT *from)
+/* Add the line counts of one context to those of another */
+{
+  to->nlpart += from->nlpart;
+  to->nlread += from->nlread;
+  to->nldrop += from->nldrop;
+  to->nlhash += from->nlhash;
+  to->nlempt += from->nlempt;
+  to->nlwrit += from->nlwrit;
+  to->nlwrap += from->nlwrap;
+}
+
+/*-----------------------------------------------------------*/
+
+int RunChunk(IVTT *c,char *data,long len)
+/* Process data as the complete rest of the input.
+   Return the exit code: 3 if all OK */
+{
+  c->inbuf = data; c->inlen = len; c->inpos = 0;
+  c->ineof = 1;
+  c->status = RunLines(c);
+  OutFlush(c);
+  if (c->outerr && c->status == 3) {
+    if (c->mute < 2) fprintf (c->ferr, "%s\n", "Error writing the output");
+    c->status = 2;
+  }
+  return c->status;
+}
+
+/*-----------------------------------------------------------*/
+
+int PageStart(IVTT *c,char *data,long len,long pos)
+/* Check whether the record starting at data[pos], just after
+   a newline, is a page header whatever precedes it: a locus
+   in the first position without . , or ; before the >
+   and no possible continuation from the previous line */
+/* Return 1 if so, else 0 */
+{
+  long ii;
+  unsigned char cb;
+
+  if (data[pos] != '<') return 0;
+  for (ii = pos+1; ii < len; ii++) {
+    cb = (unsigned char) data[ii];
+    if (cb == '>') break;
+    if (cb == '.' || cb == ',' || cb == ';' || cb == '\n' || cb > 127) return 0;
+  }
+  if (ii >= len) return 0;
+
+  /* When unwrapping, a slash anywhere in the previous line
+     might make this a continuation */
+  if (c->wrap > 0) {
+    for (ii = pos-2; ii >= 0 && data[ii] != '\n'; ii--) {
+      if (data[ii] == '/') return 0;
+    }
+  }
+  return 1;
+}
+
+/*-----------------------------------------------------------*/
+
+/* One piece of input for page-parallel processing, and
+   the state shared by the threads working on them */
+
+struct ivtt_chunk {
+  char *data;       /* Input of this chunk, ending at a page header */
+  long len;
+  IVTT *c;          /* Context that processed it */
+  FILE *fo, *fe;    /* Output and messages, kept in memory */
+  char *obuf, *ebuf;
+  size_t olen, elen;
+  int done;         /* Set to 1 when processed */
+};
+
+struct ivtt_pool {
+  IVTT *tmpl;       /* Context to copy for each chunk */
+  struct ivtt_chunk *ch;
+  int nch;          /* Number of chunks */
+  int next;         /* Next chunk to be picked up */
+  pthread_mutex_t mtx;
+  pthread_cond_t cnd;
+};
+
+/*-----------------------------------------------------------*/
+
+int MemOut(void *arg,char *buf,int len)
+/* Output sink writing to a memory stream */
+{
+  return (fwrite(buf, 1, len, (FILE *) arg) != (size_t) len);
+}
+
+/*-----------------------------------------------------------*/
+
+int ChunkOpen(struct ivtt_chunk *pc)
+/* Direct output and messages of the chunk's context to memory */
+/* Return 0 if all OK, 1 if out of memory */
+{
+  pc->fo = open_memstream(&pc->obuf, &pc->olen);
+  pc->fe = open_memstream(&pc->ebuf, &pc->elen);
+  if (pc->fo == NULL || pc->fe == NULL) return 1;
+  pc->c->ferr = pc->fe;
+  ivtt_output(pc->c, MemOut, pc->fo);
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+void ChunkClose(struct ivtt_chunk *pc)
+/* Release the memory streams of a chunk */
+{
+  if (pc->fo != NULL) fclose(pc->fo);
+  if (pc->fe != NULL) fclose(pc->fe);
+  free(pc->obuf); free(pc->ebuf);
+  pc->fo = pc->fe = NULL;
+  pc->obuf = pc->ebuf = NULL;
+  pc->olen = pc->elen = 0;
+}
+
+/*-----------------------------------------------------------*/
+
+void *PageThread(void *arg)
+/* Worker: process chunks, each in a context of its own,
+   until none are left */
+{
+  struct ivtt_pool *pp = (struct ivtt_pool *) arg;
+  struct ivtt_chunk *pc;
+  int i;
+
+  while (1) {
+    pthread_mutex_lock(&pp->mtx);
+    i = pp->next;
+    if (i < pp->nch) pp->next += 1;
+    pthread_mutex_unlock(&pp->mtx);
+    if (i >= pp->nch) break;
+
+    pc = &pp->ch[i];
+    pc->c = CloneCtx(pp->tmpl, i > 0);
+    if (pc->c != NULL) {
+      if (ChunkOpen(pc) == 0) {
+        (void) RunChunk(pc->c, pc->data, pc->len);
+      } else {
+        ChunkClose(pc); FreeCtx(pc->c); pc->c = NULL;
+      }
+    }
+
+    pthread_mutex_lock(&pp->mtx);
+    pc->done = 1;
+    pthread_cond_broadcast(&pp->cnd);
+    pthread_mutex_unlock(&pp->mtx);
+  }
+  return NULL;
+}
+
+/*-----------------------------------------------------------*/
+
+IVTT *NewCtx(void)
+/* Create a context with all options at their defaults */
+/* Return NULL if out of memory */
+{
+  IVTT *c;
+  int i;
+
+  c = (IVTT *) calloc(1, sizeof(IVTT));
+  if (c == NULL) return NULL;
+
+  for (i=0; i<=26; i++) {
+    c->invar[i]=' '; c->exvar[i]=' ';
+  }
+  c->infarg = -1; c->oufarg = -1; c->lstarg = -1; c->cachearg = -1;
+  c->corparg = -1; c->uncarg = -1;
+  c->auth = ' '; c->uloc2 = ' ';
+  c->ferr = stderr; c->fin = stdin; c->fout = stdout;
+  c->cwarn = ' ';
+  (void) strcpy(c->folname, "      ");
+  c->lineauth = ' '; c->cator = ' ';
+  (void) strcpy(c->loc2, "   ");
+  c->ind_ligo = -1; c->ind_ligc = -1;
+  c->ind_alto = -1; c->ind_altb = 0; c->ind_altc = -1;
+  c->word0 = -1; c->word1 = -1; c->weir0 = -1;
+  c->hasc0 = -1; c->hasc1 = -1;
+  c->comchr = ' ';
+  c->cue = '.';
+  c->outpend = -1;
+  pthread_mutex_init(&c->outmtx, NULL);
+  pthread_cond_init(&c->outcnd, NULL);
+  if (LineRoom(c, MAXLEN)) {
+    FreeCtx(c);
+    return NULL;
+  }
+  return c;
+}
+
+/*-----------------------------------------------------------*/
+
+void SetAction(IVTT *c)
+/* Work out once what the output options do to each type of
+   inline comment and to dot and comma spaces, so that PutLine
+   and ProcSpaces need not test them again for every character */
+{
+  int i, np, drop;
+  char repl;
+
+  for (np=0; np<2; np++) {
+    for (i=0; i<256; i++) {
+      drop = 0; repl = 0;
+      if (c->kcomi > 0) {
+        if (np) {
+          if (c->kcomi == 2) drop = 1;
+        } else {
+          if (i == '!' || i == '~' || i == '@') drop = 1;
+        }
+      }
+      if (i == '-') {
+        if (c->gaps == 1) drop = 1;
+        else if (c->gaps == 2) repl = '.';
+      }
+      if (i == '%') {
+        if (c->para == 1 || c->para == 2) drop = 1;
+      }
+      if (i == '$') {
+        if (c->para == 1) drop = 1;
+        else if (c->para == 2) repl = '\n';
+      }
+      if (i == '@') {
+        if (c->kfoli == 1 || c->kcomi == 2) drop = 1;
+      }
+      c->spact[np][i] = drop ? SA_DROP : (repl ? repl : SA_KEEP);
+    }
+  }
+
+  /* Dot space */
+  if (c->s_hard == 1) c->spout[0] = ' ';
+  else if (c->s_hard == 2) c->spout[0] = 0;
+  else if (c->s_hard == 3) c->spout[0] = '\n';
+  else c->spout[0] = '.';
+
+  /* Comma space, of which option 1 treats it as a dot */
+  if (c->s_uncn == 1) c->spout[1] = c->spout[0];
+  else if (c->s_uncn == 2) c->spout[1] = 0;
+  else if (c->s_uncn == 3) c->spout[1] = '?';
+  else c->spout[1] = ',';
+}
+
+/*-----------------------------------------------------------*/
+
+void SetSelect(IVTT *c)
+/* Compile the page and locus selection options into the list
+   of variables to check and the locus rules used by usepgloc */
+{
+  int i;
+
+  c->nslot = 0; c->inmask = 0; c->exmask = 0;
+  for (i=1; i<=26; i++) {
+    if (c->invar[i] != ' ') c->inmask |= 1L << i;
+    if (c->exvar[i] != ' ') c->exmask |= 1L << i;
+    if ((c->inmask | c->exmask) & (1L << i)) {
+      c->selslot[c->nslot++] = (char) i;
+    }
+  }
+
+  c->locrule = 0;
+  if (c->invar[0] != ' ') c->locrule |= LR_IN;
+  if (c->exvar[0] != ' ') c->locrule |= LR_EX;
+  if (c->uloc2) c->locrule |= LR_TWO;
+  if (c->toppar == 1) c->locrule |= LR_TOP;
+  if (c->toppar == 2) c->locrule |= LR_NTOP;
+}
+
+/*-----------------------------------------------------------*/
+
+void StartCtx(IVTT *c)
+/* Prepare a context for reading, once all options are set */
+{
+  int i;
+
+  /* Count the selection options */
+  if (c->invar[0] != ' ' || c->exvar[0] != ' ') c->nlcopt = 1;
+  for (i=1; i<=26; i++) {
+    if (c->invar[i] != ' ') c->npgopt += 1;
+    if (c->exvar[i] != ' ') c->npgopt += 1;
+  }
+
+  clearvar(c);
+  SetClass(c);
+  SetAction(c);
+  SetSelect(c);
+
+  /* The initial value of selpage (i.e. before the first 'new folio')
+     depends on whether page selection options were specified */
+  if (c->npgopt == 0) {
+    c->selpage = 1;
+  } else {
+    c->selpage = 0;
+  }
+}
+
+/*-----------------------------------------------------------*/
+
+IVTT *ivtt_open(int argc,char *argv[])
+/* Create a context and set it up from the command line options
+   in argv[1..argc-1]. File names among them are only recorded */
+/* Return NULL if the options are in error or memory is short */
+{
+  IVTT *c;
+  int erropt;
+
+  c = NewCtx();
+  if (c == NULL) return NULL;
+
+  /* Parse command line options */
+  /* Do this first, in order to get the "mute" option first */
+  erropt = ParseOpts(c, argc, argv);
+  if (c->mute == 0) {
+    fprintf (c->ferr,"Intermediate Voynich Transliteration Tool (v 1.1)\n\n");
+  }
+
+  if (erropt) {
+    if (c->mute < 2) fprintf (c->ferr, "%s\n", "Error parsing command line");
+    FreeCtx(c);
+    return NULL;
+  }
+
+  /* The corpus is collected by this context alone, so that the
+     pages must be processed in order, on one thread. The
+     uncertainty records are made from it */
+  if (c->corparg >= 0 || c->uncarg >= 0) {
+    if (c->lstarg >= 0 || c->cachearg >= 0) {
+      if (c->mute < 2) fprintf (c->ferr, "%s\n", "The corpus or uncertainties cannot be written with a variant list or the page cache");
+      FreeCtx(c);
+      return NULL;
+    }
+    c->corp = (struct ivtt_corpus *) calloc(1, sizeof(struct ivtt_corpus));
+    if (c->corp == NULL) {
+      FreeCtx(c);
+      return NULL;
+    }
+    if (c->corparg >= 0) c->corp->fname = argv[c->corparg]+9;
+    if (c->uncarg >= 0) c->corp->uname = argv[c->uncarg]+9;
+    c->njob = 1;
+  }
+
+  StartCtx(c);
+  return c;
+}
+
+/*-----------------------------------------------------------*/
+
+void ivtt_output(IVTT *c,int (*outfn)(void *,char *,int),void *outarg)
+/* Send the output of this context to outfn instead of a file */
+{
+  c->outfn = outfn;
+  c->outarg = outarg;
+}
+
+/*-----------------------------------------------------------*/
+
+int ivtt_feed(IVTT *c,char *data,long len)
+/* Process a block of input. All complete records are processed,
+   a partial record at the end is kept until more data arrives.
+   The data need not stay valid after the call */
+/* Return 0 if all OK, else the exit code for the error */
+{
+  if (c->status != 0) return c->status;
+
+  if (c->inpos < c->inlen) {
+    /* Part of a record is waiting, so append to it */
+    if (KeepIn(c, data, len)) {
+      if (c->mute < 2) fprintf (c->ferr, "%s\n", "Out of memory");
+      return (c->status = 4);
+    }
+  } else {
+    /* Work directly on the caller's data */
+    c->inbuf = data; c->inlen = len; c->inpos = 0;
+  }
+
+  c->status = RunLines(c);
+  if (c->status == 0 && c->inbuf != c->inown) {
+    if (KeepIn(c, NULL, 0)) {
+      if (c->mute < 2) fprintf (c->ferr, "%s\n", "Out of memory");
+      c->status = 4;
+    }
+  }
+  return c->status;
+}
+
+/*-----------------------------------------------------------*/
+
+int ivtt_pages(IVTT *c,char *data,long len)
+/* Process the complete input in data, on the number of threads
+   given with -j. The input is cut at page headers, the pieces
+   are processed independently and their output is written in
+   the original order. Must be used instead of ivtt_feed */
+/* Return the exit code: 3 if all OK */
+{
+  struct ivtt_pool pool;
+  struct ivtt_chunk *pc;
+  pthread_t *thr;
+  IVTT *prev, tot;
+  long target, pos, end, *cut;
+  int i, ncut, nthr, iret;
+  char *eol;
+
+  if (c->njob < 2) {
+    if ((iret = ivtt_feed(c, data, len)) != 0) return iret;
+    c->ineof = 1;
+    return (c->status = RunLines(c));
+  }
+
+  /* Cut the input into a few pieces per thread */
+  target = len / (4 * c->njob);
+  if (target < INBLK) target = INBLK;
+  cut = (long *) malloc(sizeof(long) * (len / target + 2));
+  if (cut == NULL) return (c->status = 4);
+  ncut = 0; pos = 0;
+  while (pos < len) {
+    end = pos + target;
+    if (end >= len) {
+      end = len;
+    } else {
+      /* Find the first page header from here */
+      while (1) {
+        eol = (char *) memchr(data+end-1, '\n', len-end+1);
+        if (eol == NULL) {
+          end = len; break;
+        }
+        end = eol - data + 1;
+        if (end >= len || PageStart(c, data, len, end)) break;
+        end += 1;
+      }
+    }
+    cut[ncut++] = pos;
+    pos = end;
+  }
+  cut[ncut] = len;
+
+  pool.ch = (struct ivtt_chunk *) calloc(ncut, sizeof(struct ivtt_chunk));
+  pool.tmpl = CloneCtx(c, 0);
+  thr = (pthread_t *) malloc(sizeof(pthread_t) * c->njob);
+  if (pool.ch == NULL || pool.tmpl == NULL || thr == NULL) {
+    free(cut); free(pool.ch); free(thr);
+    if (pool.tmpl != NULL) FreeCtx(pool.tmpl);
+    return (c->status = 4);
+  }
+  for (i=0; i<ncut; i++) {
+    pool.ch[i].data = data + cut[i];
+    pool.ch[i].len = cut[i+1] - cut[i];
+  }
+  free(cut);
+  pool.nch = ncut; pool.next = 0;
+  pthread_mutex_init(&pool.mtx, NULL);
+  pthread_cond_init(&pool.cnd, NULL);
+
+  nthr = 0;
+  while (nthr < c->njob && nthr < ncut) {
+    if (pthread_create(&thr[nthr], NULL, PageThread, &pool) != 0) break;
+    nthr += 1;
+  }
+  if (nthr == 0) (void) PageThread(&pool);
+
+  /* Collect the results in order */
+  memset(&tot, 0, sizeof(tot));
+  prev = NULL; iret = 3;
+  for (i=0; i<ncut; i++) {
+    pc = &pool.ch[i];
+    pthread_mutex_lock(&pool.mtx);
+    while (pc->done == 0) pthread_cond_wait(&pool.cnd, &pool.mtx);
+    pthread_mutex_unlock(&pool.mtx);
+
+    if (pc->c == NULL) {
+      if (c->mute < 2) fprintf (c->ferr, "%s\n", "Out of memory");
+      iret = 4;
+      break;
+    }
+
+    /* A @...; code left open by the previous chunk carries
+       over into this one. Then continue serially instead */
+    if (prev != NULL && (prev->hasc0 >= 0 || prev->hasc1 >= 0)) {
+      ChunkClose(pc); FreeCtx(pc->c);
+      pc->c = prev; prev = NULL;
+      if (ChunkOpen(pc)) {
+        AddStats(&tot, pc->c); ChunkClose(pc); FreeCtx(pc->c); pc->c = NULL;
+        if (c->mute < 2) fprintf (c->ferr, "%s\n", "Out of memory");
+        iret = 4;
+        break;
+      }
+      (void) RunChunk(pc->c, pc->data, pc->len);
+    }
+
+    fflush(pc->fo); fflush(pc->fe);
+    if (pc->elen > 0) fwrite(pc->ebuf, 1, pc->elen, c->ferr);
+    OutBlock(c, pc->obuf, (long) pc->olen);
+    ChunkClose(pc);
+
+    if (prev != NULL) {
+      AddStats(&tot, prev); FreeCtx(prev);
+    }
+    prev = pc->c; pc->c = NULL;
+    if (prev->status != 3) {
+      iret = prev->status;
+      break;
+    }
+  }
+  if (prev != NULL) {
+    AddStats(&tot, prev); FreeCtx(prev);
+  }
+
+  /* Stop the threads and release what was not used */
+  pthread_mutex_lock(&pool.mtx);
+  pool.next = pool.nch;
+  pthread_mutex_unlock(&pool.mtx);
+  for (i=0; i<nthr; i++) pthread_join(thr[i], NULL);
+  for (i=0; i<ncut; i++) {
+    pc = &pool.ch[i];
+    if (pc->c != NULL) {
+      ChunkClose(pc); FreeCtx(pc->c);
+    }
+  }
+  pthread_mutex_destroy(&pool.mtx);
+  pthread_cond_destroy(&pool.cnd);
+  FreeCtx(pool.tmpl);
+  free(pool.ch); free(thr);
+
+  AddStats(c, &tot);
+  return (c->status = iret);
+}
+
+/*-----------------------------------------------------------*/
+
+int ivtt_finish(IVTT *c)
+/* Process what is left of the input, flush all output and
+   release the context */
+/* Return the exit code: 3 if all OK */
+{
+  int iret;
+
+  if (c->status == 0) {
+    c->ineof = 1;
+    c->status = RunLines(c);
+  }
+  iret = c->status;
+  if (iret == 3) PrintStats(c);
+  if (iret == 3 && c->corp != NULL) {
+    if (MakeUnc(c->corp)) {
+      if (c->mute < 2) fprintf (c->ferr, "%s\n", "Out of memory for the corpus");
+      iret = 4;
+    } else if (c->corp->fname != NULL && WriteCorp(c)) {
+      if (c->mute < 2) fprintf (c->ferr, "Cannot write the corpus to %s\n", c->corp->fname);
+      iret = 2;
+    } else if (c->corp->uname != NULL && WriteUnc(c)) {
+      if (c->mute < 2) fprintf (c->ferr, "Cannot write the uncertainties to %s\n", c->corp->uname);
+      iret = 2;
+    }
+  }
+
+  iret = OutEnd(c, iret);
+  FreeCtx(c);
+  return iret;
+}
+
+/*-----------------------------------------------------------*/
+
+int SameRead(IVTT *a,IVTT *b)
+/* Check whether two contexts read and preprocess lines in the
+   same way. Only the options used by GetLine and PrepLine count,
+   except kfoli, which is applied in CopyLine */
+/* Return 1 if so, else 0 */
+{
+  return ((a->wrap > 0) == (b->wrap > 0) && a->white == b->white &&
+          (a->liga == 1) == (b->liga == 1) && a->a_high == b->a_high &&
+          a->folign == b->folign && a->mute == b->mute);
+}
+
+/*-----------------------------------------------------------*/
+
+void CopyLine(IVTT *v,IVTT *r)
+/* Take over the information on the current line from the
+   context r that read and preprocessed it */
+{
+  v->comlin = r->comlin; v->filehead = r->filehead;
+  v->hastrtxt = r->hastrtxt; v->hasfoli = r->hasfoli;
+  v->newpage = r->newpage; v->nwpar = r->nwpar; v->endpar = r->endpar;
+  memcpy(v->folname, r->folname, sizeof(v->folname));
+  v->num = r->num; v->lineauth = r->lineauth; v->cator = r->cator;
+  memcpy(v->loc2, r->loc2, sizeof(v->loc2));
+  memcpy(v->pgvar, r->pgvar, sizeof(v->pgvar));
+  memcpy(v->txtag, r->txtag, sizeof(v->txtag));
+  v->nlread = r->nlread; v->nlpart = r->nlpart;
+
+  /* The reader always runs with kfoli 0 (see RunList) */
+  if (v->newpage && (v->kfoli == 1)) v->hastrtxt = 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int RunList(IVTT *c,int argc,char *argv[],char *data,long len)
+/* Produce all variants in the list given by @<filename> from
+   one reading of the input. Each line of the list has options,
+   which are added to those on the command line, followed by
+   the output file name. Lines are read and preprocessed once for
+   all variants that do this in the same way, and only the
+   remaining steps are done for each variant */
+/* Return the exit code: 3 if all OK, else that of the first
+   variant that failed */
+{
+  IVTT *var[MAXVAR], *rdr[MAXVAR], *r, *v;
+  char *vargv[MAXARG+1], lbuf[MAXLEN], *tok, *orig;
+  int grp[MAXVAR], nvar = 0, nrdr = 0, nlin = 0;
+  int i, k, nv, iret = 0, igetl, lorig, nact;
+  FILE *flst;
+
+  if (c->oufarg >= 0) {
+    if (c->mute < 2) fprintf (c->ferr, "%s\n", "No output file allowed with a variant list");
+    return 2;
+  }
+  if ((flst = fopen(argv[c->lstarg]+1, "r")) == NULL) {
+    if (c->mute < 2) fprintf (c->ferr, "%s\n", "Cannot open variant list");
+    return 2;
+  }
+
+  /* Set up a context for each variant */
+  while (iret == 0 && fgets(lbuf, MAXLEN, flst) != NULL) {
+    nlin += 1;
+    nv = 1; vargv[0] = argv[0];
+    tok = strtok(lbuf, " \t\r\n");
+    while (tok != NULL && nv <= MAXARG) {
+      vargv[nv++] = tok;
+      tok = strtok(NULL, " \t\r\n");
+    }
+    /* Skip empty and comment lines */
+    if (nv == 1 || vargv[1][0] == '#') continue;
+
+    if (tok != NULL || nvar >= MAXVAR) {
+      if (c->mute < 2) fprintf (c->ferr, "Too many variants or options in list line %d\n", nlin);
+      iret = 2; break;
+    }
+    if ((v = NewCtx()) == NULL) {
+      if (c->mute < 2) fprintf (c->ferr, "%s\n", "Out of memory");
+      iret = 4; break;
+    }
+    var[nvar] = v; grp[nvar++] = -1;
+
+    /* The last word is the output file, all others must be options */
+    if (ParseOpts(v, argc, argv) || ParseOpts(v, nv-1, vargv) ||
+        v->infarg != c->infarg || v->oufarg >= 0 || v->lstarg != c->lstarg) {
+      if (c->mute < 2) fprintf (c->ferr, "Error in variant list line %d\n", nlin);
+      iret = 2; break;
+    }
+    StartCtx(v);
+    if ((v->fout = fopen(vargv[nv-1], "w")) == NULL) {
+      if (c->mute < 2) fprintf (c->ferr, "Cannot open output file %s\n", vargv[nv-1]);
+      iret = 2; break;
+    }
+
+    /* Variants that read lines in the same way share a reader */
+    for (k=0; k<nrdr; k++) {
+      if (SameRead(rdr[k], v)) break;
+    }
+    if (k == nrdr) {
+      if ((rdr[k] = CloneCtx(v, 0)) == NULL) {
+        if (c->mute < 2) fprintf (c->ferr, "%s\n", "Out of memory");
+        iret = 4; break;
+      }
+      rdr[k]->kfoli = 0; rdr[k]->fout = NULL;
+      nrdr += 1;
+    }
+    grp[nvar-1] = k;
+    if (c->mute == 0) {
+      fprintf (c->ferr, "Variant %d: output file %s (reader %d)\n", nvar, vargv[nv-1], k+1);
+    }
+  }
+  fclose(flst);
+  if (iret == 0 && nvar == 0) {
+    if (c->mute < 2) fprintf (c->ferr, "%s\n", "No variants in list");
+    iret = 2;
+  }
+
+  if (iret == 0) {
+    for (i=0; i<nvar; i++) OutInit(var[i]);
+
+    /* One pass over the input per reader */
+    for (k=0; k<nrdr; k++) {
+      r = rdr[k];
+      r->inbuf = data; r->inlen = len; r->inpos = 0; r->ineof = 1;
+      nact = 1;
+      while (nact > 0) {
+        igetl = GetLine(r, &orig, &lorig);
+        if (igetl < 0) {
+          iret = 3;
+        } else if (igetl > 0) {
+          if (r->mute < 2) fprintf (r->ferr, "%s\n", "Error reading line from stdin");
+          iret = 4;
+        } else {
+          iret = StartLine(r, orig, lorig);
+        }
+        nact = 0;
+        for (i=0; i<nvar; i++) {
+          v = var[i];
+          if (grp[i] != k || v->status != 0) continue;
+          if (iret != 0) {
+            v->status = iret;
+          } else {
+            CopyLine(v, r);
+            if (LineRoom(v, r->lcap)) {
+              if (v->mute < 2) fprintf (v->ferr, "%s\n", "Out of memory");
+              v->status = 4;
+              continue;
+            }
+            v->status = EndLine(v, r->buf1, orig, lorig);
+            if (v->status == 0) nact += 1;
+          }
+        }
+      }
+    }
+
+    /* Statistics per variant, and the first failure if any */
+    iret = 3;
+    for (i=0; i<nvar; i++) {
+      v = var[i];
+      if (v->status == 3 && c->mute == 0) {
+        fprintf (c->ferr, "\nVariant %d:", i+1);
+        PrintStats(v);
+      }
+      if (iret == 3) iret = v->status;
+    }
+  }
+
+  for (i=0; i<nvar; i++) {
+    if (OutClose(var[i])) {
+      if (c->mute < 2) fprintf (c->ferr, "Error writing the output of variant %d\n", i+1);
+      if (iret == 3) iret = 2;
+    }
+    if (var[i]->fout != NULL && var[i]->fout != stdout) fclose(var[i]->fout);
+    FreeCtx(var[i]);
+  }
+  for (k=0; k<nrdr; k++) FreeCtx(rdr[k]);
+  return iret;
+}
+
+/*-----------------------------------------------------------*/
+
+/* The locus index of a file, kept next to it as <file>.idx.
+   It gives the byte range of each page, from its header up to the
+   next page, and of each locus, from its line up to the next locus,
+   page or hash comment line. The page variables are not kept:
+   a locus is always looked up with the header line of its page,
+   which sets them (see RunLook). The index holds the size and time of the file it was built from,
+   and is built again as soon as these no longer match */
+
+struct ivtt_ient {
+  char type;        /* P for a page, L for a locus */
+  char name[16];    /* Page name, with .num for a locus */
+  long beg, end;    /* Byte range in the file */
+};
+
+struct ivtt_index {
+  long size, mtime; /* Of the file that was indexed */
+  int n, nmax;      /* Number of entries, and room for them */
+  struct ivtt_ient *e;
+};
+
+/*-----------------------------------------------------------*/
+
+int AddEntry(struct ivtt_index *ix,char type,char *name,long beg)
+/* Add an entry starting at beg. Its end is set later */
+/* Return 0 if all OK, 1 if out of memory */
+{
+  struct ivtt_ient *pe;
+
+  if (ix->n >= ix->nmax) {
+    if (ResizeMem((void **) &ix->e,
+                  (long) sizeof(struct ivtt_ient) * (2 * ix->nmax + 256))) {
+      return 1;
+    }
+    ix->nmax = 2 * ix->nmax + 256;
+  }
+  pe = &ix->e[ix->n++];
+  memset(pe, 0, sizeof(struct ivtt_ient));
+  pe->type = type;
+  strncpy(pe->name, name, sizeof(pe->name) - 1);
+  pe->beg = beg; pe->end = beg;
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int MakeIndex(IVTT *c,char *data,long len,struct ivtt_index *ix)
+/* Build the index of the complete file in data. Lines are read and
+   preprocessed as with the default options, each on its own */
+/* Return 0 if all OK, else the exit code for the error */
+{
+  IVTT *r;
+  int igetl, iret = 0, lorig, curp = -1, curl = -1;
+  long pos;
+  char *orig, name[16];
+
+  ix->n = 0;
+  if ((r = NewCtx()) == NULL) return 4;
+  r->mute = (c->mute < 2) ? 1 : 2;
+  r->ferr = c->ferr;
+  StartCtx(r);
+  r->inbuf = data; r->inlen = len; r->inpos = 0; r->ineof = 1;
+
+  while (iret == 0) {
+    pos = r->inpos;
+    igetl = GetLine(r, &orig, &lorig);
+    if (igetl < 0) break;
+    if (igetl > 0) {
+      if (r->mute < 2) fprintf (r->ferr, "%s\n", "Error reading line from input");
+      iret = 4; break;
+    }
+    if ((iret = StartLine(r, orig, lorig)) != 0) break;
+
+    /* A hash comment line, a locus or a page ends the locus before */
+    if (r->comlin == 0 && r->hasfoli == 0) continue;
+    if (curl >= 0) {
+      ix->e[curl].end = pos; curl = -1;
+    }
+    if (r->comlin) continue;
+
+    /* PrepLine stores the page name from folname[1] on */
+    if (r->newpage == 1) {
+      if (curp >= 0) ix->e[curp].end = pos;
+      curp = ix->n;
+      if (AddEntry(ix, 'P', r->folname+1, pos)) iret = 4;
+    } else {
+      curl = ix->n;
+      sprintf(name, "%.6s.%d", r->folname+1, r->num);
+      if (AddEntry(ix, 'L', name, pos)) iret = 4;
+    }
+  }
+  if (curl >= 0) ix->e[curl].end = len;
+  if (curp >= 0) ix->e[curp].end = len;
+
+  if (iret == 4 && r->mute < 2) fprintf (r->ferr, "%s\n", "Out of memory");
+  FreeCtx(r);
+  return iret;
+}
+
+/*-----------------------------------------------------------*/
+
+int WriteIndex(char *fname,struct ivtt_index *ix)
+/* Write the index to file fname */
+/* Return 0 if all OK, 1 if it could not be written */
+{
+  FILE *fi;
+  struct ivtt_ient *pe;
+  int i;
+
+  if ((fi = fopen(fname, "w")) == NULL) return 1;
+  fprintf (fi, "#=IVTT index 1\n");
+  fprintf (fi, "S %ld %ld\n", ix->size, ix->mtime);
+  for (i=0; i<ix->n; i++) {
+    pe = &ix->e[i];
+    fprintf (fi, "%c %s %ld %ld\n", pe->type, pe->name, pe->beg, pe->end);
+  }
+  return (fclose(fi) != 0);
+}
+
+/*-----------------------------------------------------------*/
+
+int ReadIndex(char *fname,struct ivtt_index *ix)
+/* Read the index from file fname. Anything after the byte range
+   of an entry is ignored, such as the page variables that earlier
+   versions wrote */
+/* Return 0 if all OK, 1 if there is no valid index */
+{
+  FILE *fi;
+  char lbuf[MAXLEN], name[16], type;
+  long beg, end;
+  int bad = 0;
+
+  ix->n = 0;
+  if ((fi = fopen(fname, "r")) == NULL) return 1;
+  if (fgets(lbuf, MAXLEN, fi) == NULL || strcmp(lbuf, "#=IVTT index 1\n") != 0 ||
+      fgets(lbuf, MAXLEN, fi) == NULL ||
+      sscanf(lbuf, "S %ld %ld", &ix->size, &ix->mtime) != 2) {
+    bad = 1;
+  }
+  while (bad == 0 && fgets(lbuf, MAXLEN, fi) != NULL) {
+    if (sscanf(lbuf, "%c %15s %ld %ld", &type, name, &beg, &end) != 4 ||
+        (type != 'P' && type != 'L') || AddEntry(ix, type, name, beg)) {
+      bad = 1;
+    } else {
+      ix->e[ix->n-1].end = end;
+    }
+  }
+  fclose(fi);
+  return bad;
+}
+
+/*-----------------------------------------------------------*/
+
+char *IndexName(char *fname)
+/* Name of the index file of fname, in allocated memory */
+{
+  char *iname;
+
+  iname = (char *) malloc(strlen(fname) + 5);
+  if (iname != NULL) sprintf(iname, "%s.idx", fname);
+  return iname;
+}
+
+/*-----------------------------------------------------------*/
+
+int RunIndex(IVTT *c,char *argv[],char *data,long len,struct stat *st)
+/* Build the index of the input file and write it (option --index) */
+/* Return the exit code: 3 if all OK */
+{
+  struct ivtt_index ix;
+  char *iname;
+  int iret, np, i;
+
+  if (c->infarg < 0) {
+    if (c->mute < 2) fprintf (c->ferr, "%s\n", "The locus index needs an input file");
+    return 2;
+  }
+  memset(&ix, 0, sizeof(ix));
+  iret = MakeIndex(c, data, len, &ix);
+  if (iret == 0) {
+    ix.size = (long) st->st_size; ix.mtime = (long) st->st_mtime;
+    iname = IndexName(argv[c->infarg]);
+    if (iname == NULL || WriteIndex(iname, &ix)) {
+      if (c->mute < 2) fprintf (c->ferr, "%s\n", "Cannot write the locus index");
+      iret = 2;
+    } else {
+      if (c->mute == 0) {
+        for (i=np=0; i<ix.n; i++) np += (ix.e[i].type == 'P');
+        fprintf (c->ferr, "Index of %d pages and %d loci written to %s\n",
+                 np, ix.n - np, iname);
+      }
+      iret = 3;
+    }
+    free(iname);
+  }
+  free(ix.e);
+  return iret;
+}
+
+/*-----------------------------------------------------------*/
+
+int CompRange(const void *a,const void *b)
+/* Order byte ranges by start, the longer one first */
+{
+  const long *ra = (const long *) a, *rb = (const long *) b;
+
+  if (ra[0] != rb[0]) return (ra[0] < rb[0]) ? -1 : 1;
+  if (ra[1] != rb[1]) return (ra[1] > rb[1]) ? -1 : 1;
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int RunLook(IVTT *c,char *argv[],char *data,long len,struct stat *st)
+/* Process only the pages and loci given by =name, in the order of
+   the file. A locus comes with the header of its page, so that
+   the page variables are set. The index is used if it matches the
+   input file, and is built (again) if not */
+/* Return 0 if all OK, else the exit code for the error */
+{
+  struct ivtt_index ix;
+  long (*rg)[2] = NULL, last;
+  int i, k, p, found, nrg = 0, nmax = 0, iret = 0;
+  char *iname, *look, *eol;
+
+  if (c->infarg < 0 || c->lstarg >= 0) {
+    if (c->mute < 2) fprintf (c->ferr, "%s\n", "Look-ups need an input file and no variant list");
+    return (c->status = 2);
+  }
+  memset(&ix, 0, sizeof(ix));
+  iname = IndexName(argv[c->infarg]);
+  if (iname == NULL) return (c->status = 4);
+  if (ReadIndex(iname, &ix) || ix.size != (long) st->st_size ||
+      ix.mtime != (long) st->st_mtime) {
+    iret = MakeIndex(c, data, len, &ix);
+    if (iret == 0) {
+      ix.size = (long) st->st_size; ix.mtime = (long) st->st_mtime;
+      if (WriteIndex(iname, &ix) == 0) {
+        if (c->mute == 0) fprintf (c->ferr, "Locus index written to %s\n", iname);
+      } else {
+        if (c->mute == 0) fprintf (c->ferr, "Locus index could not be saved\n");
+      }
+    }
+  }
+  free(iname);
+
+  /* Collect the byte ranges */
+  for (k=0; iret == 0 && k<ix.n; k++) {
+    if (ix.e[k].beg > ix.e[k].end || ix.e[k].end > len) {
+      if (c->mute < 2) fprintf (c->ferr, "%s\n", "Locus index does not match input file");
+      iret = 2;
+    }
+  }
+  /* A locus may have a line for each transliterator */
+  for (i=0; iret == 0 && i<c->nlook; i++) {
+    look = argv[c->lkarg[i]] + 1;
+    found = 0;
+    for (k=0, p=-1; iret == 0 && k<ix.n; k++) {
+      if (ix.e[k].type == 'P') p = k;
+      if (strcmp(ix.e[k].name, look) != 0) continue;
+      found = 1;
+      if (nrg + 2 > nmax) {
+        if (ResizeMem((void **) &rg, (long) sizeof(rg[0]) * (2 * nmax + 16))) {
+          if (c->mute < 2) fprintf (c->ferr, "%s\n", "Out of memory");
+          iret = 4; break;
+        }
+        nmax = 2 * nmax + 16;
+      }
+      if (ix.e[k].type == 'L' && p >= 0) {
+        /* Only the header line of the page */
+        eol = (char *) memchr(data + ix.e[p].beg, '\n', ix.e[p].end - ix.e[p].beg);
+        rg[nrg][0] = ix.e[p].beg;
+        rg[nrg][1] = (eol == NULL) ? ix.e[p].end : eol - data + 1;
+        nrg += 1;
+      }
+      rg[nrg][0] = ix.e[k].beg; rg[nrg][1] = ix.e[k].end;
+      nrg += 1;
+    }
+    if (iret == 0 && found == 0) {
+      if (c->mute < 2) fprintf (c->ferr, "Page or locus %s not in input file\n", look);
+      iret = 2;
+    }
+  }
+  free(ix.e);
+
+  /* Feed them in order, each only once */
+  if (iret == 0) {
+    qsort(rg, nrg, sizeof(rg[0]), CompRange);
+    c->midfile = 1; last = 0;
+    for (k=0; k<nrg && iret == 0; k++) {
+      if (rg[k][1] <= last) continue;
+      iret = ivtt_feed(c, data + rg[k][0], rg[k][1] - rg[k][0]);
+      last = rg[k][1];
+    }
+  }
+  free(rg);
+  if (iret != 0) c->status = iret;
+  return iret;
+}
+
+/*-----------------------------------------------------------*/
+
+/* The page cache (--cache=<file>). The input is cut before each
+   page header, as for -jN, and the output and messages of every
+   piece are kept under the hash of its text and of the options.
+   When the file is processed again, only pieces that changed are
+   processed, the others are copied from the cache. The file name
+   does not count, so a renamed or re-issued file finds its pages
+   again. The cache counts its runs, and an entry that was not used
+   in the last CACHEAGE runs is dropped, as are older entries once
+   the file would grow beyond CACHEMAX bytes (see WriteCache) */
+
+struct ivtt_centry {
+  unsigned long phash;  /* Hash of the text of the piece */
+  unsigned long okey;   /* Hash of the options, see RunKey */
+  int first;            /* 1 for the piece at the start of the file */
+  long last;            /* Run in which it was last used or made */
+  int cnt[7];           /* Line counts, see PutCounts */
+  char *obuf, *ebuf;    /* Output and messages */
+  long olen, elen;
+  int own;              /* 1 if the buffers were allocated */
+};
+
+struct ivtt_cache {
+  char *file;           /* Contents of the cache file */
+  long run;             /* Number of this run */
+  int n, nmax;
+  struct ivtt_centry *e;
+};
+
+/*-----------------------------------------------------------*/
+
+unsigned long HashText(unsigned long h,char *buf,long len)
+/* Continue a 64-bit FNV-1a hash over len bytes */
+{
+  long ii;
+
+  for (ii=0; ii<len; ii++) {
+    h ^= (unsigned char) buf[ii];
+    h *= 0x100000001b3UL;
+  }
+  return h;
+}
+
+/*-----------------------------------------------------------*/
+
+unsigned long RunKey(IVTT *c)
+/* Hash of all options that can change output or messages. It is
+   taken from the settings they leave in the context, so that the
+   same settings give the same key however they were written (e.g.
+   -x7 or the options it stands for, in any order). File names, -j
+   and -o do not count */
+{
+  unsigned long h;
+  int opt[21];
+
+  opt[0] = c->a_high; opt[1] = c->kcomh; opt[2] = c->kcomi;
+  opt[3] = c->s_hard; opt[4] = c->s_uncn; opt[5] = c->unr;
+  opt[6] = c->brack; opt[7] = c->kfoli; opt[8] = c->folign;
+  opt[9] = c->gaps; opt[10] = c->para; opt[11] = c->toppar;
+  opt[12] = c->liga; opt[13] = c->white; opt[14] = c->wrap;
+  opt[15] = c->wwidth; opt[16] = c->mute; opt[17] = c->authrm;
+  opt[18] = c->cue; opt[19] = c->auth; opt[20] = c->uloc2;
+
+  h = HashText(0xcbf29ce484222325UL, "ivtt 1.1 cache 2", 16);
+  h = HashText(h, (char *) opt, (long) sizeof(opt));
+  h = HashText(h, c->invar, (long) sizeof(c->invar));
+  h = HashText(h, c->exvar, (long) sizeof(c->exvar));
+  return h;
+}
+
+/*-----------------------------------------------------------*/
+
+void GetCounts(IVTT *c,int *cnt)
+/* Store the line counts of a context */
+{
+  cnt[0] = c->nlpart; cnt[1] = c->nlread; cnt[2] = c->nldrop;
+  cnt[3] = c->nlhash; cnt[4] = c->nlempt; cnt[5] = c->nlwrit;
+  cnt[6] = c->nlwrap;
+}
+
+/*-----------------------------------------------------------*/
+
+void PutCounts(IVTT *c,int *cnt)
+/* Add stored line counts to those of a context */
+{
+  c->nlpart += cnt[0]; c->nlread += cnt[1]; c->nldrop += cnt[2];
+  c->nlhash += cnt[3]; c->nlempt += cnt[4]; c->nlwrit += cnt[5];
+  c->nlwrap += cnt[6];
+}
+
+/*-----------------------------------------------------------*/
+
+struct ivtt_centry *NewEntry(struct ivtt_cache *cc)
+/* Add an empty entry to the cache */
+/* Return NULL if out of memory */
+{
+  struct ivtt_centry *pe;
+
+  if (cc->n >= cc->nmax) {
+    if (ResizeMem((void **) &cc->e,
+                  (long) sizeof(struct ivtt_centry) * (2 * cc->nmax + 256))) {
+      return NULL;
+    }
+    cc->nmax = 2 * cc->nmax + 256;
+  }
+  pe = &cc->e[cc->n++];
+  memset(pe, 0, sizeof(struct ivtt_centry));
+  return pe;
+}
+
+/*-----------------------------------------------------------*/
+
+void ReadCache(char *fname,struct ivtt_cache *cc)
+/* Read the cache file, if there is a valid one. It starts with
+   the number of the run that wrote it. Each entry is a line with
+   the hash values, the run in which it was last used and the sizes,
+   followed by the output and the messages */
+{
+  FILE *fc;
+  struct ivtt_centry *pe;
+  char *pos, *end, *eol;
+  long flen;
+  int *k;
+
+  memset(cc, 0, sizeof(struct ivtt_cache));
+  cc->run = 1;
+  if ((fc = fopen(fname, "rb")) == NULL) return;
+  if (fseek(fc, 0L, SEEK_END) == 0 && (flen = ftell(fc)) > 0 &&
+      fseek(fc, 0L, SEEK_SET) == 0 &&
+      (cc->file = (char *) malloc(flen)) != NULL &&
+      fread(cc->file, 1, flen, fc) == (size_t) flen) {
+    pos = cc->file; end = cc->file + flen;
+    eol = (char *) memchr(pos, '\n', end - pos);
+    if (eol != NULL) *eol = 0;
+    if (eol == NULL || sscanf(pos, "#=IVTT cache 2 %ld", &cc->run) != 1 ||
+        cc->run < 0) {
+      cc->run = 0; end = pos;
+    } else {
+      pos = eol + 1;
+    }
+    cc->run += 1;
+    while (pos < end && (eol = (char *) memchr(pos, '\n', end - pos)) != NULL) {
+      if ((pe = NewEntry(cc)) == NULL) break;
+      *eol = 0; k = pe->cnt;
+      if (sscanf(pos, "E %lx %lx %d %ld %ld %ld %d %d %d %d %d %d %d",
+                 &pe->phash, &pe->okey, &pe->first, &pe->last, &pe->olen, &pe->elen,
+                 &k[0], &k[1], &k[2], &k[3], &k[4], &k[5], &k[6]) != 13 ||
+          pe->olen < 0 || pe->elen < 0 || pe->olen + pe->elen > end - eol - 1) {
+        cc->n -= 1; break;
+      }
+      pe->obuf = eol + 1; pe->ebuf = pe->obuf + pe->olen;
+      pos = pe->ebuf + pe->elen;
+    }
+  }
+  fclose(fc);
+}
+
+/*-----------------------------------------------------------*/
+
+int WriteCache(char *fname,struct ivtt_cache *cc)
+/* Write the cache file, through a temporary file. Entries that were
+   not used in the last CACHEAGE runs are dropped. If the others
+   would take more than CACHEMAX bytes, those used longest ago are
+   dropped too, but never those used in this run */
+/* Return 0 if all OK, 1 if it could not be written */
+{
+  FILE *fc;
+  struct ivtt_centry *pe;
+  char *tname;
+  long size[CACHEAGE], tot, age;
+  int i, *k, bad, keep;
+
+  /* Bytes per age, from which follows the oldest age kept */
+  memset(size, 0, sizeof(size));
+  for (i=0; i<cc->n; i++) {
+    pe = &cc->e[i];
+    age = cc->run - pe->last;
+    if (age >= 0 && age < CACHEAGE) size[age] += pe->olen + pe->elen + 64;
+  }
+  tot = size[0];
+  for (keep=1; keep<CACHEAGE; keep++) {
+    if (tot + size[keep] > CACHEMAX) break;
+    tot += size[keep];
+  }
+
+  tname = (char *) malloc(strlen(fname) + 5);
+  if (tname == NULL) return 1;
+  sprintf(tname, "%s.tmp", fname);
+  if ((fc = fopen(tname, "wb")) == NULL) {
+    free(tname);
+    return 1;
+  }
+  fprintf (fc, "#=IVTT cache 2 %ld\n", cc->run);
+  for (i=0; i<cc->n; i++) {
+    pe = &cc->e[i];
+    age = cc->run - pe->last;
+    if (age < 0 || age >= keep) continue;
+    k = pe->cnt;
+    fprintf (fc, "E %lx %lx %d %ld %ld %ld %d %d %d %d %d %d %d\n",
+             pe->phash, pe->okey, pe->first, pe->last, pe->olen, pe->elen,
+             k[0], k[1], k[2], k[3], k[4], k[5], k[6]);
+    fwrite(pe->obuf, 1, pe->olen, fc);
+    fwrite(pe->ebuf, 1, pe->elen, fc);
+  }
+  bad = (fclose(fc) != 0);
+  if (bad == 0) bad = (rename(tname, fname) != 0);
+  if (bad) remove(tname);
+  free(tname);
+  return bad;
+}
+
+/*-----------------------------------------------------------*/
+
+int RunCache(IVTT *c,char *argv[],char *data,long len)
+/* Process the complete input in data page by page, taking the
+   result of pages that did not change from the cache file */
+/* Return the exit code: 3 if all OK */
+{
+  struct ivtt_cache cc;
+  struct ivtt_centry *pe;
+  struct ivtt_chunk ch;
+  IVTT *tmpl, tot;
+  unsigned long okey, ph;
+  long pos, end;
+  char *eol;
+  int i, first, nhit = 0, nrun = 0, iret = 3, held = 0;
+
+  if (c->lstarg >= 0 || c->nlook > 0) {
+    if (c->mute < 2) fprintf (c->ferr, "%s\n", "The page cache cannot be used with a variant list or look-ups");
+    return (c->status = 2);
+  }
+  if ((tmpl = CloneCtx(c, 0)) == NULL) return (c->status = 4);
+  ReadCache(argv[c->cachearg]+8, &cc);
+  okey = RunKey(c);
+  memset(&tot, 0, sizeof(tot));
+  memset(&ch, 0, sizeof(ch));
+
+  for (pos = 0; pos < len && iret == 3; pos = end) {
+
+    /* The next piece ends before the next page header */
+    end = pos;
+    while (1) {
+      eol = (char *) memchr(data+end, '\n', len-end);
+      if (eol == NULL) {
+        end = len; break;
+      }
+      end = eol - data + 1;
+      if (end >= len || PageStart(c, data, len, end)) break;
+    }
+    first = (pos == 0);
+    ph = HashText(0xcbf29ce484222325UL, data+pos, end-pos);
+
+    for (i=0; i<cc.n; i++) {
+      pe = &cc.e[i];
+      if (pe->phash == ph && pe->okey == okey && pe->first == first) break;
+    }
+    if (i < cc.n) {
+      /* Unchanged: as it was */
+      pe->last = cc.run; nhit += 1;
+      if (pe->elen > 0) fwrite(pe->ebuf, 1, pe->elen, c->ferr);
+      OutBlock(c, pe->obuf, pe->olen);
+      PutCounts(&tot, pe->cnt);
+      continue;
+    }
+
+    /* Changed or new: process it */
+    nrun += 1;
+    ch.data = data+pos; ch.len = end-pos;
+    ch.c = CloneCtx(tmpl, first == 0);
+    if (ch.c == NULL || ChunkOpen(&ch)) {
+      if (c->mute < 2) fprintf (c->ferr, "%s\n", "Out of memory");
+      iret = 4;
+    } else {
+      iret = RunChunk(ch.c, ch.data, ch.len);
+
+      /* A @...; code left open continues into the next page,
+         so the rest of the input is done at once */
+      if (iret == 3 && end < len && (ch.c->hasc0 >= 0 || ch.c->hasc1 >= 0)) {
+        held = 1;
+        iret = RunChunk(ch.c, data+end, len-end);
+        end = len;
+      }
+      fflush(ch.fo); fflush(ch.fe);
+      if (ch.elen > 0) fwrite(ch.ebuf, 1, ch.elen, c->ferr);
+      OutBlock(c, ch.obuf, (long) ch.olen);
+
+      /* Keep the result of a page that went well */
+      if (iret == 3 && held == 0 && (pe = NewEntry(&cc)) != NULL) {
+        pe->phash = ph; pe->okey = okey; pe->first = first;
+        pe->last = cc.run; pe->own = 1;
+        GetCounts(ch.c, pe->cnt);
+        pe->olen = (long) ch.olen; pe->elen = (long) ch.elen;
+        pe->obuf = (char *) malloc(pe->olen + pe->elen + 1);
+        if (pe->obuf == NULL) {
+          cc.n -= 1;
+        } else {
+          memcpy(pe->obuf, ch.obuf, pe->olen);
+          pe->ebuf = pe->obuf + pe->olen;
+          memcpy(pe->ebuf, ch.ebuf, pe->elen);
+        }
+      }
+    }
+    if (ch.c != NULL) {
+      AddStats(&tot, ch.c);
+      ChunkClose(&ch); FreeCtx(ch.c); ch.c = NULL;
+    }
+  }
+
+  if (iret == 3) {
+    if (WriteCache(argv[c->cachearg]+8, &cc) && c->mute < 2) {
+      fprintf (c->ferr, "%s\n", "Cannot write the page cache");
+    }
+  }
+  if (c->mute == 0) {
+    fprintf (c->ferr, "\n%7d pages taken from the cache\n", nhit);
+    fprintf (c->ferr, "%7d pages processed\n", nrun);
+  }
+
+  for (i=0; i<cc.n; i++) {
+    if (cc.e[i].own) free(cc.e[i].obuf);
+  }
+  free(cc.e); free(cc.file);
+  FreeCtx(tmpl);
+  AddStats(c, &tot);
+  return (c->status = iret);
+}
+
+/*-----------------------------------------------------------*/
+
+#ifndef IVTT_NOMAIN
+
+int main(int argc,char *argv[])
+/*int argc;
+char *argv[];*/
+{
+  IVTT *c;
+  struct stat st;
+  char *map, *blk, *nblk;
+  long nget, nall;
+  int iret;
+
+  /* For reference: */
+  char *what = "@(#)ivtt\t\t1.1\t2020/04/10 RZ\n";
+
+  /* Parse command line options */
+  c = ivtt_open(argc, argv);
+  if (c == NULL) return 8;
+
+  /* List summary of options and open files as needed */  
+  if (DumpOpts(c, argc, argv)) {
+    if (c->mute < 2) fprintf (stderr, "%s\n", "Error opening file(s)");
+    return 2;
+  }  
+  OutInit(c);
+  if (c->mute == 0) fprintf (stderr, "\n%s\n", "Starting...");
+
+  /* Pass the whole input file at once if it can be mapped,
+     otherwise read it in blocks */
+  map = NULL;
+  if (fstat(fileno(c->fin), &st) == 0 && S_ISREG(st.st_mode) &&
+      st.st_size > 0) {
+    map = (char *) mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE,
+                        fileno(c->fin), 0);
+    if (map == (char *) MAP_FAILED) map = NULL;
+  }
+  if (c->njob > 1 || c->lstarg >= 0 || c->idxopt || c->nlook > 0 ||
+      c->cachearg >= 0) {
+    /* Variants, page-parallel processing, the locus index and
+       the page cache need all input at once */
+    if (map != NULL) {
+      blk = map; nall = (long) st.st_size;
+    } else {
+      nall = 0; nget = INBLK;
+      blk = (char *) malloc(nget);
+      while (blk != NULL) {
+        nall += (long) fread(blk+nall, 1, nget-nall, c->fin);
+        if (nall < nget) break;
+        nget *= 2;
+        if ((nblk = (char *) realloc(blk, nget)) == NULL) free(blk);
+        blk = nblk;
+      }
+    }
+    if (blk == NULL) {
+      if (c->mute < 2) fprintf (stderr, "%s\n", "Out of memory");
+      c->status = 4;
+    } else if (c->idxopt) {
+      iret = RunIndex(c, argv, blk, nall, &st);
+      iret = OutEnd(c, iret); FreeCtx(c);
+      return iret;
+    } else if (c->cachearg >= 0) {
+      (void) RunCache(c, argv, blk, nall);
+    } else if (c->nlook > 0) {
+      (void) RunLook(c, argv, blk, nall, &st);
+    } else if (c->lstarg >= 0) {
+      iret = RunList(c, argc, argv, blk, nall);
+      iret = OutEnd(c, iret); FreeCtx(c);
+      return iret;
+    } else {
+      (void) ivtt_pages(c, blk, nall);
+    }
+  } else if (map != NULL) {
+    (void) madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+    (void) ivtt_feed(c, map, (long) st.st_size);
+  } else {
+    blk = (char *) malloc(INBLK);
+    if (blk != NULL) {
+      while ((nget = (long) fread(blk, 1, INBLK, c->fin)) > 0) {
+        if (ivtt_feed(c, blk, nget) != 0) break;
+      }
+    }
+  }
+
+  return ivtt_finish(c);
+}
+
+#endif
@@ -0,0 +1,104 @@
+/*
+   Intermediate Voynich Transliteration Tool - engine interface.
+
+   All state of a run is kept in an IVTT context, so several
+   contexts may be used at the same time, e.g. one per thread.
+   Compile ivtt.c with -DIVTT_NOMAIN to use it as a library.
+
+   c = ivtt_open(argc, argv)   Options as on the command line
+                               (argv[0] is ignored)
+   ivtt_output(c, fn, arg)     Optional: output goes to fn(arg, buf, len)
+                               instead of standard output
+   ivtt_feed(c, data, len)     Process input, any number of times
+   ivtt_pages(c, data, len)    Or: process all input at once, cut at
+                               page headers, on the threads given by -jN
+   ivtt_finish(c)              Process the rest, flush and release
+
+   The feed and finish functions return 0 while all is well, and
+   otherwise the exit code of the ivtt program (3 = normal end).
+
+   With --corpus=<file> the text written to the output is also
+   stored as a binary corpus, which can be mapped into memory and
+   used as it is. The file starts with the header below. All
+   numbers are 32-bit, in the byte order of the machine that wrote
+   the file (endian reads 0x01020304 when it matches), and every
+   section starts at a multiple of 8 bytes. The sections are:
+
+   off[IVTT_C_TOK]    uint32 tok[ntok]       Word ID of each token
+   off[IVTT_C_FLAG]   uint8 flag[ntok]       IVTT_F_.. bits of each token
+   off[IVTT_C_LINE]   uint32 line[nline+1]   First token of each line
+   off[IVTT_C_LLOC]   uint32 lloc[nline]     Locus of each line
+   off[IVTT_C_PAR]    uint32 par[npar+1]     First line of each paragraph
+   off[IVTT_C_LFOL]   uint32 lfol[nlocus]    Folio of each locus
+   off[IVTT_C_LNUM]   uint32 lnum[nlocus]    Number of each locus
+   off[IVTT_C_FOL]    char fol[nfolio][8]    Folio names
+   off[IVTT_C_VOFF]   uint32 voff[nword+1]   Start of each word in pool
+   off[IVTT_C_POOL]   char pool[npool]       The words, each ending in 0
+   off[IVTT_C_UNC]    ivtt_urec unc[nunc]    The uncertain tokens
+
+   The last entry of line, par and voff is ntok, nline and npool.
+   Words are numbered in the order in which they first appear.
+   A token is uncertain if it contains ?, [a:b] or an uncertain
+   space. With --uncert=<file> the same records are also written
+   as JSON lines.
+*/
+
+#ifndef IVTT_H
+#define IVTT_H
+
+typedef struct ivtt_ctx IVTT;
+
+IVTT *ivtt_open(int argc,char *argv[]);
+void ivtt_output(IVTT *c,int (*outfn)(void *,char *,int),void *outarg);
+int ivtt_feed(IVTT *c,char *data,long len);
+int ivtt_pages(IVTT *c,char *data,long len);
+int ivtt_finish(IVTT *c);
+
+#define IVTT_CORPUS "IVTTCORP"
+#define IVTT_C_TOK 0
+#define IVTT_C_FLAG 1
+#define IVTT_C_LINE 2
+#define IVTT_C_LLOC 3
+#define IVTT_C_PAR 4
+#define IVTT_C_LFOL 5
+#define IVTT_C_LNUM 6
+#define IVTT_C_FOL 7
+#define IVTT_C_VOFF 8
+#define IVTT_C_POOL 9
+#define IVTT_C_UNC 10
+#define IVTT_C_NSEC 11
+
+/* Token flags: what the token contains */
+#define IVTT_F_SINGLE 1   /* A single unreadable character ? */
+#define IVTT_F_SEQ 2      /* A sequence of them ??? */
+#define IVTT_F_ALT 4      /* An alternate reading [a:b] */
+#define IVTT_F_SPACE 8    /* An uncertain space , */
+#define IVTT_F_LIGA 16    /* A ligature bracket { } */
+#define IVTT_F_HIGH 32    /* High Ascii, also as @...; */
+/* The flags that make a token uncertain */
+#define IVTT_F_UNC (IVTT_F_SINGLE | IVTT_F_SEQ | IVTT_F_ALT | IVTT_F_SPACE)
+
+struct ivtt_corphead {
+  char magic[8];          /* IVTT_CORPUS */
+  unsigned int version;   /* 1 */
+  unsigned int endian;    /* 0x01020304 */
+  unsigned int ntok, nline, npar, nlocus, nfolio, nword, npool;
+  unsigned int nunc;
+  unsigned int off[IVTT_C_NSEC]; /* Byte offset of each section */
+  unsigned int spare;
+};
+
+/* One uncertain token. Its left context are the tokens from lbeg
+   up to tok, its right context those after tok up to lend */
+struct ivtt_urec {
+  unsigned int tok;       /* Position of the token */
+  unsigned int word;      /* Its word ID */
+  unsigned int lbeg, lend; /* Tokens of its line */
+  unsigned int pbeg, pend; /* Tokens of its paragraph */
+  unsigned int locus;     /* Its locus */
+  unsigned char flag;     /* IVTT_F_.. bits */
+  unsigned char qrun;     /* Longest run of ? */
+  unsigned char spare[2];
+};
+
+#endif
@@ -0,0 +1,518 @@
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "math.h"
+#include "fcntl.h"
+#include "unistd.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+#ifdef __AVX2__
+#include "immintrin.h"
+#endif
+#include "wvscore.h"
+
+/*
+   Embedding scorer, see wvscore.h.
+
+   For an alternative of one word, the context vector is the sum of
+   the context rows, normalised, and the score is the cosine between
+   it and the row of the word. For an alternative of n words, word i
+   gets its own context: the left context from word i on, the other
+   words of the alternative and the right context up to n-i-1 words
+   from its end, with the slicing rules of Python. The score is the
+   mean over the words. Suffix sums of the left context and prefix
+   sums of the right one give each of these sums in a few additions.
+
+   The words are found in a hash table (FNV-1a, open addressing) of
+   the words of the rows, so that a whole list of alternatives is
+   turned into rows in one call of wvs_find.
+*/
+
+struct wvscore {
+  char *map;        /* The mapped file */
+  long size;
+  float *vec;       /* Row i of the file is vec[i*dim] .. */
+  float *copy;      /* Rows copied from a file where they are not aligned */
+  char **word;      /* Word of each row, NULL until the words of a
+                       .npy file are given */
+  unsigned int *hash; /* Row+1 of each word, 0 for a free place */
+  long hsize;
+  int nhash;        /* Rows in the table */
+  int nfile;        /* Rows in the file */
+  int dim;
+  float *extra;     /* Rows added by wvs_add */
+  int nextra, mextra;
+  float *norm;      /* Norm of each row, the file rows then the added ones */
+  float *work;      /* Sums of the context, see wvs_score */
+  long mwork;
+};
+
+/*-----------------------------------------------------------*/
+
+float *Row(WVS *s,int i)
+/* Return row i */
+{
+  if (i < s->nfile) return s->vec + (long) i * s->dim;
+  return s->extra + (long) (i - s->nfile) * s->dim;
+}
+
+/*-----------------------------------------------------------*/
+
+float Dot(float *a,float *b,int n)
+/* Return the dot product of two vectors */
+{
+  float sum = 0;
+  int i = 0;
+#ifdef __AVX2__
+  __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+  __m128 half;
+
+  for ( ; i+16<=n; i+=16) {
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i), acc0);
+    acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i+8), _mm256_loadu_ps(b+i+8), acc1);
+  }
+  for ( ; i+8<=n; i+=8) {
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i), acc0);
+  }
+  acc0 = _mm256_add_ps(acc0, acc1);
+  half = _mm_add_ps(_mm256_castps256_ps128(acc0), _mm256_extractf128_ps(acc0, 1));
+  half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+  half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+  sum = _mm_cvtss_f32(half);
+#else
+  float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+  for ( ; i+4<=n; i+=4) {
+    s0 += a[i] * b[i]; s1 += a[i+1] * b[i+1];
+    s2 += a[i+2] * b[i+2]; s3 += a[i+3] * b[i+3];
+  }
+  sum = (s0 + s1) + (s2 + s3);
+#endif
+  for ( ; i<n; i++) sum += a[i] * b[i];
+  return sum;
+}
+
+/*-----------------------------------------------------------*/
+
+void AddVec(float *out,float *a,float *b,int n)
+/* Set out to a + b, out may be a or b */
+{
+  int i = 0;
+#ifdef __AVX2__
+  for ( ; i+8<=n; i+=8) {
+    _mm256_storeu_ps(out+i, _mm256_add_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i)));
+  }
+#endif
+  for ( ; i<n; i++) out[i] = a[i] + b[i];
+}
+
+/*-----------------------------------------------------------*/
+
+void DivVec(float *out,float *a,float d,int n)
+/* Set out to a / d */
+{
+  int i = 0;
+#ifdef __AVX2__
+  __m256 vd = _mm256_set1_ps(d);
+
+  for ( ; i+8<=n; i+=8) {
+    _mm256_storeu_ps(out+i, _mm256_div_ps(_mm256_loadu_ps(a+i), vd));
+  }
+#endif
+  for ( ; i<n; i++) out[i] = a[i] / d;
+}
+
+/*-----------------------------------------------------------*/
+
+void FreeWords(WVS *s)
+/* Release the words of the rows and their table */
+{
+  int i;
+
+  if (s->word != NULL) {
+    for (i=0; s->word[i] != NULL; i++) free(s->word[i]);
+    free(s->word);
+  }
+  free(s->hash);
+  s->word = NULL; s->hash = NULL; s->hsize = 0; s->nhash = 0;
+}
+
+/*-----------------------------------------------------------*/
+
+unsigned int HashOf(char *w,int len)
+/* Return the FNV-1a hash of a word */
+{
+  unsigned int h = 2166136261U;
+  int k;
+
+  for (k=0; k<len; k++) h = (h ^ (unsigned char) w[k]) * 16777619U;
+  return h;
+}
+
+/*-----------------------------------------------------------*/
+
+int HashWords(WVS *s)
+/* Put the words of the rows that are not yet there into the table,
+   which is kept at most half full. The first of two equal words
+   is the one found */
+/* Return 0 if all OK, 1 if out of memory */
+{
+  unsigned int *nhash;
+  long i, nsize;
+  int row, nrow = s->nfile + s->nextra, len;
+
+  if (2L * nrow + 2 > s->hsize) {
+    for (nsize=1024; nsize < 2L * nrow + 2; nsize *= 2) ;
+    nhash = (unsigned int *) calloc(nsize, sizeof(unsigned int));
+    if (nhash == NULL) return 1;
+    free(s->hash);
+    s->hash = nhash; s->hsize = nsize; s->nhash = 0;
+  }
+  for (row=s->nhash; row<nrow; row++) {
+    len = strlen(s->word[row]);
+    for (i=HashOf(s->word[row], len) & (s->hsize-1); s->hash[i]; i=(i+1) & (s->hsize-1)) {
+      if (strcmp(s->word[s->hash[i]-1], s->word[row]) == 0) break;
+    }
+    if (s->hash[i] == 0) s->hash[i] = (unsigned int) row + 1;
+  }
+  s->nhash = nrow;
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int FindWord(WVS *s,char *w,int len)
+/* Return the row of a word, -1 if it has none */
+{
+  long i;
+  char *r;
+
+  for (i=HashOf(w, len) & (s->hsize-1); s->hash[i]; i=(i+1) & (s->hsize-1)) {
+    r = s->word[s->hash[i]-1];
+    if (memcmp(r, w, len) == 0 && r[len] == 0) return s->hash[i] - 1;
+  }
+  return -1;
+}
+
+/*-----------------------------------------------------------*/
+
+int ReadNpy(WVS *s)
+/* Find the matrix in a mapped .npy file: float32, two dimensions,
+   C order */
+/* Return 0 if all OK, 1 if not such a file */
+{
+  char *head, *p;
+  long hbeg, hlen, nrow, dim;
+
+  /* The magic string, the version and the length of the header,
+     which is the text of a Python dict */
+  if (s->size < 10 || memcmp(s->map, "\223NUMPY", 6) != 0) return 1;
+  if (s->map[6] == 1) {
+    hbeg = 10;
+    hlen = (unsigned char) s->map[8] | (unsigned char) s->map[9] << 8;
+  } else {
+    if (s->size < 12) return 1;
+    hbeg = 12;
+    hlen = (unsigned char) s->map[8] | (unsigned char) s->map[9] << 8 |
+           (long) (unsigned char) s->map[10] << 16 | (long) (unsigned char) s->map[11] << 24;
+  }
+  if (hbeg + hlen > s->size) return 1;
+  if ((head = (char *) malloc(hlen + 1)) == NULL) return 1;
+  memcpy(head, s->map + hbeg, hlen); head[hlen] = 0;
+  hlen += hbeg;
+  if (strstr(head, "'<f4'") == NULL || strstr(head, "'fortran_order': False") == NULL ||
+      (p = strstr(head, "'shape': (")) == NULL ||
+      sscanf(p + 10, "%ld, %ld)", &nrow, &dim) != 2) {
+    free(head);
+    return 1;
+  }
+  free(head);
+  if (nrow < 0 || dim <= 0 || nrow > 0x7fffffff || hlen + nrow * dim * 4 > s->size) return 1;
+  s->nfile = nrow; s->dim = dim;
+  s->vec = (float *) (s->map + hlen);
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+int ReadW2v(WVS *s)
+/* Find the words and rows of a mapped word2vec binary file. The
+   rows are used in place when they are all aligned, else copied */
+/* Return 0 if all OK, 1 if not such a file or out of memory */
+{
+  char *p, *end = s->map + s->size, line[64];
+  long *off;
+  int nrow, dim, i, n, aligned = 1;
+
+  p = memchr(s->map, '\n', s->size < 63 ? s->size : 63);
+  if (p == NULL) return 1;
+  memcpy(line, s->map, p - s->map); line[p - s->map] = 0;
+  if (sscanf(line, "%d %d", &nrow, &dim) != 2 || nrow < 0 || dim <= 0) return 1;
+  p += 1;
+  s->word = (char **) calloc(nrow+1, sizeof(char *));
+  off = (long *) malloc((nrow+1) * sizeof(long));
+  if (s->word == NULL || off == NULL) {
+    free(off);
+    return 1;
+  }
+  for (i=0; i<nrow; i++) {
+    while (p < end && *p == '\n') p++;
+    for (n=0; p+n < end && p[n] != ' '; n++) ;
+    if (p + n + 1 + 4L * dim > end) {
+      free(off);
+      return 1;
+    }
+    if ((s->word[i] = (char *) malloc(n+1)) == NULL) {
+      free(off);
+      return 1;
+    }
+    memcpy(s->word[i], p, n); s->word[i][n] = 0;
+    p += n + 1;
+    off[i] = p - s->map;
+    if (off[i] % sizeof(float) != 0 || (i > 0 && off[i] - off[i-1] != 4L * dim)) aligned = 0;
+    p += 4L * dim;
+  }
+  s->nfile = nrow; s->dim = dim;
+  if (aligned) {
+    s->vec = (float *) (s->map + (nrow > 0 ? off[0] : 0));
+  } else {
+    s->copy = (float *) malloc((long) nrow * dim * sizeof(float) + 1);
+    if (s->copy == NULL) {
+      free(off);
+      return 1;
+    }
+    for (i=0; i<nrow; i++) memcpy(s->copy + (long) i * dim, s->map + off[i], 4L * dim);
+    s->vec = s->copy;
+  }
+  free(off);
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+WVS *wvs_open(char *fname)
+/* Map an embedding file and compute the norms of its rows */
+/* Return NULL if it cannot be read or is not an embedding file */
+{
+  WVS *s;
+  struct stat st;
+  int fd, i;
+
+  if ((fd = open(fname, O_RDONLY)) < 0) return NULL;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+  s = (WVS *) calloc(1, sizeof(WVS));
+  if (s == NULL) {
+    close(fd);
+    return NULL;
+  }
+  s->size = st.st_size;
+  s->map = (char *) mmap(NULL, s->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (s->map == MAP_FAILED) {
+    s->map = NULL;
+    wvs_close(s);
+    return NULL;
+  }
+  if (ReadNpy(s) && ReadW2v(s)) {
+    wvs_close(s);
+    return NULL;
+  }
+  s->norm = (float *) malloc((s->nfile+1) * sizeof(float));
+  if (s->norm == NULL) {
+    wvs_close(s);
+    return NULL;
+  }
+  for (i=0; i<s->nfile; i++) s->norm[i] = sqrtf(Dot(Row(s, i), Row(s, i), s->dim));
+  if (s->word != NULL && HashWords(s)) {
+    wvs_close(s);
+    return NULL;
+  }
+  return s;
+}
+
+/*-----------------------------------------------------------*/
+
+int wvs_rows(WVS *s)
+/* Return the number of rows, with the added ones */
+{
+  return s->nfile + s->nextra;
+}
+
+/*-----------------------------------------------------------*/
+
+int wvs_dim(WVS *s)
+/* Return the length of the rows */
+{
+  return s->dim;
+}
+
+/*-----------------------------------------------------------*/
+
+int wvs_words(WVS *s,char *text)
+/* Give the words of the rows of a .npy file, one per line, or only
+   check that the rows have words if text is NULL */
+/* Return 1 if the rows have words, 0 if not, -1 if the number of
+   words is not that of the rows or if out of memory */
+{
+  char *p, *q;
+  int i, n;
+
+  if (text == NULL || s->word != NULL) return (s->word != NULL);
+  for (n=1, p=text; *p; p++) if (*p == '\n') n++;
+  if (n != s->nfile || s->nextra > 0) return -1;
+  s->word = (char **) calloc(s->nfile+1, sizeof(char *));
+  if (s->word == NULL) return -1;
+  for (i=0, p=text; i<n; i++, p=q+1) {
+    for (q=p; *q && *q != '\n'; q++) ;
+    if ((s->word[i] = (char *) malloc(q-p+1)) == NULL) {
+      FreeWords(s);
+      return -1;
+    }
+    memcpy(s->word[i], p, q-p); s->word[i][q-p] = 0;
+  }
+  if (HashWords(s)) {
+    FreeWords(s);
+    return -1;
+  }
+  return 1;
+}
+
+/*-----------------------------------------------------------*/
+
+int wvs_find(WVS *s,char *text,int *rows,int *aoff)
+/* Find the rows of the words of some alternatives, one per line
+   and their words separated by blanks. The words of alternative k
+   go to rows[aoff[k]] .. rows[aoff[k+1]-1], -1 for an unknown word */
+/* Return the number of unknown words */
+{
+  char *p = text, *q;
+  int k = 0, n = 0, nbad = 0;
+
+  aoff[0] = 0;
+  for (;;) {
+    for (q=p; *q && *q != ' ' && *q != '\n'; q++) ;
+    rows[n] = (s->hash != NULL) ? FindWord(s, p, q-p) : -1;
+    if (rows[n++] < 0) nbad++;
+    if (*q != ' ') aoff[++k] = n;
+    if (*q == 0) break;
+    p = q+1;
+  }
+  return nbad;
+}
+
+/*-----------------------------------------------------------*/
+
+int wvs_add(WVS *s,char *word,float *vec)
+/* Add a row for a word after those of the file */
+/* Return its number, -1 if out of memory or if the rows have no words */
+{
+  float *nextra, *nnorm;
+  char **nword;
+  int mextra, row = s->nfile + s->nextra;
+
+  if (s->word == NULL) return -1;
+  if (s->nextra == s->mextra) {
+    mextra = (s->mextra == 0) ? 16 : 2 * s->mextra;
+    nextra = (float *) realloc(s->extra, (long) mextra * s->dim * sizeof(float));
+    if (nextra == NULL) return -1;
+    s->extra = nextra;
+    nnorm = (float *) realloc(s->norm, (s->nfile + mextra) * sizeof(float));
+    if (nnorm == NULL) return -1;
+    s->norm = nnorm;
+    nword = (char **) realloc(s->word, (s->nfile + mextra + 1) * sizeof(char *));
+    if (nword == NULL) return -1;
+    s->word = nword;
+    s->mextra = mextra;
+  }
+  if ((s->word[row] = (char *) malloc(strlen(word) + 1)) == NULL) return -1;
+  strcpy(s->word[row], word);
+  s->word[row+1] = NULL;
+  memcpy(s->extra + (long) s->nextra * s->dim, vec, s->dim * sizeof(float));
+  s->norm[row] = sqrtf(Dot(vec, vec, s->dim));
+  s->nextra += 1;
+  if (HashWords(s)) {
+    s->nextra -= 1;
+    free(s->word[row]); s->word[row] = NULL;
+    return -1;
+  }
+  return row;
+}
+
+/*-----------------------------------------------------------*/
+
+int wvs_score(WVS *s,int *left,int nleft,int *right,int nright,
+              int *alt,int *aoff,int nalt,float *score)
+/* Score each alternative, see wvscore.h */
+/* Return 0 if all OK, 1 for a bad row or if out of memory */
+{
+  float *lsum, *rsum, *glob, *cont, *wrow, sim;
+  long need;
+  int i, j, k, n, e, nrow = s->nfile + s->nextra, dim = s->dim;
+
+  for (i=0; i<nleft; i++) if (left[i] < 0 || left[i] >= nrow) return 1;
+  for (i=0; i<nright; i++) if (right[i] < 0 || right[i] >= nrow) return 1;
+  for (i=0; i<aoff[nalt]; i++) if (alt[i] < 0 || alt[i] >= nrow) return 1;
+
+  /* lsum[i] is the sum of left[i..], rsum[j] that of right[..j-1] */
+  need = (long) (nleft + nright + 4) * dim;
+  if (need > s->mwork) {
+    free(s->work);
+    if ((s->work = (float *) malloc(need * sizeof(float))) == NULL) {
+      s->mwork = 0;
+      return 1;
+    }
+    s->mwork = need;
+  }
+  lsum = s->work; rsum = lsum + (long) (nleft+1) * dim;
+  glob = rsum + (long) (nright+1) * dim; cont = glob + dim;
+  memset(lsum + (long) nleft * dim, 0, dim * sizeof(float));
+  for (i=nleft-1; i>=0; i--) {
+    AddVec(lsum + (long) i * dim, lsum + (long) (i+1) * dim, Row(s, left[i]), dim);
+  }
+  memset(rsum, 0, dim * sizeof(float));
+  for (j=0; j<nright; j++) {
+    AddVec(rsum + (long) (j+1) * dim, rsum + (long) j * dim, Row(s, right[j]), dim);
+  }
+  AddVec(glob, lsum, rsum + (long) nright * dim, dim);
+  DivVec(glob, glob, sqrtf(Dot(glob, glob, dim)), dim);
+
+  for (k=0; k<nalt; k++) {
+    n = aoff[k+1] - aoff[k];
+    if (n == 1) {
+      score[k] = Dot(Row(s, alt[aoff[k]]), glob, dim) / s->norm[alt[aoff[k]]];
+      continue;
+    }
+    score[k] = 0;
+    for (i=0; i<n; i++) {
+      /* context_right[:len(context_right)-n+i+1] */
+      e = nright - n + i + 1;
+      if (e < 0) e += nright;
+      if (e < 0) e = 0;
+      AddVec(cont, lsum + (long) (i < nleft ? i : nleft) * dim, rsum + (long) e * dim, dim);
+      for (j=0; j<n; j++) {
+        if (j != i) AddVec(cont, cont, Row(s, alt[aoff[k]+j]), dim);
+      }
+      DivVec(cont, cont, sqrtf(Dot(cont, cont, dim)), dim);
+      wrow = Row(s, alt[aoff[k]+i]);
+      sim = Dot(wrow, cont, dim) / s->norm[alt[aoff[k]+i]];
+      score[k] += sim;
+    }
+    score[k] /= n;
+  }
+  return 0;
+}
+
+/*-----------------------------------------------------------*/
+
+void wvs_close(WVS *s)
+/* Release a scorer */
+{
+  if (s == NULL) return;
+  FreeWords(s);
+  if (s->map != NULL) munmap(s->map, s->size);
+  free(s->copy); free(s->extra); free(s->norm); free(s->work);
+  free(s);
+}
@@ -0,0 +1,57 @@
+/*
+   Embedding scorer - the cosine scores of predict_uncertain_word in
+   validation.py, for a whole list of alternatives in one call.
+
+   The embedding matrix is mapped from its file, which is either a
+   .npy file of float32 (e.g. np.save of model.wv.vectors, the words
+   being given apart) or a word2vec binary file (e.g. written by
+   model.wv.save_word2vec_format with binary=True). The norms of the
+   rows are computed once when the file is opened. Build it as a
+   shared library for the Python binding:
+
+     cc -O3 -mavx2 -mfma -shared -fPIC -o libwvscore.so wvscore.c
+
+   Without -mavx2 the same sums are made with portable loops.
+
+   s = wvs_open(fname)          Map an embedding file
+   wvs_rows(s), wvs_dim(s)      Number of rows and their length
+   wvs_words(s, text)           Give the words of the rows of a .npy
+                                file, one per line. Return 1 if the
+                                rows have words (text may be NULL to
+                                only check), 0 if not, -1 on error
+   wvs_find(s, text, rows, aoff)
+                                Find the rows of the words of a list
+                                of alternatives, one per line and the
+                                words separated by blanks, -1 for an
+                                unknown word. The words of alternative
+                                k go to rows[aoff[k]] to
+                                rows[aoff[k+1]-1]. Return the number of
+                                unknown words
+   wvs_add(s, word, vec)        Add a row for a word that is not in the
+                                file, and return its number (-1 if out
+                                of memory)
+   wvs_score(s, left, nleft, right, nright, alt, aoff, nalt, score)
+                                Score the alternatives in the context
+                                of rows left[] and right[]. The words
+                                of alternative k are rows alt[aoff[k]]
+                                to alt[aoff[k+1]-1]. Return 0 if all
+                                OK, 1 for a bad row or no memory
+   wvs_close(s)                 Release the scorer
+*/
+
+#ifndef WVSCORE_H
+#define WVSCORE_H
+
+typedef struct wvscore WVS;
+
+WVS *wvs_open(char *fname);
+int wvs_rows(WVS *s);
+int wvs_dim(WVS *s);
+int wvs_words(WVS *s,char *text);
+int wvs_find(WVS *s,char *text,int *rows,int *aoff);
+int wvs_add(WVS *s,char *word,float *vec);
+int wvs_score(WVS *s,int *left,int nleft,int *right,int nright,
+              int *alt,int *aoff,int nalt,float *score);
+void wvs_close(WVS *s);
+
+#endif
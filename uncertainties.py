@@ -1,9 +1,15 @@
 import re
+import os
+import ctypes
 import itertools
 
 
 ALT_READING = r'\[(\S*?):(\S*?)\]'
 
+# Native alternatives generator, built from software/altgen.c
+ALTGEN_LIBRARY = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'software', 'libaltgen.so')
+_altgen = None
+
 
 class Uncertainty:
     '''
@@ -144,8 +150,328 @@ def create_alternatives(uncertain_word, uncertainty_chars, alphabet):
     return alternatives_joined
 
 
+def load_altgen():
+    '''
+    Load the native alternatives generator.
+
+    Returns:
+        (ctypes.CDLL): the library, or None if it has not been built
+    '''
+    global _altgen
+    if _altgen is None:
+        try:
+            lib = ctypes.CDLL(ALTGEN_LIBRARY)
+        except OSError:
+            _altgen = False
+            return None
+        strings = ctypes.POINTER(ctypes.c_char_p)
+        lib.altgen_open.restype = ctypes.c_void_p
+        lib.altgen_open.argtypes = [ctypes.c_char_p, strings, ctypes.c_int, strings, ctypes.c_int]
+        lib.altgen_count.restype = ctypes.c_longlong
+        lib.altgen_count.argtypes = [ctypes.c_void_p]
+        lib.altgen_fill.restype = ctypes.c_long
+        lib.altgen_fill.argtypes = [ctypes.c_void_p, ctypes.c_longlong, ctypes.c_long, ctypes.c_char_p, ctypes.c_long]
+        lib.altgen_close.restype = None
+        lib.altgen_close.argtypes = [ctypes.c_void_p]
+        lib.altgen_prune.restype = ctypes.c_longlong
+        lib.altgen_prune.argtypes = [ctypes.c_void_p, ctypes.c_void_p]
+        lib.altgen_total.restype = ctypes.c_longlong
+        lib.altgen_total.argtypes = [ctypes.c_void_p]
+        lib.altvoc_open.restype = ctypes.c_void_p
+        lib.altvoc_open.argtypes = [strings, ctypes.c_int]
+        lib.altvoc_close.restype = None
+        lib.altvoc_close.argtypes = [ctypes.c_void_p]
+        _altgen = lib
+    return _altgen or None
+
+
+class Vocabulary:
+    '''
+    Trie of the words of a vocabulary, e.g. of a trained model, built once and shared
+    by all the Alternatives that are limited to it.
+
+    Attributes:
+        words (set of str): the words
+    '''
+
+    def __init__(self, words):
+        self.words = set(words)
+        self._voc = None
+        self._trie = None
+        self._lib = lib = load_altgen()
+        if lib is not None:
+            encoded = [word.encode() for word in self.words]
+            self._voc = lib.altvoc_open((ctypes.c_char_p * len(encoded))(*encoded), len(encoded))
+            if not self._voc:
+                raise MemoryError('Cannot build the vocabulary trie')
+        else:
+            # The end of a word is marked by an empty key
+            self._trie = {}
+            for word in self.words:
+                node = self._trie
+                for char in word:
+                    node = node.setdefault(char, {})
+                node[''] = True
+
+    def __del__(self):
+        if self._voc:
+            self._lib.altvoc_close(self._voc)
+            self._voc = None
+
+    def __contains__(self, word):
+        return word in self.words
+
+    def __len__(self):
+        return len(self.words)
+
+
+class Alternatives:
+    '''
+    Lazy list of the alternatives of an uncertain word. It holds the same alternatives
+    as create_alternatives, with the same repetitions but in another order, and makes
+    them in batches only when they are needed.
+
+    The word is cut at its uncertain spaces, and each piece has one form for each way of
+    resolving its alternate readings. A form is a sequence of fixed text, single
+    uncertainties and uncertain sequences, so that the alternatives can be counted and
+    numbered without making them. The native generator of software/altgen.c is used
+    when it has been built, otherwise the same numbering is done in Python.
+
+    With a vocabulary, only the alternatives made of words of the vocabulary are kept.
+    They are found by following the vocabulary trie while the letters are chosen, so that
+    the alternatives that cannot be in the vocabulary are never made.
+
+    Attributes:
+        uncertain_word (str): the uncertain word
+        native (bool): True if the native generator is used
+        total (int): number of alternatives before pruning, None if too many to count
+    '''
+
+    def __init__(self, uncertain_word, uncertainty_chars, alphabet, batch_size=4096, vocabulary=None):
+        self.uncertain_word = uncertain_word
+        self.batch_size = batch_size
+        self.letters = [letter for letter in alphabet]
+        single = uncertainty_chars['SINGLE_UNCERTAINTY']
+        self.marks = [single, uncertainty_chars['UNCERTAIN_SEQUENCE'], uncertainty_chars['UNCERTAIN_SPACE']]
+        # Marks that no branch of create_alternatives resolves drop the alternative
+        self.marks += [value for key, value in uncertainty_chars.items() if value not in self.marks
+                       and value.replace(single, '') != '']
+        self._gen = None
+        self._buffer = None
+        self._kept = None
+        self._lib = lib = load_altgen()
+        self.native = lib is not None
+        if self.native:
+            letters = (ctypes.c_char_p * len(self.letters))(*[x.encode() for x in self.letters])
+            marks = (ctypes.c_char_p * len(self.marks))(*[x.encode() for x in self.marks])
+            self._gen = lib.altgen_open(uncertain_word.encode(), letters, len(self.letters),
+                                        marks, len(self.marks))
+            if not self._gen:
+                raise MemoryError('Cannot set up the alternatives of ' + uncertain_word)
+            self.total = lib.altgen_count(self._gen)
+            if vocabulary is not None and lib.altgen_prune(self._gen, vocabulary._voc) < 0:
+                raise MemoryError('Cannot prune the alternatives of ' + uncertain_word)
+            self._count = lib.altgen_count(self._gen)
+            if self._count < 0:
+                raise OverflowError('Too many alternatives for ' + uncertain_word)
+            if self.total < 0:
+                self.total = None
+        else:
+            self._pieces = self._cut(uncertain_word)
+            self.total = 2 ** (len(self._pieces) - 1)
+            for forms, count in self._pieces:
+                self.total *= count
+            self._count = self.total
+            if vocabulary is not None:
+                self._kept = self._prune(vocabulary._trie)
+                self._count = len(self._kept)
+
+    def __del__(self):
+        if self._gen:
+            self._lib.altgen_close(self._gen)
+            self._gen = None
+
+    def __len__(self):
+        return self._count
+
+    def __iter__(self):
+        for start in range(0, self._count, self.batch_size):
+            yield from self.batch(start, self.batch_size)
+
+    def batch(self, start, n):
+        '''
+        Make some of the alternatives.
+
+        Args:
+            start (int): number of the first alternative
+            n (int): number of alternatives
+
+        Returns:
+            (list of str): alternatives start to start+n-1, or fewer at the end
+        '''
+        n = max(0, min(n, self._count - start))
+        if not self.native:
+            return [self._make(i) for i in range(start, start + n)]
+        result = []
+        while len(result) < n:
+            if self._buffer is None:
+                self._buffer = ctypes.create_string_buffer(1 << 16)
+            got = self._lib.altgen_fill(self._gen, start + len(result), n - len(result),
+                                      self._buffer, len(self._buffer))
+            if got <= 0:
+                self._buffer = ctypes.create_string_buffer(2 * len(self._buffer))
+                continue
+            result += self._buffer.raw.split(b'\0', got)[:got]
+        return [x.decode() for x in result]
+
+    def _cut(self, word):
+        '''
+        Cut a word into pieces and forms, as altgen_open does.
+
+        Returns:
+            (list of (list of (list of (str, str), int), int)): for each piece its forms and
+                number of alternatives. A form is a list of slots ('lit', text), ('one', '')
+                or ('seq', ''), with its number of alternatives
+        '''
+        single, sequence, space = self.marks[:3]
+        nletters = len(self.letters)
+        pieces = []
+        for piece in word.split(space):
+            forms = []
+            pending = [piece]
+            while pending:
+                text = pending.pop(0)
+                match = re.search(ALT_READING, text)
+                if match:
+                    pending[:0] = [text[:match.start()] + match.group(g) + text[match.end():] for g in (1, 2)]
+                    continue
+                if any(mark in text for mark in self.marks[3:]):
+                    continue
+                slots = []
+                count = 1
+                literal = ''
+                pos = 0
+                while pos < len(text):
+                    if sequence and text.startswith(sequence, pos):
+                        slots += [('lit', literal), ('seq', '')]
+                        count *= nletters ** 3 + nletters ** 2 + nletters
+                        pos += len(sequence)
+                    elif single and text.startswith(single, pos):
+                        slots += [('lit', literal), ('one', '')]
+                        count *= nletters
+                        pos += len(single)
+                    else:
+                        literal += text[pos]
+                        pos += 1
+                        continue
+                    literal = ''
+                slots.append(('lit', literal))
+                forms.append((slots, count))
+            pieces.append((forms, sum(count for slots, count in forms)))
+        return pieces
+
+    def _prune(self, trie):
+        '''
+        Make the alternatives whose words are all in a vocabulary trie, in the order of
+        altgen_prune.
+
+        Returns:
+            (list of str): the alternatives kept
+        '''
+        kept = []
+
+        def step(node, text):
+            for char in text:
+                node = node.get(char)
+                if node is None:
+                    return None
+            return node
+
+        def walk_piece(ip, node, text):
+            for slots, count in self._pieces[ip][0]:
+                walk_slot(ip, slots, 0, node, text)
+
+        def end_piece(ip, node, text):
+            # A space or the end of the alternative needs a whole word
+            if ip == len(self._pieces) - 1:
+                if '' in node:
+                    kept.append(text)
+                return
+            walk_piece(ip + 1, node, text)
+            if '' in node:
+                walk_piece(ip + 1, trie, text + ' ')
+
+        def walk_letters(ip, slots, k, n, node, text):
+            if n == 0:
+                walk_slot(ip, slots, k + 1, node, text)
+                return
+            for letter in self.letters:
+                child = step(node, letter)
+                if child is not None:
+                    walk_letters(ip, slots, k, n - 1, child, text + letter)
+
+        def walk_slot(ip, slots, k, node, text):
+            if k == len(slots):
+                end_piece(ip, node, text)
+                return
+            kind, literal = slots[k]
+            if kind == 'lit':
+                node = step(node, literal)
+                if node is not None:
+                    walk_slot(ip, slots, k + 1, node, text + literal)
+            else:
+                for n in ((1,) if kind == 'one' else (3, 2, 1)):
+                    walk_letters(ip, slots, k, n, node, text)
+
+        walk_piece(0, trie, '')
+        return kept
+
+    def _make(self, index):
+        '''
+        Make one alternative, numbered as in altgen.c.
+        '''
+        if self._kept is not None:
+            return self._kept[index]
+        nletters = len(self.letters)
+        joins = index % 2 ** (len(self._pieces) - 1)
+        index //= 2 ** (len(self._pieces) - 1)
+        choices = []
+        for forms, count in reversed(self._pieces):
+            choices.append(index % count)
+            index //= count
+        result = ''
+        for i, ((forms, count), r) in enumerate(zip(self._pieces, reversed(choices))):
+            if i > 0 and (joins >> (len(self._pieces) - 1 - i)) & 1:
+                result += ' '
+            for slots, n in forms:
+                if r < n:
+                    break
+                r -= n
+            digits = []
+            for kind, text in reversed(slots):
+                size = {'one': nletters, 'seq': nletters ** 3 + nletters ** 2 + nletters}.get(kind, 1)
+                digits.append(r % size)
+                r //= size
+            for (kind, text), d in zip(slots, reversed(digits)):
+                if kind == 'one':
+                    result += self.letters[d]
+                elif kind == 'seq':
+                    if d >= nletters ** 3 + nletters ** 2:
+                        result += self.letters[d - nletters ** 3 - nletters ** 2]
+                    elif d >= nletters ** 3:
+                        d -= nletters ** 3
+                        result += self.letters[d // nletters] + self.letters[d % nletters]
+                    else:
+                        result += self.letters[d // nletters ** 2] + self.letters[d // nletters % nletters] + \
+                            self.letters[d % nletters]
+                else:
+                    result += text
+        return result
+
+
 def contextualize_sentence(sentence, corrupted_sentence, uncertainty_chars,
-                           alphabet, convert_uncertainties=None, is_voynich=False):
+                           alphabet, convert_uncertainties=None, is_voynich=False,
+                           vocabulary=None):
     '''
     Generate a list of Uncertainty from a corrupted sentence, eventually
     converting all uncertainties to a single character.
@@ -158,6 +484,8 @@ def contextualize_sentence(sentence, corrupted_sentence, uncertainty_chars,
             specified character and keep them in the training sentence and in context
         is_voynich (bool): True if sentence is from the Voynich manuscript
             (hence, already corrupted), False otherwise
+        vocabulary (Vocabulary): if not None, keep only the alternatives made
+            of words of the vocabulary
 
     Returns:
         (list of Uncertainty): list Uncertainty belonging to the corrupted sentence.
@@ -190,8 +518,7 @@ def contextualize_sentence(sentence, corrupted_sentence, uncertainty_chars,
         else:
             left_context = corrupted_clean_sentence.split(' ')[:index]
             right_context = corrupted_clean_sentence.split(' ')[index+1:]
-        alternatives_list = create_alternatives(word, uncertainty_chars, alphabet)
-        alternatives_list = list(set(alternatives_list))
+        alternatives_list = list(set(Alternatives(word, uncertainty_chars, alphabet, vocabulary=vocabulary)))
 
         if(is_voynich):
             correct_word = ''
@@ -204,8 +531,11 @@ def contextualize_sentence(sentence, corrupted_sentence, uncertainty_chars,
                                    ' '.join(words[index+1:]))[0]
             right_chars = ' ' * (len(right_chars)>0) + right_chars
 
+            # The correct word may be missing from the vocabulary
+            candidates = alternatives_list if vocabulary is None else \
+                set(Alternatives(word, uncertainty_chars, alphabet))
             correct_word = list(filter(lambda x: left_chars + x + right_chars
-                                       in sentence, alternatives_list))
+                                       in sentence, candidates))
             if(len(correct_word) != 1):
                 print(sentence)
                 print(corrupted_sentence)
@@ -1,7 +1,14 @@
+import os
+import ctypes
+from array import array
 import numpy as np
 import numpy.linalg as npl
 import pandas as pd
 
+# Native cosine scorer, built from software/wvscore.c
+WVSCORE_LIBRARY = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'software', 'libwvscore.so')
+_wvscore = None
+
 
 def predict_uncertain_word(model, context_left, context_right,
                            alternatives_list, how='cosine'):
@@ -11,7 +18,8 @@ def predict_uncertain_word(model, context_left, context_right,
     softmax probabilities.
 
     Args:
-        model (Word2Vec): embeddings trained model.
+        model (Word2Vec or EmbeddingScorer): embeddings trained model, or a scorer
+            of its embeddings for the 'cosine' option.
         context_left(list of str): context at the left of the uncertain word
         context_right(list of str): context at the right of the uncertain word
         alternatives_list (list of str): list of alternatives for replacing the uncertainty
@@ -22,6 +30,11 @@ def predict_uncertain_word(model, context_left, context_right,
         (list of (str, float)): similarities between alternatives and the missing word.
     '''
 
+    if(isinstance(model, EmbeddingScorer)):
+        if(how != 'cosine'):
+            raise RuntimeError('EmbeddingScorer only computes the \'cosine\' option')
+        return model.predict_uncertain_word(context_left, context_right, alternatives_list)
+
     context_global = context_left + context_right
 
     # If no context is given, assign 0 similarity to all the alternatives
@@ -177,3 +190,146 @@ def predict_and_evaluate_model(model, window, uncertainties_list, how='cosine'):
     y, predictions, types = predict_corruption(model, window, uncertainties_list, how)
     accuracies = evaluate_model(y, predictions, types)
     return accuracies
+
+
+def load_wvscore():
+    '''
+    Load the native cosine scorer.
+
+    Returns:
+        (ctypes.CDLL): the library, or None if it has not been built
+    '''
+    global _wvscore
+    if _wvscore is None:
+        try:
+            lib = ctypes.CDLL(WVSCORE_LIBRARY)
+        except OSError:
+            _wvscore = False
+            return None
+        # Arrays are passed by address, see EmbeddingScorer.predict_uncertain_word
+        ints = floats = ctypes.c_void_p
+        lib.wvs_open.restype = ctypes.c_void_p
+        lib.wvs_open.argtypes = [ctypes.c_char_p]
+        lib.wvs_rows.restype = ctypes.c_int
+        lib.wvs_rows.argtypes = [ctypes.c_void_p]
+        lib.wvs_dim.restype = ctypes.c_int
+        lib.wvs_dim.argtypes = [ctypes.c_void_p]
+        lib.wvs_words.restype = ctypes.c_int
+        lib.wvs_words.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+        lib.wvs_find.restype = ctypes.c_int
+        lib.wvs_find.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ints, ints]
+        lib.wvs_add.restype = ctypes.c_int
+        lib.wvs_add.argtypes = [ctypes.c_void_p, ctypes.c_char_p, floats]
+        lib.wvs_score.restype = ctypes.c_int
+        lib.wvs_score.argtypes = [ctypes.c_void_p, ints, ctypes.c_int, ints, ctypes.c_int,
+                                  ints, ints, ctypes.c_int, floats]
+        lib.wvs_close.restype = None
+        lib.wvs_close.argtypes = [ctypes.c_void_p]
+        _wvscore = lib
+    return _wvscore or None
+
+
+class EmbeddingScorer:
+    '''
+    Cosine scorer over embeddings mapped from a file, giving the same similarities as
+    predict_uncertain_word with how='cosine' for a whole list of alternatives in one
+    native call (software/wvscore.c). It can be passed as the model to the prediction
+    functions of this module.
+
+    The file is either a word2vec binary file, e.g. written with
+    model.wv.save_word2vec_format(path, binary=True), or a .npy matrix of float32,
+    e.g. written with np.save(path, model.wv.vectors), whose words are then given
+    in the order of the rows, e.g. model.wv.index_to_key.
+    '''
+
+    def __init__(self, path, words=None, model=None):
+        '''
+        Args:
+            path (str): name of the embedding file
+            words (list of str): words of the rows of a .npy file
+            model (Word2Vec or FastText): if not None, model asked for the vectors of the
+                words that are not in the file
+        '''
+        self._scorer = None
+        self._lib = lib = load_wvscore()
+        if lib is None:
+            raise OSError('Build ' + WVSCORE_LIBRARY + ' first, see software/wvscore.h')
+        self._scorer = lib.wvs_open(path.encode())
+        if not self._scorer:
+            raise ValueError(path + ' is not an embedding file')
+        text = None if words is None else '\n'.join(words).encode()
+        found = lib.wvs_words(self._scorer, text)
+        if found < 0:
+            raise ValueError(str(len(words)) + ' words for ' + str(lib.wvs_rows(self._scorer)) + ' rows')
+        if found == 0:
+            raise ValueError('The words of ' + path + ' must be given')
+        self.model = model
+
+    def __del__(self):
+        if self._scorer:
+            self._lib.wvs_close(self._scorer)
+            self._scorer = None
+
+    def rows(self, items):
+        '''
+        Rows of the words of some alternatives, adding those that are not in the file
+        from the model.
+
+        Args:
+            items (list of str): the alternatives, of one or more words
+
+        Returns:
+            (array of int): rows of all the words, one alternative after the other
+            (array of int): where the words of each alternative start, and their number
+        '''
+        text = '\n'.join(items).encode()
+        rows = array('i', bytes(4 * (text.count(b' ') + len(items))))
+        offsets = array('i', bytes(4 * (len(items) + 1)))
+        if self._lib.wvs_find(self._scorer, text, rows.buffer_info()[0], offsets.buffer_info()[0]) == 0:
+            return rows, offsets
+        for i, word in enumerate(text.replace(b'\n', b' ').split(b' ')):
+            if(rows[i] >= 0):
+                continue
+            if self.model is None:
+                raise KeyError('Key \'' + word.decode() + '\' not present')
+            vector = np.ascontiguousarray(self.model.wv[word.decode()], dtype=np.float32)
+            if self._lib.wvs_add(self._scorer, word, vector.ctypes.data) < 0:
+                raise MemoryError('Cannot add the vector of ' + word.decode())
+        self._lib.wvs_find(self._scorer, text, rows.buffer_info()[0], offsets.buffer_info()[0])
+        return rows, offsets
+
+    def predict_uncertain_word(self, context_left, context_right, alternatives_list):
+        '''
+        Rank the alternatives of an uncertain word by cosine similarity with the context,
+        as predict_uncertain_word does with how='cosine'.
+
+        Args:
+            context_left(list of str): context at the left of the uncertain word
+            context_right(list of str): context at the right of the uncertain word
+            alternatives_list (list of str): list of alternatives for replacing the uncertainty
+
+        Returns:
+            (list of (str, float)): similarities between alternatives and the missing word.
+        '''
+        if(len(context_left) + len(context_right) == 0):
+            return alternatives_list
+        if(len(alternatives_list) == 0):
+            return []
+
+        # The context words come first, one per item, then the alternatives
+        nleft = len(context_left)
+        ncontext = nleft + len(context_right)
+        rows, offsets = self.rows(context_left + context_right + alternatives_list)
+        scores = array('f', bytes(4 * len(alternatives_list)))
+        address = rows.buffer_info()[0]
+        if self._lib.wvs_score(self._scorer, address, nleft, address + 4 * nleft, ncontext - nleft,
+                               address, offsets.buffer_info()[0] + 4 * ncontext,
+                               len(alternatives_list), scores.buffer_info()[0]):
+            raise MemoryError('Cannot score the alternatives')
+
+        # Stable, like sorted with reverse=True
+        scores = np.frombuffer(scores, dtype=np.float32)
+        order = np.argsort(-scores, kind='stable')
+        alternatives_similarity = list(zip(map(alternatives_list.__getitem__, order.tolist()),
+                                           scores[order].tolist()))
+        return alternatives_similarity